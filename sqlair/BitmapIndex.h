@@ -0,0 +1,129 @@
+#ifndef BITMAP_INDEX_H
+#define BITMAP_INDEX_H
+
+/**
+ * A bitmap index for a column in a CSV. The index maintains a compressed
+ * bitmap of rows for each distinct value in the column. Equality conditions
+ * and counts are answered directly from the bitmaps without checking the
+ * rows. Bitmap indexes are best suited for low-cardinality columns.
+ */
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include "RowBitmap.h"
+
+/**
+ * An MT-safe bitmap index for one column. The bitmaps are copy-on-write.
+ * Hence, bitmaps returned by find() are immutable snapshots that remain
+ * valid (and unchanged) even if the index is subsequently modified.
+ */
+class BitmapIndex {
+public:
+    /**
+     * Add the value in a new row (for example, from a newly loaded or
+     * inserted row) to the index.
+     *
+     * @param rowIdx The zero-based index of the row with the value.
+     *
+     * @param value The value in this column in the row.
+     */
+    void add(size_t rowIdx, const std::string& value) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        modifiable(value).add(rowIdx);
+    }
+
+    /**
+     * Update the index when the value in a row is changed.
+     *
+     * @param rowIdx The zero-based index of the row being updated.
+     *
+     * @param oldValue The value in the row before it was updated.
+     *
+     * @param newValue The new value being set in the row.
+     */
+    void update(size_t rowIdx, const std::string& oldValue,
+                const std::string& newValue) {
+        if (oldValue == newValue) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        modifiable(oldValue).remove(rowIdx);
+        if (bitmaps[oldValue]->count() == 0) {
+            bitmaps.erase(oldValue);
+        }
+        modifiable(newValue).add(rowIdx);
+    }
+
+    /**
+     * Obtain the rows with a given value.
+     *
+     * @param value The value to be looked-up.
+     *
+     * @return A snapshot of the bitmap of rows with the value. If no rows
+     * have the value, then the bitmap is empty.
+     */
+    std::shared_ptr<const RowBitmap> find(const std::string& value) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        const auto entry = bitmaps.find(value);
+        return (entry != bitmaps.end() ? entry->second :
+                std::make_shared<const RowBitmap>());
+    }
+
+    /**
+     * Obtain the number of distinct values in the index.
+     *
+     * @return The number of distinct values.
+     */
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return bitmaps.size();
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this index.
+     *
+     * @return An estimate of the memory used by this index.
+     */
+    size_t memoryUsage() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        size_t bytes = sizeof(*this) + bitmaps.bucket_count() * sizeof(void*);
+        for (const auto& entry : bitmaps) {
+            bytes += sizeof(entry) + entry.first.capacity() +
+                entry.second->memoryUsage();
+        }
+        return bytes;
+    }
+
+private:
+    /**
+     * Helper method to obtain a bitmap that can be modified. If the current
+     * bitmap for the value is shared (with a snapshot returned by find), a
+     * copy is made and used.
+     *
+     * @note This method must be called with the mutex locked.
+     *
+     * @param value The value whose bitmap is to be modified.
+     *
+     * @return The bitmap that can be modified.
+     */
+    RowBitmap& modifiable(const std::string& value) {
+        auto& bitmap = bitmaps[value];
+        if (!bitmap) {
+            bitmap = std::make_shared<RowBitmap>();
+        } else if (bitmap.use_count() > 1) {
+            bitmap = std::make_shared<RowBitmap>(*bitmap);
+        }
+        return *bitmap;
+    }
+
+    /** The bitmap of rows for each distinct value. */
+    std::unordered_map<std::string, std::shared_ptr<RowBitmap>> bitmaps;
+
+    /** Reader-writer lock to enable MT-safe access to the bitmaps. */
+    mutable std::shared_mutex mutex;
+};
+
+#endif /* BITMAP_INDEX_H */
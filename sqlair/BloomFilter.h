@@ -0,0 +1,237 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+/**
+ * Per-block Bloom filters for a column in a CSV. The filter for a block of
+ * rows can quickly (and conservatively) determine if any row in the block
+ * may have a given value. Scans with equality conditions use the filters to
+ * skip blocks that cannot have the value.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "ZoneMap.h"
+
+/**
+ * The Bloom filters for one column in a CSV, one filter for each block of
+ * ZoneMap::BlockSize rows.  Values can be added to a filter but not removed.
+ * Hence, when a value in a row is updated the new value is added and the
+ * old value remains in the filter. Once a block has had many updates, its
+ * filter is stale (i.e., has many false positives) and should be rebuilt
+ * via the rebuild() method.
+ */
+class BloomFilter {
+public:
+    /** The number of bits in the filter for each row in a block. */
+    static constexpr size_t BitsPerRow = 8;
+
+    /** The number of bits set for each value. */
+    static constexpr size_t NumHashes = 5;
+
+    /** The number of updates after which the filter for a block is stale. */
+    static constexpr size_t MaxUpdates = ZoneMap::BlockSize / 8;
+
+    /** The bits in the filter for a block of rows. */
+    using Bits = std::vector<uint64_t>;
+
+    /**
+     * Add a value in a new row (for example, from a newly loaded or inserted
+     * row) to the filter for the row's block.
+     *
+     * @param rowIdx The zero-based index of the row with the value.
+     *
+     * @param value The value in this column in the row.
+     */
+    void add(size_t rowIdx, const std::string& value) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (rowIdx / ZoneMap::BlockSize >= blocks.size()) {
+            blocks.resize(rowIdx / ZoneMap::BlockSize + 1);
+        }
+        include(blocks[rowIdx / ZoneMap::BlockSize].bits, value);
+    }
+
+    /**
+     * Add the new value set in some rows of a block to the block's filter.
+     * The value is hashed and added just once for all the rows.
+     *
+     * @param block The zero-based index of the block with the rows.
+     *
+     * @param numRows The number of rows in the block being updated.
+     *
+     * @param newValue The new value being set in the rows.
+     */
+    void update(size_t block, size_t numRows, const std::string& newValue) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (block < blocks.size() && numRows > 0) {
+            include(blocks[block].bits, newValue);
+            blocks[block].numUpdates += numRows;
+        }
+    }
+
+    /**
+     * Determine which blocks may have rows with a given value.
+     *
+     * @param value The value to be checked.
+     *
+     * @return A flag for each block indicating if the block may have rows
+     * with the value. Rows in blocks added after this call may have the
+     * value.
+     */
+    std::vector<bool> mayContain(const std::string& value) const {
+        const auto hashes = hash(value);
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        std::vector<bool> flags(blocks.size(), true);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            flags[i] = contains(blocks[i].bits, hashes);
+        }
+        return flags;
+    }
+
+    /**
+     * Obtain the blocks whose filters are stale due to many updates.
+     *
+     * @return The index of each stale block.
+     */
+    std::vector<size_t> getStaleBlocks() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        std::vector<size_t> stale;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (blocks[i].numUpdates > MaxUpdates) {
+                stale.push_back(i);
+            }
+        }
+        return stale;
+    }
+
+    /**
+     * Rebuild the filter for a given block from the current values in the
+     * block. The filter is not locked while the values are gathered. If
+     * rows in the block are updated in the meantime, the rebuilt filter is
+     * discarded (as it may not have the new values) and the block remains
+     * stale.
+     *
+     * @param block The index of the block to be rebuilt.
+     *
+     * @param forEachValue A function that is called with a callback. The
+     * function must call the callback with the current value in each row in
+     * the block.
+     */
+    void rebuild(size_t block,
+                 const std::function<void(const std::function<void(
+                     const std::string&)>&)>& forEachValue) {
+        size_t numUpdates;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            if (block >= blocks.size()) {
+                return;
+            }
+            numUpdates = blocks[block].numUpdates;
+        }
+        Bits bits;
+        forEachValue([&bits](const std::string& value) {
+            include(bits, value);
+        });
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (blocks[block].numUpdates == numUpdates) {
+            blocks[block].bits = std::move(bits);
+            blocks[block].numUpdates = 0;
+        }
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this filter.
+     *
+     * @return An estimate of the memory used by this filter.
+     */
+    size_t memoryUsage() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        size_t bytes = sizeof(*this) + blocks.capacity() * sizeof(Block);
+        for (const auto& block : blocks) {
+            bytes += block.bits.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+private:
+    /** The number of bits in the filter for each block. */
+    static constexpr size_t NumBits = ZoneMap::BlockSize * BitsPerRow;
+
+    /** The filter for one block of rows. */
+    struct Block {
+        /** The bits in the filter. Empty until a value is added. */
+        Bits bits;
+        /** The number of updates since the filter was built. */
+        size_t numUpdates = 0;
+    };
+
+    /**
+     * Helper method to compute the pair of hashes for a value. The bit
+     * positions are derived from the pair via double hashing.
+     *
+     * @param value The value to be hashed.
+     *
+     * @return A pair of hashes for the value.
+     */
+    static std::pair<uint64_t, uint64_t> hash(std::string_view value) {
+        const uint64_t h1 = std::hash<std::string_view>()(value);
+        // Mix the bits (the multiplier is from splitmix64) for the second
+        // hash; it must be odd so that it cycles through all positions.
+        const uint64_t h2 = ((h1 ^ (h1 >> 31)) * 0xbf58476d1ce4e5b9ULL) | 1;
+        return {h1, h2};
+    }
+
+    /**
+     * Helper method to set the bits for a value in a filter.
+     *
+     * @param bits The bits of the filter to be updated.
+     *
+     * @param value The value to be added to the filter.
+     */
+    static void include(Bits& bits, const std::string& value) {
+        if (bits.empty()) {
+            bits.resize(NumBits / 64);
+        }
+        const auto hashes = hash(value);
+        for (size_t i = 0; i < NumHashes; i++) {
+            const size_t bit = (hashes.first + i * hashes.second) % NumBits;
+            bits[bit / 64] |= (uint64_t(1) << (bit % 64));
+        }
+    }
+
+    /**
+     * Helper method to check if the bits for a value are set in a filter.
+     *
+     * @param bits The bits of the filter to be checked.
+     *
+     * @param hashes The hashes for the value returned by hash().
+     *
+     * @return This method returns true if the filter may have the value.
+     */
+    static bool contains(const Bits& bits,
+                         const std::pair<uint64_t, uint64_t>& hashes) {
+        if (bits.empty()) {
+            return false;  // No values in this block
+        }
+        for (size_t i = 0; i < NumHashes; i++) {
+            const size_t bit = (hashes.first + i * hashes.second) % NumBits;
+            if ((bits[bit / 64] & (uint64_t(1) << (bit % 64))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** The filter for each block of rows. */
+    std::vector<Block> blocks;
+
+    /** Reader-writer lock to enable MT-safe access to the blocks. */
+    mutable std::shared_mutex mutex;
+};
+
+#endif /* BLOOM_FILTER_H */
@@ -10,11 +10,21 @@
  * Copyright (C) 2021 raodm@miamioh.edu
  */
 
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <thread>
 #include <condition_variable>
+#include "BitmapIndex.h"
+#include "BloomFilter.h"
+#include "ColumnDictionary.h"
+#include "RowBitmap.h"
+#include "SpatialIndex.h"
+#include "TextIndex.h"
+#include "ZoneMap.h"
 
 /** A short cut to refer to a vector of strings */
 using StrVec = std::vector<std::string>;
@@ -44,8 +54,9 @@ public:
      * moved or copied.
      * 
      * @param row The source object from where data is to be moved.
+     * It is noexcept so that rows are moved (not copied) when a CSV grows.
      */
-    CSVRow(CSVRow&& row) : StrVec(std::move(row)) {}
+    CSVRow(CSVRow&& row) noexcept : StrVec(std::move(row)) {}
     
     /** Convenience constructor to create a row with given data.
      * 
@@ -145,6 +156,208 @@ public:
      */
     int getColumnCount() const { return colNames.size(); }
 
+    /**
+     * Obtain an estimate of the number of bytes of memory used by this CSV.
+     * The estimate includes the rows, the cells in each row, and any
+     * out-of-line character data in each cell.  It is used to enforce the
+     * memory budget on in-memory CSVs.
+     *
+     * \note This method iterates over every cell. So do not call it
+     * while other threads may be modifying this CSV.
+     *
+     * \return An estimate of the number of bytes used by this CSV.
+     */
+    size_t memoryUsage() const {
+        size_t bytes = sizeof(CSV) + capacity() * sizeof(CSVRow);
+        for (const auto& row : *this) {
+            bytes += rowMemory(row);
+        }
+        for (const auto& dict : dictionaries) {
+            bytes += (dict ? dict->memoryUsage() : 0);
+        }
+        for (const auto& zoneMap : zoneMaps) {
+            bytes += (zoneMap ? zoneMap->memoryUsage() : 0);
+        }
+        for (const auto& filter : bloomFilters) {
+            bytes += (filter ? filter->memoryUsage() : 0);
+        }
+        for (const auto& index : bitmapIndexes) {
+            bytes += (index ? index->memoryUsage() : 0);
+        }
+        for (const auto& index : textIndexes) {
+            bytes += (index ? index->memoryUsage() : 0);
+        }
+        bytes += (spatialIndex ? spatialIndex->memoryUsage() : 0);
+        bytes += bitmapCache.memoryUsage();
+        return bytes;
+    }
+
+    /**
+     * Obtain the memory used by a row, excluding the CSVRow object itself.
+     *
+     * \param[in] row The row whose memory is to be returned.
+     *
+     * \return The bytes used by the cells of the row.
+     */
+    static size_t rowMemory(const CSVRow& row) {
+        size_t bytes = row.capacity() * sizeof(std::string);
+        for (const auto& cell : row) {
+            bytes += cellMemory(cell);
+        }
+        return bytes;
+    }
+
+    /**
+     * Obtain the memory allocated (on the heap) for a cell.
+     *
+     * \param[in] cell The cell whose memory is to be returned.
+     *
+     * \return The bytes allocated for the cell. It is zero for short
+     * strings that are stored in-line (small string optimization).
+     */
+    static size_t cellMemory(const std::string& cell) {
+        const size_t inlineCap = std::string().capacity();
+        return (cell.capacity() > inlineCap ? cell.capacity() + 1 : 0);
+    }
+
+    /**
+     * Obtain the estimated memory used by this CSV. Unlike memoryUsage(),
+     * this method is cheap. The estimate is set by measureMemory() and is
+     * adjusted (via addMemory()) as rows are added or changed.
+     *
+     * \return The estimated memory (in bytes) used by this CSV.
+     */
+    size_t getMemoryEstimate() const { return memoryEstimate; }
+
+    /**
+     * Set the memory estimate to the memory used by this CSV. This method
+     * must be called when the CSV is loaded, indexed, or rebuilt (e.g., by
+     * a delete), with the rows not being modified concurrently.
+     */
+    void measureMemory() { memoryEstimate = memoryUsage(); }
+
+    /**
+     * Adjust the memory estimate of this CSV (see getMemoryEstimate()).
+     *
+     * \param[in] bytes The change in the memory used. A reduction is
+     * passed as its (unsigned) negation, which wraps around.
+     */
+    void addMemory(const size_t bytes) { memoryEstimate += bytes; }
+
+    /**
+     * Record that the data in this CSV has been modified (via an update,
+     * insert, or delete). This method marks the CSV as dirty and bumps its
+     * version, which invalidates the bitmaps in bitmapCache.
+     *
+     * It also wakes up the threads waiting (in waitForChange()) for the
+     * CSV to be modified.
+     *
+     * \note This method must be called after the rows have been modified.
+     */
+    void markModified() {
+        dirty = true;
+        {
+            // The version is bumped while holding csvMutex so that a thread
+            // about to wait in waitForChange() cannot miss the wake-up.
+            std::scoped_lock<std::mutex> lock(csvMutex);
+            version++;
+        }
+        csvCondVar.notify_all();
+    }
+
+    /**
+     * Block the calling thread until this CSV is modified after a given
+     * version. The version must be noted before the rows are checked (e.g.,
+     * for "wait" queries), so that modifications made while checking the
+     * rows are not missed.
+     *
+     * \param[in] seenVersion The version of the CSV when the rows were
+     * checked.
+     */
+    void waitForChange(const size_t seenVersion) {
+        std::unique_lock<std::mutex> lock(csvMutex);
+        csvCondVar.wait(lock, [&] { return version != seenVersion; });
+    }
+
+    /**
+     * Obtain the dictionary encoding for a given column, if any.
+     *
+     * \param[in] colIdx The zero-based index of the column.
+     *
+     * \return The dictionary for the column. If the column is not
+     * dictionary encoded, then this method returns nullptr.
+     */
+    ColumnDictionary* getDictionary(int colIdx) const {
+        return (colIdx >= 0 && colIdx < static_cast<int>(dictionaries.size()) ?
+                dictionaries[colIdx].get() : nullptr);
+    }
+
+    /**
+     * Obtain the zone map for a given column, if any.
+     *
+     * \param[in] colIdx The zero-based index of the column.
+     *
+     * \return The zone map for the column. If the column does not have a
+     * zone map, then this method returns nullptr.
+     */
+    ZoneMap* getZoneMap(int colIdx) const {
+        return (colIdx >= 0 && colIdx < static_cast<int>(zoneMaps.size()) ?
+                zoneMaps[colIdx].get() : nullptr);
+    }
+
+    /**
+     * Obtain the per-block Bloom filters for a given column, if any.
+     *
+     * \param[in] colIdx The zero-based index of the column.
+     *
+     * \return The Bloom filters for the column. If the column does not
+     * have Bloom filters, then this method returns nullptr.
+     */
+    BloomFilter* getBloomFilter(int colIdx) const {
+        return (colIdx >= 0 && colIdx < static_cast<int>(bloomFilters.size()) ?
+                bloomFilters[colIdx].get() : nullptr);
+    }
+
+    /**
+     * Obtain the bitmap index for a given column, if any.
+     *
+     * \param[in] colIdx The zero-based index of the column.
+     *
+     * \return The bitmap index for the column. If the column does not
+     * have a bitmap index, then this method returns nullptr.
+     */
+    BitmapIndex* getBitmapIndex(int colIdx) const {
+        return (colIdx >= 0 && colIdx < static_cast<int>(bitmapIndexes.size()) ?
+                bitmapIndexes[colIdx].get() : nullptr);
+    }
+
+    /**
+     * Obtain the full-text index for a given column, if any.
+     *
+     * \param[in] colIdx The zero-based index of the column.
+     *
+     * \return The full-text index for the column. If the column does not
+     * have a full-text index, then this method returns nullptr.
+     */
+    TextIndex* getTextIndex(int colIdx) const {
+        return (colIdx >= 0 && colIdx < static_cast<int>(textIndexes.size()) ?
+                textIndexes[colIdx].get() : nullptr);
+    }
+
+    /**
+     * Obtain the spatial index that includes a given column, if any.
+     *
+     * \param[in] colIdx The zero-based index of the column.
+     *
+     * \return The spatial index whose latitude or longitude column is the
+     * given column. Otherwise, this method returns nullptr.
+     */
+    SpatialIndex* getSpatialIndex(int colIdx) const {
+        return (spatialIndex && (spatialIndex->getLatColumn() == colIdx ||
+                                 spatialIndex->getLonColumn() == colIdx) ?
+                spatialIndex.get() : nullptr);
+    }
+
     /**
      * Returns the names of the columns in the order in which they
      * appear in the CSV.
@@ -176,6 +389,20 @@ public:
         return (iter != colNames.end() ? iter->second : -1);
     }
 
+    /**
+     * Set the names of the columns in this CSV. This method is used by
+     * loaders other than load(), which sets the names from the header.
+     *
+     * \param[in] names The names of the columns in the order in which
+     * they appear in each row. The names must be distinct.
+     */
+    void setColumnNames(const StrVec& names) {
+        colNames.clear();
+        for (size_t i = 0; i < names.size(); i++) {
+            colNames[names[i]] = i;
+        }
+    }
+
     /**
      * API method to move the data from a given CSV
      * 
@@ -317,6 +544,89 @@ private:
      * indicates the zero-based column number.
      */
     std::unordered_map<std::string, int> colNames;
+
+public:
+    // The following members are intentionally declared after colNames so
+    // that the layout of the members used by the precompiled CSV methods
+    // remains unchanged.
+
+    /**
+     * Flag to indicate that this CSV has been modified (via an update,
+     * insert, or delete) since it was loaded or last saved.  A dirty CSV is
+     * spilled to a temporary file (rather than just discarded) when it is
+     * evicted from memory.
+     */
+    std::atomic<bool> dirty = {false};
+
+    /**
+     * The version of the data in this CSV. It is incremented each time the
+     * CSV is modified. See markModified().
+     */
+    std::atomic<size_t> version = {0};
+
+    /**
+     * The estimated memory (in bytes) used by this CSV. See
+     * getMemoryEstimate().
+     */
+    std::atomic<size_t> memoryEstimate = {0};
+
+    /**
+     * The cache of bitmaps of rows that meet the conditions in recent
+     * queries on this CSV.
+     */
+    BitmapCache bitmapCache;
+
+    /**
+     * The dictionary encoding for low-cardinality columns. The vector is
+     * indexed by column number and the entry for a column that is not
+     * dictionary encoded is nullptr. The dictionaries are built by SQLAir
+     * after the CSV is loaded.
+     */
+    std::vector<std::unique_ptr<ColumnDictionary>> dictionaries;
+
+    /**
+     * The zone maps (per-block summaries) for each column. The vector is
+     * indexed by column number. The zone maps are built by SQLAir after the
+     * CSV is loaded.
+     */
+    std::vector<std::unique_ptr<ZoneMap>> zoneMaps;
+
+    /**
+     * The optional per-block Bloom filters for each column. The vector is
+     * indexed by column number and the entry for a column without Bloom
+     * filters is nullptr. The filters are built by SQLAir after the CSV is
+     * loaded.
+     */
+    std::vector<std::unique_ptr<BloomFilter>> bloomFilters;
+
+    /**
+     * The bitmap indexes explicitly created (via "create bitmap index") on
+     * columns. The vector is indexed by column number and the entry for a
+     * column without a bitmap index is nullptr.
+     */
+    std::vector<std::unique_ptr<BitmapIndex>> bitmapIndexes;
+
+    /**
+     * The full-text indexes explicitly created (via "create text index") on
+     * columns. The vector is indexed by column number and the entry for a
+     * column without a full-text index is nullptr.
+     */
+    std::vector<std::unique_ptr<TextIndex>> textIndexes;
+
+    /**
+     * The spatial index explicitly created (via "create spatial index") on
+     * a pair of latitude and longitude columns, if any. A CSV has at most
+     * one spatial index.
+     */
+    std::unique_ptr<SpatialIndex> spatialIndex;
+
+    /**
+     * Reader-writer lock for operations that scan the rows of this CSV.
+     * Queries that read or update rows in place hold it shared, while
+     * operations that add, remove, or renumber rows (which may reallocate
+     * the rows) hold it exclusively.
+     */
+    std::shared_mutex tableMutex;
 };
 
 #endif
@@ -0,0 +1,153 @@
+#ifndef COLUMN_DICTIONARY_H
+#define COLUMN_DICTIONARY_H
+
+/**
+ * A dictionary encoding for low-cardinality columns in a CSV. Each distinct
+ * value in the column is assigned a small integer code and each row stores
+ * the code of its value. Conditions in "where" clauses can then be evaluated
+ * once per distinct value rather than once per row.
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "StringArena.h"
+
+/**
+ * A dictionary of distinct values in a column of a CSV along with the code
+ * of the value in each row.  The values in the dictionary are never removed
+ * (until the dictionary is rebuilt). Hence, codes are stable.
+ *
+ * The rows of the CSV keep their values (as the rows are vectors of
+ * strings). So a dictionary adds about sizeof(Code) bytes per row, plus the
+ * distinct values, to the memory used by a CSV. That is, it speeds-up
+ * filters rather than saving memory. See memoryUsage(). Hence, columns are
+ * encoded only if it is enabled (see SQLAir::setDictionaryEncoding()).
+ *
+ * @note The dictionary itself is MT-safe. However, the code for a given row
+ * (in rowCodes) must be accessed only while holding the rowMutex of the
+ * corresponding CSVRow -- just like the value in the row.
+ */
+class ColumnDictionary {
+public:
+    /** The type used to represent the code for each value */
+    using Code = uint32_t;
+
+    /** The code used for rows whose value is not in the dictionary */
+    static constexpr Code NoCode = UINT32_MAX;
+
+    /**
+     * Create an empty dictionary that can hold a given number of values.
+     *
+     * @param maxSize The maximum number of distinct values. Once the
+     * dictionary is full, rows with new values are assigned NoCode.
+     */
+    explicit ColumnDictionary(size_t maxSize) :
+        maxSize(maxSize), arena(4096) {}
+
+    /**
+     * Obtain the code for a given value, adding the value to the dictionary
+     * if it is not already present.
+     *
+     * @param value The value to be encoded.
+     *
+     * @return The code for the value. If the value is not in the dictionary
+     * and the dictionary is full, then this method returns NoCode.
+     */
+    Code encode(const std::string& value) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            const auto entry = codes.find(value);
+            if (entry != codes.end()) {
+                return entry->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        const auto entry = codes.find(value);
+        if (entry != codes.end()) {
+            return entry->second;  // Added by another thread
+        }
+        if (values.size() >= maxSize) {
+            return NoCode;
+        }
+        // The characters are stored in the arena, which never moves them.
+        values.push_back(arena.store(value));
+        return codes[values.back()] = static_cast<Code>(values.size() - 1);
+    }
+
+    /**
+     * Obtain the code for a given value without changing the dictionary.
+     *
+     * @param value The value to be looked-up.
+     *
+     * @return The code for the value or NoCode if the value is not present.
+     */
+    Code find(const std::string& value) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        const auto entry = codes.find(value);
+        return (entry != codes.end() ? entry->second : NoCode);
+    }
+
+    /**
+     * Call a given function for each distinct value in the dictionary, in
+     * the order of their codes (i.e., 0, 1, 2, ...).
+     *
+     * @note The dictionary is locked while the function is called. Hence,
+     * the function must not try to add values to this dictionary.
+     *
+     * @param fn The function to be called. It is passed a std::string_view
+     * with each value.
+     */
+    template<typename Function>
+    void forEachValue(Function fn) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        for (const auto& val : values) {
+            fn(val);
+        }
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this dictionary.
+     *
+     * @return An estimate of the memory used by this dictionary.
+     */
+    size_t memoryUsage() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        // Each entry in the unordered_map is approximately a node with a
+        // next-pointer, cached hash, the view, and the code.
+        const size_t entryBytes = 2 * sizeof(void*) +
+            sizeof(std::string_view) + sizeof(Code);
+        return sizeof(*this) + rowCodes.capacity() * sizeof(Code) +
+            values.capacity() * sizeof(std::string_view) +
+            codes.size() * entryBytes +
+            codes.bucket_count() * sizeof(void*) + arena.memoryUsage();
+    }
+
+    /**
+     * The code of the value in each row. See the note on the class regarding
+     * MT-safe access to this vector.
+     */
+    std::vector<Code> rowCodes;
+
+private:
+    /** The maximum number of distinct values in this dictionary. */
+    const size_t maxSize;
+
+    /** The distinct values. The index of each value is its code. */
+    std::vector<std::string_view> values;
+
+    /** The arena holding the characters of the distinct values. */
+    StringArena arena;
+
+    /** Map to look-up the code for a value in the values vector. */
+    std::unordered_map<std::string_view, Code> codes;
+
+    /** Reader-writer lock to enable MT-safe access to values and codes. */
+    mutable std::shared_mutex mutex;
+};
+
+#endif /* COLUMN_DICTIONARY_H */
@@ -0,0 +1,484 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+/**
+ * Expressions (e.g., "raters + 1" or "upper(title) || ' - ' || year") in
+ * the select list and the set clause of queries. An expression is compiled
+ * into a tree of typed evaluators. Each evaluator processes a batch of rows
+ * at a time (rather than one row at a time) and produces a vector of numbers
+ * or strings. Hence, the inner loops are simple loops over vectors.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CSV.h"
+#include "Helper.h"
+
+/** Shortcut to a compiled expression */
+using ExprPtr = std::shared_ptr<const class Expr>;
+
+/**
+ * The base class for compiled expressions. The tokens of an expression
+ * are compiled via Expr::compile(). The operators, from the lowest to the
+ * highest precedence, are: "||" (concatenation), "+" and "-", "*" and "/",
+ * and unary "-". The functions are upper(str), lower(str), and
+ * substr(str, start [, length]), where start is 1-based. Operators must be
+ * separated from their operands by spaces (e.g., "raters + 1"), except for
+ * a unary "-" before a number or column (e.g., "-raters"). Tokens that are
+ * neither column names nor numbers are string literals.
+ *
+ * The commas between expressions in a list (and between arguments to a
+ * function) are not tokens. An expression ends at the first token after an
+ * operand that is not an operator. Hence, "raters, -rating" is a list of two
+ * expressions while "raters, - rating" is one expression.
+ *
+ * Numbers are computed as doubles. Arithmetic on values that are not numbers
+ * (and division by zero) results in an empty value.
+ */
+class Expr {
+public:
+    /** The type of the values produced by an expression */
+    enum class Type { Number, Text };
+
+    /** A virtual destructor, as this class is a polymorphic base class. */
+    virtual ~Expr() {}
+
+    /**
+     * Obtain the type of values produced by this expression.
+     *
+     * @return The type of values produced by this expression.
+     */
+    Type getType() const { return type; }
+
+    /**
+     * Obtain the text of this expression. It is used as the column name
+     * when the values of the expression are printed.
+     *
+     * @return The text of this expression (e.g., "raters + 1").
+     */
+    const std::string& getText() const { return text; }
+
+    /**
+     * Obtain the column (if any) referenced by this expression on its own.
+     *
+     * @return The index of the column, if this expression is just a
+     * column name. Otherwise this method returns -1.
+     */
+    virtual int getColumn() const { return -1; }
+
+    /**
+     * Evaluate this expression as numbers for a batch of rows. By default,
+     * the text values of the expression are converted to numbers.
+     *
+     * @note The caller must ensure that the rows are not concurrently
+     * modified (e.g., by holding the table lock of the CSV).
+     *
+     * @param csv The CSV with the rows.
+     *
+     * @param rows The indexes of the rows for which the expression is to be
+     * evaluated.
+     *
+     * @param[out] out The value of the expression for each row. Values
+     * that are not numbers are NaN.
+     */
+    virtual void eval(const CSV& csv, const std::vector<size_t>& rows,
+                      std::vector<double>& out) const {
+        StrVec values;
+        eval(csv, rows, values);
+        out.resize(values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            out[i] = toNumber(values[i]);
+        }
+    }
+
+    /**
+     * Evaluate this expression as strings for a batch of rows. By default,
+     * the numeric values of the expression are converted to strings.
+     *
+     * @note The caller must ensure that the rows are not concurrently
+     * modified (e.g., by holding the table lock of the CSV).
+     *
+     * @param csv The CSV with the rows.
+     *
+     * @param rows The indexes of the rows for which the expression is to be
+     * evaluated.
+     *
+     * @param[out] out The value of the expression for each row.
+     */
+    virtual void eval(const CSV& csv, const std::vector<size_t>& rows,
+                      StrVec& out) const {
+        std::vector<double> numbers;
+        eval(csv, rows, numbers);
+        out.resize(numbers.size());
+        for (size_t i = 0; i < numbers.size(); i++) {
+            out[i] = toText(numbers[i]);
+        }
+    }
+
+    /**
+     * Compile an expression starting at a given token. Compilation stops
+     * at the first token (after an operand) that is not an operator. Hence,
+     * a list of expressions (e.g., "title, raters + 1") can be compiled by
+     * repeated calls.
+     *
+     * @param csv The CSV whose column names may be used in the expression.
+     *
+     * @param tokens The tokens of the query, with parentheses as separate
+     * tokens. See SQLAir::splitParens().
+     *
+     * @param[in,out] pos The index of the first token of the expression. It
+     * is updated to the index of the token after the expression.
+     *
+     * @return The compiled expression.
+     *
+     * @exception Exp This method throws an exception if the expression is
+     * invalid.
+     */
+    static ExprPtr compile(const CSV& csv, const StrVec& tokens, size_t& pos) {
+        return compile(csv, tokens, pos, 0);
+    }
+
+    /**
+     * Convert a string to a number.
+     *
+     * @param str The string to be converted.
+     *
+     * @return The number or NaN if the string is not a number.
+     */
+    static double toNumber(const std::string& str) {
+        double number = 0;
+        return ZoneMap::toNumber(str, number) ? number : NAN;
+    }
+
+    /**
+     * Convert a number to a string. Whole numbers are printed without a
+     * decimal point (e.g., "11" rather than "11.000000").
+     *
+     * @param number The number to be converted.
+     *
+     * @return The string or an empty string if the number is not finite.
+     */
+    static std::string toText(const double number) {
+        if (!std::isfinite(number)) {
+            return "";
+        }
+        if (number == std::trunc(number) && std::abs(number) < 1e15) {
+            return std::to_string(static_cast<long long>(number));
+        }
+        char str[32];
+        std::snprintf(str, sizeof(str), "%.15g", number);
+        return str;
+    }
+
+protected:
+    /**
+     * Constructor for use by the derived classes.
+     *
+     * @param type The type of values produced by the expression.
+     *
+     * @param text The text of the expression.
+     */
+    Expr(const Type type, const std::string& text) : type(type), text(text) {}
+
+private:
+    /**
+     * Helper method to compile the operators at a given precedence level
+     * (and higher) in an expression. See compile().
+     */
+    static std::shared_ptr<Expr> compile(const CSV& csv, const StrVec& tokens,
+                                         size_t& pos, const size_t level);
+
+    /**
+     * Helper method to compile an operand (a parenthesized expression,
+     * a unary "-", a function call, a column name, or a literal).
+     * See compile().
+     */
+    static std::shared_ptr<Expr> compileOperand(const CSV& csv,
+                                                const StrVec& tokens,
+                                                size_t& pos);
+
+    /** The type of values produced by this expression. */
+    Type type;
+
+    /** The text of this expression. */
+    std::string text;
+};
+
+/**
+ * An expression that is just a column name.
+ */
+class ColumnExpr : public Expr {
+public:
+    ColumnExpr(const int colIdx, const std::string& name) :
+        Expr(Type::Text, name), colIdx(colIdx) {}
+
+    int getColumn() const override { return colIdx; }
+
+    void eval(const CSV& csv, const std::vector<size_t>& rows,
+              std::vector<double>& out) const override {
+        out.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            out[i] = toNumber(csv[rows[i]][colIdx]);
+        }
+    }
+
+    void eval(const CSV& csv, const std::vector<size_t>& rows,
+              StrVec& out) const override {
+        out.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            out[i] = csv[rows[i]][colIdx];
+        }
+    }
+
+private:
+    /** The index of the column in the rows. */
+    const int colIdx;
+};
+
+/**
+ * A literal value. Literals that are numbers are of type Number but retain
+ * their text (e.g., "2.50") when evaluated as strings.
+ */
+class LiteralExpr : public Expr {
+public:
+    explicit LiteralExpr(const std::string& value) :
+        Expr(std::isnan(toNumber(value)) ? Type::Text : Type::Number, value),
+        number(toNumber(value)) {}
+
+    void eval(const CSV&, const std::vector<size_t>& rows,
+              std::vector<double>& out) const override {
+        out.assign(rows.size(), number);
+    }
+
+    void eval(const CSV&, const std::vector<size_t>& rows,
+              StrVec& out) const override {
+        out.assign(rows.size(), getText());
+    }
+
+private:
+    /** The value as a number (NaN if it is not a number). */
+    const double number;
+};
+
+/**
+ * An arithmetic operation ("+", "-", "*", or "/") on two numbers.
+ */
+class ArithmeticExpr : public Expr {
+public:
+    ArithmeticExpr(const char op, ExprPtr lhs, ExprPtr rhs,
+                   const std::string& text) :
+        Expr(Type::Number, text), op(op), lhs(lhs), rhs(rhs) {}
+
+    using Expr::eval;
+
+    void eval(const CSV& csv, const std::vector<size_t>& rows,
+              std::vector<double>& out) const override {
+        std::vector<double> rhsValues;
+        lhs->eval(csv, rows, out);
+        rhs->eval(csv, rows, rhsValues);
+        // The operator is checked once per batch rather than once per row.
+        const size_t size = out.size();
+        switch (op) {
+        case '+': for (size_t i = 0; i < size; i++) out[i] += rhsValues[i];
+            break;
+        case '-': for (size_t i = 0; i < size; i++) out[i] -= rhsValues[i];
+            break;
+        case '*': for (size_t i = 0; i < size; i++) out[i] *= rhsValues[i];
+            break;
+        default:  for (size_t i = 0; i < size; i++) out[i] /= rhsValues[i];
+        }
+    }
+
+private:
+    /** The operator, i.e., one of '+', '-', '*', or '/'. */
+    const char op;
+
+    /** The two operands of the operator. */
+    const ExprPtr lhs, rhs;
+};
+
+/**
+ * The concatenation ("||") of two strings.
+ */
+class ConcatExpr : public Expr {
+public:
+    ConcatExpr(ExprPtr lhs, ExprPtr rhs, const std::string& text) :
+        Expr(Type::Text, text), lhs(lhs), rhs(rhs) {}
+
+    using Expr::eval;
+
+    void eval(const CSV& csv, const std::vector<size_t>& rows,
+              StrVec& out) const override {
+        StrVec rhsValues;
+        lhs->eval(csv, rows, out);
+        rhs->eval(csv, rows, rhsValues);
+        for (size_t i = 0; i < out.size(); i++) {
+            out[i] += rhsValues[i];
+        }
+    }
+
+private:
+    /** The two strings to be concatenated. */
+    const ExprPtr lhs, rhs;
+};
+
+/**
+ * A call to one of the string functions upper, lower, or substr.
+ */
+class FunctionExpr : public Expr {
+public:
+    FunctionExpr(const std::string& name, const std::vector<ExprPtr>& args,
+                 const std::string& text) :
+        Expr(Type::Text, text), name(name), args(args) {}
+
+    using Expr::eval;
+
+    void eval(const CSV& csv, const std::vector<size_t>& rows,
+              StrVec& out) const override {
+        args.front()->eval(csv, rows, out);
+        if (name != "substr") {
+            const bool upper = (name == "upper");
+            for (auto& str : out) {
+                for (char& chr : str) {
+                    const unsigned char uchr = chr;
+                    chr = (upper ? std::toupper(uchr) : std::tolower(uchr));
+                }
+            }
+            return;
+        }
+        // Arguments of substr: start (1-based) and an optional length. The
+        // characters between start and start + length that are in the
+        // string are returned.
+        std::vector<double> start, length(rows.size(), 1e15);
+        args[1]->eval(csv, rows, start);
+        if (args.size() > 2) {
+            args[2]->eval(csv, rows, length);
+        }
+        for (size_t i = 0; i < out.size(); i++) {
+            if (std::isnan(start[i]) || std::isnan(length[i])) {
+                out[i].clear();
+                continue;
+            }
+            const double size = out[i].size();
+            const double first = std::clamp(start[i] - 1, 0.0, size);
+            const double last = std::clamp(start[i] - 1 + length[i], first,
+                                           size);
+            out[i] = out[i].substr(static_cast<size_t>(first),
+                                   static_cast<size_t>(last - first));
+        }
+    }
+
+    /**
+     * Obtain the number of arguments of a function.
+     *
+     * @param name The name of the function.
+     *
+     * @return The minimum and maximum number of arguments. If the name
+     * is not a function, then the maximum is zero.
+     */
+    static std::pair<size_t, size_t> getArgCount(const std::string& name) {
+        if (name == "upper" || name == "lower") {
+            return {1, 1};
+        }
+        return (name == "substr" ? std::make_pair(2, 3) :
+                std::make_pair(0, 0));
+    }
+
+private:
+    /** The name of the function. */
+    const std::string name;
+
+    /** The arguments to the function. */
+    const std::vector<ExprPtr> args;
+};
+
+inline std::shared_ptr<Expr> Expr::compile(const CSV& csv,
+                                           const StrVec& tokens, size_t& pos,
+                                           const size_t level) {
+    static const std::vector<StrVec> Operators = {{"||"}, {"+", "-"},
+                                                  {"*", "/"}};
+    if (level == Operators.size()) {
+        return compileOperand(csv, tokens, pos);
+    }
+    // Left-associative chain of operators at this precedence level.
+    auto expr = compile(csv, tokens, pos, level + 1);
+    while (pos < tokens.size() &&
+           std::find(Operators[level].begin(), Operators[level].end(),
+                     tokens[pos]) != Operators[level].end()) {
+        const std::string op = tokens[pos++];
+        auto rhs = compile(csv, tokens, pos, level + 1);
+        const std::string text = expr->text + " " + op + " " + rhs->text;
+        if (op == "||") {
+            expr = std::make_shared<ConcatExpr>(expr, rhs, text);
+        } else {
+            expr = std::make_shared<ArithmeticExpr>(op[0], expr, rhs, text);
+        }
+    }
+    return expr;
+}
+
+inline std::shared_ptr<Expr> Expr::compileOperand(const CSV& csv,
+                                                  const StrVec& tokens,
+                                                  size_t& pos) {
+    static const StrVec Reserved = {"(", ")", "||", "+", "*", "/", "=",
+                                    "from", "where"};
+    if (pos >= tokens.size()) {
+        throw Exp("Incomplete expression in query");
+    }
+    const std::string& tok = tokens[pos++];
+    if (tok == "(") {
+        auto expr = compile(csv, tokens, pos, 0);
+        if (pos >= tokens.size() || tokens[pos++] != ")") {
+            throw Exp("Missing ) in expression " + expr->text);
+        }
+        expr->text = "(" + expr->text + ")";
+        return expr;
+    }
+    if (tok == "-") {
+        // Unary minus, e.g., "- raters", is the operand times -1.
+        auto operand = compileOperand(csv, tokens, pos);
+        return std::make_shared<ArithmeticExpr>('*', operand,
+            std::make_shared<LiteralExpr>("-1"), "-" + operand->text);
+    }
+    const auto [minArgs, maxArgs] = FunctionExpr::getArgCount(tok);
+    if (maxArgs > 0 && pos < tokens.size() && tokens[pos] == "(") {
+        // The arguments are just consecutive expressions, as the commas
+        // between them are not tokens.
+        std::vector<ExprPtr> args;
+        std::string text;
+        for (pos++; pos < tokens.size() && tokens[pos] != ")";) {
+            args.push_back(compile(csv, tokens, pos, 0));
+            text += (text.empty() ? "" : ", ") + args.back()->text;
+        }
+        if (pos++ >= tokens.size() || args.size() < minArgs ||
+            args.size() > maxArgs) {
+            throw Exp("Invalid arguments for function " + tok);
+        }
+        return std::make_shared<FunctionExpr>(tok, args,
+                                              tok + "(" + text + ")");
+    }
+    if (std::find(Reserved.begin(), Reserved.end(), tok) != Reserved.end()) {
+        throw Exp("Invalid expression near " + tok);
+    }
+    if (const int colIdx = csv.getColumnIndex(tok); colIdx != -1) {
+        return std::make_shared<ColumnExpr>(colIdx, tok);
+    }
+    if (const int colIdx = csv.getColumnIndex(tok.substr(tok[0] == '-'));
+        tok[0] == '-' && colIdx != -1) {
+        // A negated column name, e.g., "-raters".
+        return std::make_shared<ArithmeticExpr>('*',
+            std::make_shared<ColumnExpr>(colIdx, tok.substr(1)),
+            std::make_shared<LiteralExpr>("-1"), tok);
+    }
+    if (pos < tokens.size() && tokens[pos] == "(") {
+        throw Exp("Unknown function " + tok);
+    }
+    return std::make_shared<LiteralExpr>(tok);
+}
+
+#endif /* EXPR_H */
@@ -0,0 +1,252 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+/**
+ * A lexer that splits a query (or rows of CSV data) into tokens without
+ * copying or allocating memory. Each token is a std::string_view into the
+ * original buffer. Tokens are not converted to lower case. Instead,
+ * keywords are matched case-insensitively via Token::is(). The tokens are
+ * the same as those returned by CSV::tokenize() (except for the case of
+ * unquoted tokens and escape characters in quoted tokens, which are
+ * removed only when a token is copied via Token::str()).
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <string_view>
+
+/**
+ * A token returned by the Lexer.
+ */
+struct Token {
+    /** The text of the token (without any quotes) in the buffer. */
+    std::string_view text;
+
+    /** Flag to indicate if the token was quoted. */
+    bool quoted = false;
+
+    /** Flag to indicate if the text has backslash escape characters
+     * (e.g., in 'it\'s') that are to be removed from the token. */
+    bool escaped = false;
+
+    /**
+     * Determine if this token is a given keyword, ignoring case. Quoted
+     * tokens must match the keyword exactly.
+     *
+     * @param keyword The keyword in lower case.
+     *
+     * @return This method returns true if this token is the keyword.
+     */
+    bool is(std::string_view keyword) const {
+        if (quoted || text.size() != keyword.size()) {
+            return quoted && (escaped ? str() == keyword : text == keyword);
+        }
+        for (size_t i = 0; i < text.size(); i++) {
+            if (std::tolower(static_cast<unsigned char>(text[i])) !=
+                keyword[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Obtain a copy of the text of this token. Escape characters are
+     * removed and unquoted tokens are optionally converted to lower case,
+     * consistent with CSV::tokenize().
+     *
+     * @param lowcase If this flag is true, unquoted tokens are converted to
+     * lower case.
+     *
+     * @return A copy of the text. Short tokens do not need any memory
+     * allocation due to the small string optimization.
+     */
+    std::string str(const bool lowcase = true) const {
+        if (escaped) {
+            std::string copy;
+            for (size_t i = 0; i < text.size(); i++) {
+                if (text[i] != '\\' || ++i < text.size()) {
+                    copy += text[i];
+                }
+            }
+            return copy;
+        }
+        std::string copy(text);
+        if (lowcase && !quoted) {
+            for (char& chr : copy) {
+                chr = std::tolower(static_cast<unsigned char>(chr));
+            }
+        }
+        return copy;
+    }
+};
+
+/**
+ * A lexer over a buffer. Tokens are separated by commas (with an empty
+ * token for an empty value between commas) and optionally by white space.
+ * A single or double quote at the start of a token quotes the token until
+ * the matching quote, with a backslash escaping the next character. A run
+ * of special characters (e.g., "<>" or "!=") is a token on its own.
+ *
+ * \code
+ *     Lexer lexer("select title from 'Test.csv'");
+ *     for (Token tok; lexer.next(tok);) {
+ *         // Use tok.text
+ *     }
+ * \endcode
+ */
+class Lexer {
+public:
+    /**
+     * Create a lexer over a given buffer. The buffer must remain valid
+     * while the tokens are in use.
+     *
+     * @param buffer The buffer to be split into tokens.
+     *
+     * @param spcDelim If this flag is true, white space separates tokens.
+     * Otherwise, white space is part of the tokens.
+     *
+     * @param splChars The special characters that are tokens on their own.
+     *
+     * @param rows If this flag is true, then each line (that is not in a
+     * quoted token) is a separate row. See nextRow().
+     */
+    explicit Lexer(std::string_view buffer, const bool spcDelim = true,
+                   std::string_view splChars = "<>=!()",
+                   const bool rows = false) :
+        buffer(buffer), spcDelim(spcDelim), splChars(splChars), rows(rows) {}
+
+    /**
+     * Obtain the next token in the buffer (or in the current row).
+     *
+     * @param[out] tok The next token.
+     *
+     * @return This method returns false if there are no more tokens in the
+     * buffer (or in the current row).
+     */
+    bool next(Token& tok) {
+        while (!endOfRow()) {
+            const char chr = buffer[pos];
+            if (chr == ',') {
+                pos++;
+                const bool emptyValue = !hasValue;
+                hasValue = false;
+                if (emptyValue) {
+                    tok = Token{buffer.substr(pos - 1, 0)};
+                    return true;
+                }
+            } else if (spcDelim &&
+                       std::isspace(static_cast<unsigned char>(chr))) {
+                pos++;
+            } else {
+                tok = (chr == '"' || chr == '\'' ? quoted() : unquoted());
+                hasValue = true;
+                return true;
+            }
+        }
+        if (!hasValue) {
+            // The last value (after a comma or in an empty row) is empty.
+            hasValue = true;
+            tok = Token{buffer.substr(pos, 0)};
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Move to the next row in the buffer after the tokens in the current
+     * row have been obtained via next().
+     *
+     * @return This method returns false if there are no more rows.
+     */
+    bool nextRow() {
+        if (pos < buffer.size() && buffer[pos] == '\r') {
+            pos++;
+        }
+        if (pos < buffer.size() && buffer[pos] == '\n') {
+            pos++;
+        }
+        hasValue = false;
+        return pos < buffer.size();
+    }
+
+    /**
+     * Obtain the position of the lexer in the buffer.
+     *
+     * @return The index of the next character to be processed.
+     */
+    size_t position() const { return pos; }
+
+private:
+    /**
+     * Helper method to determine if the end of the buffer (or the current
+     * row) has been reached. A row ends with a newline or CR-LF.
+     */
+    bool endOfRow() const {
+        return pos >= buffer.size() || (rows && (buffer[pos] == '\n' ||
+            (buffer[pos] == '\r' && pos + 1 < buffer.size() &&
+             buffer[pos + 1] == '\n')));
+    }
+
+    /**
+     * Helper method to obtain a quoted token starting at the current
+     * position. An unterminated quote extends to the end of the buffer.
+     */
+    Token quoted() {
+        const char quote = buffer[pos++];
+        const size_t start = pos;
+        bool escaped = false;
+        for (; pos < buffer.size() && buffer[pos] != quote; pos++) {
+            if (buffer[pos] == '\\') {
+                escaped = true;
+                pos++;  // Skip over the escaped character
+            }
+        }
+        const size_t end = std::min(pos, buffer.size());
+        pos = std::min(end + 1, buffer.size());
+        return Token{buffer.substr(start, end - start), true, escaped};
+    }
+
+    /**
+     * Helper method to obtain an unquoted token (a word or a run of special
+     * characters) starting at the current position.
+     */
+    Token unquoted() {
+        const size_t start = pos;
+        const bool special = isSpecial(buffer[pos]);
+        while (!endOfRow() && buffer[pos] != ',' &&
+               isSpecial(buffer[pos]) == special &&
+               !(spcDelim &&
+                 std::isspace(static_cast<unsigned char>(buffer[pos])))) {
+            pos++;
+        }
+        return Token{buffer.substr(start, pos - start)};
+    }
+
+    /** Helper method to check if a character is a special character. */
+    bool isSpecial(const char chr) const {
+        return splChars.find(chr) != std::string_view::npos;
+    }
+
+    /** The buffer being split into tokens. */
+    std::string_view buffer;
+
+    /** Flag to indicate if white space separates tokens. */
+    bool spcDelim;
+
+    /** The special characters that are tokens on their own. */
+    std::string_view splChars;
+
+    /** Flag to indicate if the buffer is split into rows. */
+    bool rows;
+
+    /** The index of the next character to be processed in buffer. */
+    size_t pos = 0;
+
+    /** Flag to indicate if the current value (i.e., since the last comma
+     * or the start of the row) has a token. */
+    bool hasValue = false;
+};
+
+#endif /* LEXER_H */
@@ -0,0 +1,279 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+/**
+ * Precompiled matchers for the "ilike" (case-insensitive substring) and
+ * "regexp" (regular expression) conditions in where clauses. A matcher is
+ * compiled once per query and then checked against each value (or each
+ * distinct value of a dictionary encoded column). Both kinds of matchers
+ * first search for a literal substring using a Boyer-Moore-Horspool skip
+ * table, so that most non-matching values are rejected without running
+ * the regular expression.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <memory>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include "Helper.h"
+
+/**
+ * A condition of the form "col ilike value" or "col regexp pattern". The
+ * pattern of a regexp is an ECMAScript regular expression that may match
+ * anywhere in a value (e.g., "where title regexp '^the .*s$'"). Patterns
+ * with upper case letters or special characters must be quoted. Note that
+ * backslashes in quoted values are escape characters, so "\d" must be
+ * written as '\\d' in a query.
+ */
+class Matcher {
+public:
+    /**
+     * Determine if a condition in a where clause is checked by a matcher.
+     *
+     * @param cond The condition, e.g., "=" or "ilike".
+     *
+     * @return This method returns true for "ilike" and "regexp".
+     */
+    static bool handles(const std::string& cond) {
+        return cond == "ilike" || cond == "regexp";
+    }
+
+    /**
+     * Compile a matcher for a given condition.
+     *
+     * @param cond The condition. Either "ilike" or "regexp".
+     *
+     * @param pattern The substring or regular expression to be matched.
+     *
+     * @exception Exp This constructor throws an exception if the regular
+     * expression is invalid.
+     */
+    Matcher(const std::string& cond, const std::string& pattern) :
+        foldCase(cond == "ilike") {
+        for (size_t chr = 0; chr < caseMap.size(); chr++) {
+            caseMap[chr] = (foldCase ? std::tolower(chr) : chr);
+        }
+        if (!foldCase) {
+            try {
+                regex.emplace(pattern, std::regex::ECMAScript |
+                              std::regex::optimize);
+            } catch (const std::exception& err) {
+                throw Exp("Invalid regular expression " + pattern + ": " +
+                          err.what());
+            }
+        }
+        literal = (foldCase ? pattern : requiredLiteral(pattern));
+        for (char& chr : literal) {
+            chr = fold(chr);
+        }
+        // The number of characters to skip when the last character of the
+        // window being checked is a given character.
+        skip.fill(literal.size());
+        for (size_t i = 0; i + 1 < literal.size(); i++) {
+            skip[static_cast<unsigned char>(literal[i])] =
+                literal.size() - i - 1;
+        }
+    }
+
+    /**
+     * Check if a value meets the condition of this matcher.
+     *
+     * @param value The value in a column of a row.
+     *
+     * @return This method returns true if the value has the substring
+     * (ignoring case) or matches the regular expression.
+     */
+    bool matches(std::string_view value) const {
+        if (!contains(value)) {
+            return false;
+        }
+        return !regex || std::regex_search(value.begin(), value.end(),
+                                           *regex);
+    }
+
+    /**
+     * Extract a substring that every match of a regular expression must
+     * have. For example, "colou?r [a-z]+" must have "colo". The
+     * extraction is conservative: patterns with alternations (i.e., "|")
+     * have no required substring.
+     *
+     * @param pattern The ECMAScript regular expression.
+     *
+     * @return The longest run of required characters. It is empty if a
+     * run could not be determined.
+     */
+    static std::string requiredLiteral(const std::string& pattern) {
+        if (pattern.find('|') != std::string::npos) {
+            return "";
+        }
+        std::string best, run;
+        bool lastInRun = false;  // Is the last atom the last char in run?
+        const auto endRun = [&]() {
+            best = (run.size() > best.size() ? run : best);
+            run.clear();
+            lastInRun = false;
+        };
+        for (size_t i = 0; i < pattern.size(); i++) {
+            const char chr = pattern[i];
+            if (chr == '\\' && i + 1 < pattern.size() &&
+                !std::isalnum(static_cast<unsigned char>(pattern[i + 1]))) {
+                run += pattern[++i];  // Escaped punctuation, e.g., "\."
+                lastInRun = true;
+            } else if (chr == '\\') {
+                endRun();  // A class (e.g., "\d") or a coded character
+                i = skipEscape(pattern, i);
+            } else if (chr == '*' || chr == '?' || chr == '{') {
+                // The previous atom is optional (or repeated).
+                if (lastInRun) {
+                    run.pop_back();
+                }
+                endRun();
+                i = (chr == '{' ? pattern.find('}', i) : i);
+            } else if (chr == '+') {
+                endRun();  // The previous atom occurs at least once.
+            } else if (chr == '[' || chr == '(') {
+                endRun();
+                i = skipGroup(pattern, i);
+            } else if (std::string_view(".^$)]}").find(chr) !=
+                       std::string_view::npos) {
+                endRun();  // Any character, anchors, and stray brackets
+            } else {
+                run += chr;
+                lastInRun = true;
+            }
+            if (i == std::string::npos) {
+                break;
+            }
+        }
+        endRun();
+        return best;
+    }
+
+private:
+    /**
+     * Convert a character to lower case for case-insensitive matchers.
+     *
+     * @param chr The character to be converted.
+     *
+     * @return The character in lower case or the character itself if case
+     * is not ignored.
+     */
+    char fold(const char chr) const {
+        return caseMap[static_cast<unsigned char>(chr)];
+    }
+
+    /**
+     * Search for the literal in a value using the skip table.
+     *
+     * @param value The value to be searched.
+     *
+     * @return This method returns true if the value has the literal.
+     */
+    bool contains(std::string_view value) const {
+        const size_t len = literal.size();
+        if (len == 0) {
+            return true;
+        }
+        for (size_t pos = 0; pos + len <= value.size();
+             pos += skip[static_cast<unsigned char>(
+                     fold(value[pos + len - 1]))]) {
+            size_t i = len;
+            while (i > 0 && fold(value[pos + i - 1]) == literal[i - 1]) {
+                i--;
+            }
+            if (i == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Find the last character of an escape sequence that is not just an
+     * escaped punctuation character, e.g., "\d", "\x41", or "\1".
+     *
+     * @param pattern The regular expression.
+     *
+     * @param start The index of the backslash.
+     *
+     * @return The index of the last character in the escape sequence.
+     */
+    static size_t skipEscape(const std::string& pattern, size_t start) {
+        size_t end = start + 1;
+        switch (pattern[end]) {
+        case 'x': end += 2; break;
+        case 'u': end += 4; break;
+        case 'c': end += 1; break;
+        default:
+            while (std::isdigit(static_cast<unsigned char>(pattern[end])) &&
+                   end + 1 < pattern.size() &&
+                   std::isdigit(static_cast<unsigned char>(pattern[end + 1]))) {
+                end++;  // Back reference, e.g., "\12"
+            }
+        }
+        return std::min(end, pattern.size() - 1);
+    }
+
+    /**
+     * Find the end of a character class (e.g., "[a-z]") or of a group
+     * (e.g., "(ab|cd)"), skipping nested groups and escaped characters.
+     *
+     * @param pattern The regular expression.
+     *
+     * @param start The index of the opening "[" or "(".
+     *
+     * @return The index of the closing "]" or ")" or npos if it is
+     * missing.
+     */
+    static size_t skipGroup(const std::string& pattern, size_t start) {
+        size_t i = start + 1;
+        if (pattern[start] == '[') {
+            // A "]" right after "[" or "[^" is a character in the class.
+            i += (i < pattern.size() && pattern[i] == '^');
+            for (i++; i < pattern.size() && pattern[i] != ']'; i++) {
+                i += (pattern[i] == '\\');
+            }
+            return (i < pattern.size() ? i : std::string::npos);
+        }
+        for (int depth = 1; i < pattern.size(); i++) {
+            if (pattern[i] == '\\') {
+                i++;
+            } else if (pattern[i] == '[') {
+                if ((i = skipGroup(pattern, i)) == std::string::npos) {
+                    break;
+                }
+            } else if (pattern[i] == '(') {
+                depth++;
+            } else if (pattern[i] == ')' && --depth == 0) {
+                return i;
+            }
+        }
+        return std::string::npos;
+    }
+
+    /** Flag to indicate if case is ignored (for "ilike"). */
+    const bool foldCase;
+
+    /** The (lower case) character to be used for each character. */
+    std::array<char, 256> caseMap;
+
+    /** The substring that every matching value must have. For an "ilike"
+     * it is the whole value (in lower case). */
+    std::string literal;
+
+    /** The number of characters to advance the search window by, indexed
+     * by the last character in the window. */
+    std::array<size_t, 256> skip;
+
+    /** The compiled regular expression (for "regexp" only). */
+    std::optional<std::regex> regex;
+};
+
+/** Shortcut to a shared pointer to a compiled matcher. */
+using MatcherPtr = std::shared_ptr<const Matcher>;
+
+#endif /* MATCHER_H */
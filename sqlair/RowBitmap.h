@@ -0,0 +1,494 @@
+#ifndef ROW_BITMAP_H
+#define ROW_BITMAP_H
+
+/**
+ * A compressed bitmap of row numbers (in the spirit of Roaring bitmaps) that
+ * is used to represent the set of rows in a CSV that meet a condition.
+ * Bitmaps for different conditions are combined via bitwise AND and OR
+ * operations. This file also includes a small cache of bitmaps so that
+ * repeated conditions need not be re-evaluated.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A compressed set of row numbers. The row numbers are split into chunks of
+ * 65536 rows (based on the upper bits of the row number). Each chunk is
+ * stored in a container that is either a sorted array of the lower 16 bits
+ * (for sparse chunks) or a bitset of 65536 bits (for dense chunks).
+ */
+class RowBitmap {
+public:
+    /**
+     * Add a row to this bitmap. Adding rows in increasing order (the common
+     * case when scanning a CSV) is the most efficient.
+     *
+     * @param row The row number to be added.
+     */
+    void add(size_t row) {
+        const size_t key = row >> 16;
+        if (containers.empty() || containers.back().key < key) {
+            containers.push_back(Container{key});
+        }
+        auto cont = (containers.back().key == key ? std::prev(containers.end())
+                     : std::lower_bound(containers.begin(), containers.end(),
+                                        key, keyLess));
+        if (cont == containers.end() || cont->key != key) {
+            cont = containers.insert(cont, Container{key});
+        }
+        addLow(*cont, static_cast<uint16_t>(row & 0xFFFF));
+    }
+
+    /**
+     * Remove a row from this bitmap, if it is present.
+     *
+     * @param row The row number to be removed.
+     */
+    void remove(size_t row) {
+        const auto cont = std::lower_bound(containers.begin(),
+                                           containers.end(), row >> 16,
+                                           keyLess);
+        if (cont == containers.end() || cont->key != (row >> 16)) {
+            return;
+        }
+        const uint16_t low = static_cast<uint16_t>(row & 0xFFFF);
+        if (!cont->bits.empty()) {
+            const uint64_t mask = uint64_t(1) << (low % 64);
+            if ((cont->bits[low / 64] & mask) != 0) {
+                cont->bits[low / 64] &= ~mask;
+                cont->cardinality--;
+                shrink(*cont);
+            }
+        } else {
+            const auto pos = std::lower_bound(cont->array.begin(),
+                                              cont->array.end(), low);
+            if (pos != cont->array.end() && *pos == low) {
+                cont->array.erase(pos);
+                cont->cardinality--;
+            }
+        }
+        if (cont->cardinality == 0) {
+            containers.erase(cont);
+        }
+    }
+
+    /**
+     * Obtain the first row in this bitmap that is at or after a given row.
+     *
+     * @param row The row number from where to search.
+     *
+     * @return The first row (in increasing order) in this bitmap that is
+     * not less than the given row. If there is no such row, then this method
+     * returns SIZE_MAX.
+     */
+    size_t next(size_t row) const {
+        for (auto cont = std::lower_bound(containers.begin(),
+                                          containers.end(), row >> 16,
+                                          keyLess);
+             cont != containers.end(); cont++) {
+            const size_t base = cont->key << 16;
+            // Only rows at or after the given row in the first container
+            const size_t low = (cont->key == (row >> 16) ? row & 0xFFFF : 0);
+            if (cont->bits.empty()) {
+                const auto pos = std::lower_bound(cont->array.begin(),
+                                                  cont->array.end(), low);
+                if (pos != cont->array.end()) {
+                    return base + *pos;
+                }
+                continue;
+            }
+            for (size_t word = low / 64; word < NumWords; word++) {
+                uint64_t bits = cont->bits[word];
+                if (word == low / 64) {
+                    bits &= ~uint64_t(0) << (low % 64);
+                }
+                if (bits != 0) {
+                    return base + word * 64 + __builtin_ctzll(bits);
+                }
+            }
+        }
+        return SIZE_MAX;
+    }
+
+    /**
+     * Check if a given row is in this bitmap.
+     *
+     * @param row The row number to be checked.
+     *
+     * @return This method returns true if the row is in this bitmap.
+     */
+    bool contains(size_t row) const {
+        const auto cont = std::lower_bound(containers.begin(),
+                                           containers.end(), row >> 16,
+                                           keyLess);
+        return cont != containers.end() && cont->key == (row >> 16) &&
+            hasLow(*cont, static_cast<uint16_t>(row & 0xFFFF));
+    }
+
+    /**
+     * Obtain the number of rows in this bitmap.
+     *
+     * @return The number of rows in this bitmap.
+     */
+    size_t count() const {
+        size_t total = 0;
+        for (const auto& cont : containers) {
+            total += cont.cardinality;
+        }
+        return total;
+    }
+
+    /**
+     * Call a given function for each row in this bitmap, in increasing
+     * order of row numbers.
+     *
+     * @param fn The function to be called. It is passed each row number.
+     */
+    template<typename Function>
+    void forEach(Function fn) const {
+        for (const auto& cont : containers) {
+            const size_t base = cont.key << 16;
+            if (cont.bits.empty()) {
+                for (const uint16_t low : cont.array) {
+                    fn(base + low);
+                }
+                continue;
+            }
+            for (size_t word = 0; word < cont.bits.size(); word++) {
+                for (uint64_t bits = cont.bits[word]; bits != 0;
+                     bits &= bits - 1) {
+                    fn(base + word * 64 + __builtin_ctzll(bits));
+                }
+            }
+        }
+    }
+
+    /**
+     * Intersect (bitwise AND) this bitmap with another bitmap.
+     *
+     * @param other The other bitmap to be intersected with this one.
+     *
+     * @return A bitmap with the rows that are in both bitmaps.
+     */
+    RowBitmap operator&(const RowBitmap& other) const {
+        RowBitmap result;
+        auto lhs = containers.begin(), rhs = other.containers.begin();
+        while (lhs != containers.end() && rhs != other.containers.end()) {
+            if (lhs->key < rhs->key) {
+                lhs++;
+            } else if (rhs->key < lhs->key) {
+                rhs++;
+            } else {
+                Container cont = intersect(*lhs++, *rhs++);
+                if (cont.cardinality > 0) {
+                    result.containers.push_back(std::move(cont));
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Unite (bitwise OR) this bitmap with another bitmap.
+     *
+     * @param other The other bitmap to be united with this one.
+     *
+     * @return A bitmap with the rows that are in either bitmap.
+     */
+    RowBitmap operator|(const RowBitmap& other) const {
+        RowBitmap result;
+        auto lhs = containers.begin(), rhs = other.containers.begin();
+        while (lhs != containers.end() || rhs != other.containers.end()) {
+            if (rhs == other.containers.end() ||
+                (lhs != containers.end() && lhs->key < rhs->key)) {
+                result.containers.push_back(*lhs++);
+            } else if (lhs == containers.end() || rhs->key < lhs->key) {
+                result.containers.push_back(*rhs++);
+            } else {
+                result.containers.push_back(unite(*lhs++, *rhs++));
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this bitmap.
+     *
+     * @return An estimate of the memory used by this bitmap.
+     */
+    size_t memoryUsage() const {
+        size_t bytes = sizeof(*this) +
+            containers.capacity() * sizeof(Container);
+        for (const auto& cont : containers) {
+            bytes += cont.array.capacity() * sizeof(uint16_t) +
+                cont.bits.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+private:
+    /** Containers with more entries than this are stored as bitsets. */
+    static constexpr size_t MaxArraySize = 4096;
+
+    /** The number of 64-bit words in the bitset of a container. */
+    static constexpr size_t NumWords = 65536 / 64;
+
+    /** The rows in one chunk of 65536 rows. */
+    struct Container {
+        /** The upper bits of the row numbers in this container. */
+        size_t key;
+        /** The sorted lower 16 bits of the rows (if sparse). */
+        std::vector<uint16_t> array;
+        /** A bit for each of the 65536 rows (if dense). */
+        std::vector<uint64_t> bits;
+        /** The number of rows in this container. */
+        size_t cardinality = 0;
+    };
+
+    /**
+     * Helper comparator to search for a container with a given key.
+     */
+    static bool keyLess(const Container& cont, size_t key) {
+        return cont.key < key;
+    }
+
+    /**
+     * Helper method to add the lower 16 bits of a row to a container,
+     * converting the container to a bitset when it becomes dense.
+     */
+    static void addLow(Container& cont, uint16_t low) {
+        if (!cont.bits.empty()) {
+            const uint64_t mask = uint64_t(1) << (low % 64);
+            cont.cardinality += ((cont.bits[low / 64] & mask) == 0 ? 1 : 0);
+            cont.bits[low / 64] |= mask;
+            return;
+        }
+        if (cont.array.empty() || cont.array.back() < low) {
+            cont.array.push_back(low);  // Common case of increasing rows
+        } else {
+            const auto pos = std::lower_bound(cont.array.begin(),
+                                              cont.array.end(), low);
+            if (*pos == low) {
+                return;  // Already present
+            }
+            cont.array.insert(pos, low);
+        }
+        if (++cont.cardinality > MaxArraySize) {
+            toBitset(cont);
+        }
+    }
+
+    /**
+     * Helper method to check if the lower 16 bits of a row are in a
+     * container.
+     */
+    static bool hasLow(const Container& cont, uint16_t low) {
+        if (!cont.bits.empty()) {
+            return (cont.bits[low / 64] >> (low % 64)) & 1;
+        }
+        return std::binary_search(cont.array.begin(), cont.array.end(), low);
+    }
+
+    /**
+     * Helper method to convert a sparse (array) container to a bitset.
+     */
+    static void toBitset(Container& cont) {
+        cont.bits.assign(NumWords, 0);
+        for (const uint16_t low : cont.array) {
+            cont.bits[low / 64] |= uint64_t(1) << (low % 64);
+        }
+        cont.array = std::vector<uint16_t>();
+    }
+
+    /**
+     * Helper method to convert a bitset container to an array, if it has
+     * become sparse. The cardinality must be up-to-date.
+     */
+    static void shrink(Container& cont) {
+        if (cont.bits.empty() || cont.cardinality > MaxArraySize) {
+            return;
+        }
+        cont.array.reserve(cont.cardinality);
+        for (size_t word = 0; word < NumWords; word++) {
+            for (uint64_t bits = cont.bits[word]; bits != 0; bits &= bits - 1) {
+                cont.array.push_back(word * 64 + __builtin_ctzll(bits));
+            }
+        }
+        cont.bits = std::vector<uint64_t>();
+    }
+
+    /**
+     * Helper method to intersect two containers with the same key.
+     */
+    static Container intersect(const Container& lhs, const Container& rhs) {
+        Container result{lhs.key};
+        if (lhs.bits.empty() || rhs.bits.empty()) {
+            // At least one is sparse. So the result is sparse.
+            const Container& sparse = (lhs.bits.empty() ? lhs : rhs);
+            const Container& other = (lhs.bits.empty() ? rhs : lhs);
+            if (other.bits.empty()) {
+                std::set_intersection(sparse.array.begin(), sparse.array.end(),
+                                      other.array.begin(), other.array.end(),
+                                      std::back_inserter(result.array));
+            } else {
+                std::copy_if(sparse.array.begin(), sparse.array.end(),
+                             std::back_inserter(result.array),
+                             [&other](uint16_t low) {
+                                 return hasLow(other, low); });
+            }
+            result.cardinality = result.array.size();
+            return result;
+        }
+        result.bits.resize(NumWords);
+        for (size_t word = 0; word < NumWords; word++) {
+            result.bits[word] = lhs.bits[word] & rhs.bits[word];
+            result.cardinality += __builtin_popcountll(result.bits[word]);
+        }
+        shrink(result);
+        return result;
+    }
+
+    /**
+     * Helper method to unite two containers with the same key.
+     */
+    static Container unite(const Container& lhs, const Container& rhs) {
+        Container result{lhs.key};
+        if (lhs.bits.empty() && rhs.bits.empty()) {
+            std::set_union(lhs.array.begin(), lhs.array.end(),
+                           rhs.array.begin(), rhs.array.end(),
+                           std::back_inserter(result.array));
+            result.cardinality = result.array.size();
+            if (result.cardinality > MaxArraySize) {
+                toBitset(result);
+            }
+            return result;
+        }
+        // At least one is dense. So the result is dense.
+        result = (lhs.bits.empty() ? rhs : lhs);
+        const Container& other = (lhs.bits.empty() ? lhs : rhs);
+        if (other.bits.empty()) {
+            for (const uint16_t low : other.array) {
+                result.bits[low / 64] |= uint64_t(1) << (low % 64);
+            }
+        } else {
+            for (size_t word = 0; word < NumWords; word++) {
+                result.bits[word] |= other.bits[word];
+            }
+        }
+        result.cardinality = 0;
+        for (const uint64_t word : result.bits) {
+            result.cardinality += __builtin_popcountll(word);
+        }
+        return result;
+    }
+
+    /** The containers in this bitmap, sorted on their keys. */
+    std::vector<Container> containers;
+};
+
+/**
+ * An MT-safe cache of the bitmaps of rows that meet the conditions used in
+ * recent queries on a CSV. Each bitmap is tagged with the version of the CSV
+ * for which it was computed. Hence, bitmaps become stale (and are ignored)
+ * once the CSV is modified.
+ */
+class BitmapCache {
+public:
+    /**
+     * Create an empty cache.
+     *
+     * @param maxEntries The maximum number of bitmaps in the cache. When the
+     * cache is full, the least recently used bitmap is removed.
+     */
+    explicit BitmapCache(size_t maxEntries = 64) : maxEntries(maxEntries) {}
+
+    /**
+     * Look-up the bitmap for a given condition.
+     *
+     * @param key A string that uniquely identifies the condition.
+     *
+     * @param version The current version of the CSV.
+     *
+     * @return The bitmap for the condition or nullptr if the condition is
+     * not in the cache or the cached bitmap is stale.
+     */
+    std::shared_ptr<const RowBitmap> find(const std::string& key,
+                                          size_t version) {
+        std::scoped_lock<std::mutex> guard(mutex);
+        const auto entry = entries.find(key);
+        if (entry == entries.end() || entry->second.version != version) {
+            return nullptr;
+        }
+        entry->second.lastUse = ++useClock;
+        return entry->second.bitmap;
+    }
+
+    /**
+     * Add (or replace) the bitmap for a given condition in the cache.
+     *
+     * @param key A string that uniquely identifies the condition.
+     *
+     * @param version The version of the CSV from which the bitmap was
+     * computed. This must be obtained before the rows were checked.
+     *
+     * @param bitmap The bitmap of rows that meet the condition.
+     */
+    void insert(const std::string& key, size_t version,
+                std::shared_ptr<const RowBitmap> bitmap) {
+        std::scoped_lock<std::mutex> guard(mutex);
+        if (entries.size() >= maxEntries &&
+            entries.find(key) == entries.end()) {
+            entries.erase(std::min_element(entries.begin(), entries.end(),
+                [](const auto& e1, const auto& e2) {
+                    return e1.second.lastUse < e2.second.lastUse; }));
+        }
+        entries[key] = Entry{version, std::move(bitmap), ++useClock};
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this cache.
+     *
+     * @return An estimate of the memory used by this cache.
+     */
+    size_t memoryUsage() const {
+        std::scoped_lock<std::mutex> guard(mutex);
+        size_t bytes = sizeof(*this);
+        for (const auto& entry : entries) {
+            bytes += sizeof(entry) + entry.first.capacity() +
+                entry.second.bitmap->memoryUsage();
+        }
+        return bytes;
+    }
+
+private:
+    /** A cached bitmap along with information to manage it. */
+    struct Entry {
+        /** The version of the CSV from which the bitmap was computed. */
+        size_t version;
+        /** The bitmap of rows that meet the condition. */
+        std::shared_ptr<const RowBitmap> bitmap;
+        /** Logical time at which this entry was last used (for LRU). */
+        size_t lastUse;
+    };
+
+    /** The maximum number of entries in this cache. */
+    const size_t maxEntries;
+
+    /** The cached bitmaps. The key identifies the condition. */
+    std::unordered_map<std::string, Entry> entries;
+
+    /** Logical clock used to track the least recently used entry. */
+    size_t useClock = 0;
+
+    /** The mutex to enable MT-safe access to this cache. */
+    mutable std::mutex mutex;
+};
+
+#endif /* ROW_BITMAP_H */
@@ -11,10 +11,18 @@
 #include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/format.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <unistd.h>
 
 #include "HTTPFile.h"
 using namespace boost::asio;
@@ -30,117 +38,1502 @@ const std::string HTTPRespHeader =
     "Content-Type: text/plain\r\n"
     "Content-Length: ";
 
+// The largest body (in bytes) of a request that is accepted. The body is
+// read in chunks so that a client cannot make the server allocate memory
+// for more data than it actually sends.
+const size_t MaxBodySize = 16 * 1024 * 1024;
+const size_t BodyChunkSize = 64 * 1024;
+
+// The CSVs pinned by the query being run by each thread and if the query
+// is a "use" statement.
+thread_local std::vector<std::shared_ptr<CSV>> SQLAir::pinnedCSV;
+thread_local bool SQLAir::usingCSV = false;
+
+// The session of the request being run by each thread and the CSVs that
+// are locked by the thread to commit a transaction.
+thread_local Session* SQLAir::session = nullptr;
+thread_local std::vector<const CSV*> SQLAir::committingCSV;
+thread_local std::vector<std::function<void()>> SQLAir::undoLog;
+
+// The most recent version number assigned to a snapshot of in-memory CSVs.
+static std::atomic<size_t> lastCatalogVersion = {0};
+
+// The number of spill files created by this process, to name them uniquely.
+static std::atomic<size_t> numSpillFiles = {0};
+
+/**
+ * Helper method to obtain the current time to track the least recently
+ * used CSVs. Unlike a shared counter, it does not need any shared writes.
+ *
+ * @return The current time in steady_clock ticks.
+ */
+std::chrono::steady_clock::rep now() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+SQLAir::SQLAir() {
+    // Give the initial (empty) snapshot of in-memory CSVs a unique version.
+    catalogVersion = ++lastCatalogVersion;
+    // Use the optional memory budget (in megabytes) from the environment.
+    // An invalid budget is ignored (i.e., the budget is unlimited).
+    if (const char* budget = std::getenv("SQLAIR_MEMORY_BUDGET_MB")) {
+        const std::string megs = budget;
+        if (!megs.empty() && megs.size() <= 9 &&
+            megs.find_first_not_of("0123456789") == std::string::npos) {
+            setMemoryBudget(std::stoul(megs) * 1024 * 1024);
+        } else {
+            std::cerr << "Ignoring invalid SQLAIR_MEMORY_BUDGET_MB: " << megs
+                      << std::endl;
+        }
+    }
+    // Optionally dictionary encode the low-cardinality columns
+    if (const char* encode = std::getenv("SQLAIR_DICTIONARY_ENCODING")) {
+        setDictionaryEncoding(std::string(encode) == "1");
+    }
+    // Optionally build Bloom filters on columns that are not encoded
+    if (const char* bloom = std::getenv("SQLAIR_BLOOM_FILTERS")) {
+        setBloomFilters(std::string(bloom) == "1");
+    }
+}
+
+SQLAir::~SQLAir() {
+    for (const auto& entry : spilledCSV) {
+        std::error_code ec;  // Errors are ignored
+        std::filesystem::remove(entry.second.path, ec);
+    }
+}
+
+bool SQLAir::process(const std::string& sql, std::ostream& os) {
+    // Release CSVs pinned by this query, even if exceptions occur.
+    struct Unpin {
+        ~Unpin() { pinnedCSV.clear(); }
+    } unpin;
+    // Tokenize and process the query based on the command.
+    StrVec tokens;
+    bool mustWait;
+    int cmd;
+    std::tie(tokens, mustWait, cmd) = preprocess(sql);
+    usingCSV = (cmd == 5);
+    // Waiting for changes by other queries would fail the validation of
+    // the transaction (see Transaction).
+    if (mustWait && currentSession().inTransaction) {
+        throw Exp("Wait cannot be used in a transaction");
+    }
+    switch (cmd) {
+        case 0: return false;  // exit
+        case 1: validateAndProcessSelect(tokens, mustWait, os); break;
+        case 2: validateAndProcessUpdate(tokens, mustWait, os); break;
+        case 3: validateAndProcessInsert(tokens, mustWait, os); break;
+        case 4: validateAndProcessDelete(tokens, mustWait, os); break;
+        case 5: validateAndProcessUse(tokens, mustWait, os);    break;
+        case 6: validateAndProcessSave(tokens, mustWait, os);   break;
+        default:
+            if (tokens.size() == 2 && tokens[0] == "show" &&
+                tokens[1] == "memory") {
+                showMemory(os);
+            } else if (!tokens.empty() && tokens[0] == "create") {
+                validateAndProcessCreate(tokens, mustWait, os);
+            } else if (!tokens.empty() && tokens[0] == "copy") {
+                validateAndProcessCopy(tokens, mustWait, os);
+            } else if (!tokens.empty() && (tokens[0] == "begin" ||
+                                           tokens[0] == "commit" ||
+                                           tokens[0] == "rollback")) {
+                validateAndProcessTransaction(tokens, os);
+            } else {
+                throw Exp("Invalid sql-air command " +
+                          (tokens.empty() ? "" : tokens.front()));
+            }
+    }
+    return true;
+}
+
+void SQLAir::setBloomFilters(bool enable) {
+    bloomFilters = enable;
+}
+
+void SQLAir::setDictionaryEncoding(bool enable) {
+    dictionaryEncoding = enable;
+}
+
+void SQLAir::showMemory(std::ostream& os) {
+    std::scoped_lock<std::mutex> guard(catalogMutex);
+    size_t totalBytes = 0;
+    for (const auto& entry : *inMemoryCSV) {
+        // The estimate for CSVs in use by other queries may be dated.
+        CachedCSV& cached = *entry.second;
+        size_t bytes = cached.csv->getMemoryEstimate();
+        if (exclude(cached)) {
+            cached.csv->measureMemory();  // Also refreshes the estimate
+            bytes = cached.csv->getMemoryEstimate();
+            cached.excluded = false;
+        }
+        os << entry.first << "\t" << bytes << " bytes" << std::endl;
+        totalBytes += bytes;
+    }
+    os << "total\t" << totalBytes << " bytes" << std::endl;
+}
+
 /**
  *
  * An helper method that print rows that has been selected.
  *
  * @param row the row that has been selected.
  *
- * @param cols The content of the row
- *
- * @param csv The CSV data to be used.
+ * @param colIdx The indexes of the columns to be printed. See
+ * ColumnPlan::colIdx.
  *
  * @param[out] os The output stream to where the number of rows selected must
  * be written -- e.g." "1 row(s) selected.\n"
  */
-void printRow(CSVRow& row, const StrVec& cols, const CSV& csv,
+void printRow(CSVRow& row, const std::vector<int>& colIdx,
               std::ostream& os) {
-    CSVRow rowCopy;
+    // Rather than copying the whole row, the selected columns are formatted
+    // into a per-thread buffer that is reused (without reallocation) for
+    // each row printed by this thread.
+    thread_local std::string line;
+    line.clear();
     {
         std::unique_lock lock(row.rowMutex);
-        rowCopy = row;
+        for (size_t i = 0; i < colIdx.size(); i++) {
+            line += (i > 0 ? "\t" : "");
+            line += row.at(colIdx[i]);
+        }
+    }
+    line += '\n';
+    os << line;
+}
+
+/**
+ * Helper method to print a batch of selected rows. The expressions (if any)
+ * in the plan are evaluated once for the whole batch of rows.
+ *
+ * @note The caller must hold the table lock of the CSV (at least in shared
+ * mode), so that the rows are not modified while they are printed.
+ *
+ * @param csv The CSV with the rows.
+ *
+ * @param plan The columns (or expressions) to be printed.
+ *
+ * @param rows The indexes of the rows to be printed.
+ *
+ * @param[out] os The output stream to where the rows are to be written.
+ */
+void printRows(CSV& csv, const ColumnPlan& plan,
+               const std::vector<size_t>& rows, std::ostream& os) {
+    if (plan.exprs.empty()) {
+        for (const size_t rowIdx : rows) {
+            printRow(csv[rowIdx], plan.colIdx, os);
+        }
+        return;
+    }
+    std::vector<StrVec> values(plan.exprs.size());
+    for (size_t i = 0; i < plan.exprs.size(); i++) {
+        if (plan.exprs[i] != nullptr) {
+            plan.exprs[i]->eval(csv, rows, values[i]);
+        }
     }
-    std::string delim = "";
-    for (const auto& colName : cols) {
-        os << delim << rowCopy.at(csv.getColumnIndex(colName));
-        delim = "\t";
+    thread_local std::string lines;
+    lines.clear();
+    for (size_t r = 0; r < rows.size(); r++) {
+        const CSVRow& row = csv[rows[r]];
+        for (size_t i = 0; i < plan.exprs.size(); i++) {
+            lines += (i > 0 ? "\t" : "");
+            lines += (plan.exprs[i] != nullptr ? values[i][r] :
+                      row[plan.colIdx[i]]);
+        }
+        lines += '\n';
     }
-    os << std::endl;
+    os << lines;
 }
 
-int SQLAir::selectHelper(CSV& csv, StrVec colNames, const int whereColIdx,
-                         const std::string& cond, const std::string& value,
-                         std::ostream& os) {
+/**
+ * Helper method to check if the select list of a query has expressions
+ * (rather than just column names).
+ *
+ * @param colNames The tokens in the select list.
+ *
+ * @return This method returns true if the tokens have operators or
+ * parentheses (e.g., for function calls).
+ */
+bool hasExpressions(const StrVec& colNames) {
+    return std::any_of(colNames.begin(), colNames.end(),
+                       [&colNames](const std::string& tok) {
+        return tok == "+" || tok == "-" || tok == "/" || tok == "||" ||
+            (tok == "*" && colNames.size() > 1) ||
+            tok.find_first_of("()") != std::string::npos;
+    });
+}
+
+/**
+ * Helper method to obtain the full-text index on a column in a "match"
+ * condition.
+ *
+ * @param csv The CSV with the column.
+ *
+ * @param colIdx The index of the column.
+ *
+ * @return The full-text index on the column.
+ *
+ * @exception Exp This method throws an exception if the column does not
+ * have a full-text index.
+ */
+const TextIndex& textIndexOf(const CSV& csv, const int colIdx) {
+    if (const auto index = csv.getTextIndex(colIdx)) {
+        return *index;
+    }
+    throw Exp("Column " + csv.getColumnNames().at(colIdx) + " does not "
+              "have a text index. Use: create text index on <csv> "
+              "(<column>)");
+}
+
+/**
+ * Helper method to obtain the spatial index of a CSV.
+ *
+ * @param csv The CSV whose index is to be returned.
+ *
+ * @return The spatial index of the CSV.
+ *
+ * @exception Exp This method throws an exception if the CSV does not have
+ * a spatial index.
+ */
+const SpatialIndex& spatialIndexOf(const CSV& csv) {
+    if (csv.spatialIndex) {
+        return *csv.spatialIndex;
+    }
+    throw Exp("CSV does not have a spatial index. Use: create spatial index "
+              "on <csv> (<latitude>, <longitude>)");
+}
+
+/**
+ * Helper method to find the rows meeting a spatial ("within_radius" or
+ * "nearest") condition using the spatial index of a CSV.
+ *
+ * @param csv The CSV whose rows are to be found.
+ *
+ * @param where The spatial condition. Its values are the latitude and
+ * longitude of the point and the distance (or the number of rows).
+ *
+ * @return The rows meeting the condition and their distances (in km) from
+ * the point.
+ */
+SpatialIndex::Results spatialSearch(const CSV& csv, const WhereExpr& where) {
+    const auto& index = spatialIndexOf(csv);
+    const double lat = Expr::toNumber(where.values.at(0));
+    const double lon = Expr::toNumber(where.values.at(1));
+    const double arg = Expr::toNumber(where.values.at(2));
+    // More rows than the CSV has are not needed (and may not fit a size_t)
+    return (where.cond == "nearest" ?
+            index.nearest(lat, lon, static_cast<size_t>(
+                std::min(arg, static_cast<double>(csv.size())))) :
+            index.withinRadius(lat, lon, arg));
+}
+
+/**
+ * Helper method to determine if a name in the select list is the "score"
+ * or "distance" of the rows (rather than a column). See RankClause.
+ *
+ * @param csv The CSV whose rows are selected.
+ *
+ * @param name The name in the select list.
+ *
+ * @return This method returns true if the name is "score" or "distance"
+ * and the CSV does not have a column with the name.
+ */
+bool isRankValue(const CSV& csv, const std::string& name) {
+    return (name == "score" || name == "distance") &&
+        csv.getColumnIndex(name) == -1;
+}
+
+/**
+ * The "score" or "distance" column of a select statement with full-text
+ * or spatial conditions. It is evaluated using the values computed by
+ * addRankValues(), rounded to 4 decimal places. See RankClause.
+ */
+class RankExpr : public Expr {
+public:
+    /**
+     * Create the column.
+     *
+     * @param name The name of the column. Either "score" or "distance".
+     *
+     * @param values The value of each row. Rows without a value have a
+     * score of 0 and no (i.e., an empty) distance.
+     */
+    RankExpr(const std::string& name,
+             const std::unordered_map<size_t, double>& values) :
+        Expr(Type::Number, name), values(values),
+        missing(name == "score" ? 0 : NAN) {}
+
+    void eval(const CSV&, const std::vector<size_t>& rows,
+              std::vector<double>& out) const override {
+        out.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            const auto value = values.find(rows[i]);
+            out[i] = (value != values.end() ?
+                      std::round(value->second * 1e4) / 1e4 : missing);
+        }
+    }
+
+private:
+    /** The value of each row. */
+    const std::unordered_map<size_t, double>& values;
+
+    /** The value of the rows that are not in values. */
+    const double missing;
+};
+
+/**
+ * Helper method to compute the value by which rows are ranked for the
+ * conditions in a where clause. The score of a row is the sum of its BM25
+ * scores for the full-text ("match") conditions and the distance of a row
+ * is its smallest distance from the points in the spatial conditions.
+ *
+ * @param csv The CSV whose rows are to be ranked.
+ *
+ * @param where The parsed 'where' clause.
+ *
+ * @param name The value to be computed. Either "score" or "distance".
+ *
+ * @param[in,out] values The value of each row meeting a full-text (for
+ * scores) or spatial (for distances) condition.
+ */
+void addRankValues(const CSV& csv, const WhereExpr& where,
+                   const std::string& name,
+                   std::unordered_map<size_t, double>& values) {
+    if (!where.op.empty()) {
+        addRankValues(csv, *where.lhs, name, values);
+        addRankValues(csv, *where.rhs, name, values);
+    } else if (where.cond == "match" && name == "score") {
+        const auto& index = textIndexOf(csv, where.colIdx);
+        for (const auto& [rowIdx, score] : index.search(where.values.at(0))) {
+            values[rowIdx] += score;
+        }
+    } else if (SpatialIndex::handles(where.cond) && name == "distance") {
+        for (const auto& [rowIdx, km] : spatialSearch(csv, where)) {
+            const auto [entry, added] = values.try_emplace(rowIdx, km);
+            entry->second = std::min(entry->second, km);
+        }
+    }
+}
+
+/**
+ * Helper method to order the selected rows of a CSV (by decreasing score or
+ * increasing distance, with ties in the order of the rows) and limit the
+ * number of rows.
+ *
+ * @param csv The CSV with the rows.
+ *
+ * @param selected The rows that meet the where clause.
+ *
+ * @param values The value of each row by which the rows are ordered. See
+ * addRankValues().
+ *
+ * @param rank The order and number of rows to be returned.
+ *
+ * @return The indexes of the rows to be printed, in order.
+ */
+std::vector<size_t> rankRows(const CSV& csv, const RowBitmap& selected,
+                             const std::unordered_map<size_t, double>& values,
+                             const RankClause& rank) {
+    // Rows are sorted by increasing key, so scores are negated. Rows
+    // without a distance are last.
+    const bool byScore = (rank.orderBy == "score");
+    std::vector<std::pair<double, size_t>> rows;  // (key, row index)
+    selected.forEach([&](const size_t rowIdx) {
+        if (rowIdx < csv.size()) {
+            const auto value = values.find(rowIdx);
+            rows.emplace_back(value == values.end() ?
+                              (byScore ? 0 : INFINITY) :
+                              (byScore ? -value->second : value->second),
+                              rowIdx);
+        }
+    });
+    const size_t count = std::min(rank.limit, rows.size());
+    if (!rank.orderBy.empty()) {
+        std::partial_sort(rows.begin(), rows.begin() + count, rows.end());
+    }
+    std::vector<size_t> ranked(count);
+    for (size_t i = 0; i < count; i++) {
+        ranked[i] = rows[i].second;
+    }
+    return ranked;
+}
+
+void SQLAir::setMemoryBudget(size_t bytes) {
+    memoryBudget = bytes;
+    enforceMemoryBudget();
+}
+
+void SQLAir::enforceMemoryBudget() {
+    if (memoryBudget == 0) {
+        return;  // Unlimited memory budget. No need to lock.
+    }
+    std::vector<std::shared_ptr<CSV>> evicted;  // Freed after unlocking
+    SpillList spills;
+    {
+        std::scoped_lock<std::mutex> guard(catalogMutex);
+        evictIfNeeded(evicted, spills);
+    }
+    for (const auto& [fileOrURL, spilled] : spills) {
+        spill(fileOrURL, spilled);
+    }
+}
+
+void SQLAir::indexColumns(CSV& csv) {
+    // The dictionaries add to the memory used by the CSV. So columns are
+    // encoded only if it has been enabled.
+    if (dictionaryEncoding) {
+        encodeColumns(csv);
+    } else {
+        csv.dictionaries.clear();
+        csv.dictionaries.resize(csv.getColumnCount());
+    }
+    // Build zone maps for all the columns.
+    csv.zoneMaps.clear();
+    for (int col = 0; col < csv.getColumnCount(); col++) {
+        csv.zoneMaps.push_back(std::make_unique<ZoneMap>());
+    }
+    for (size_t rowIdx = 0; rowIdx < csv.size(); rowIdx++) {
+        for (int col = 0; col < csv.getColumnCount(); col++) {
+            csv.zoneMaps[col]->add(rowIdx, csv[rowIdx].at(col));
+        }
+    }
+    // Dictionary encoded columns already check equality conditions once per
+    // distinct value. So Bloom filters are built only for other columns.
+    csv.bloomFilters.clear();
+    csv.bloomFilters.resize(csv.getColumnCount());
+    for (int col = 0; bloomFilters && col < csv.getColumnCount(); col++) {
+        if (csv.getDictionary(col) == nullptr) {
+            csv.bloomFilters[col] = std::make_unique<BloomFilter>();
+            for (size_t rowIdx = 0; rowIdx < csv.size(); rowIdx++) {
+                csv.bloomFilters[col]->add(rowIdx, csv[rowIdx].at(col));
+            }
+        }
+    }
+    // Rebuild the bitmap, full-text, and spatial indexes (if any) as row
+    // numbers may have changed.
+    for (int col = 0; col < static_cast<int>(csv.bitmapIndexes.size()); col++) {
+        if (csv.bitmapIndexes[col]) {
+            createBitmapIndex(csv, col);
+        }
+    }
+    for (int col = 0; col < static_cast<int>(csv.textIndexes.size()); col++) {
+        if (csv.textIndexes[col]) {
+            createTextIndex(csv, col);
+        }
+    }
+    if (csv.spatialIndex) {
+        createSpatialIndex(csv, csv.spatialIndex->getLatColumn(),
+                           csv.spatialIndex->getLonColumn());
+    }
+}
+
+void SQLAir::createIndexes(const std::string& fileOrURL, CSV& csv,
+                           const bool lock) {
+    StrVec bitmapCols, textCols, spatialCols;
+    {
+        std::unique_lock<std::mutex> guard(catalogMutex, std::defer_lock);
+        if (lock) {
+            guard.lock();
+        }
+        if (const auto entry = bitmapIndexCols.find(fileOrURL);
+            entry != bitmapIndexCols.end()) {
+            bitmapCols = entry->second;
+        }
+        if (const auto entry = textIndexCols.find(fileOrURL);
+            entry != textIndexCols.end()) {
+            textCols = entry->second;
+        }
+        if (const auto entry = spatialIndexCols.find(fileOrURL);
+            entry != spatialIndexCols.end()) {
+            spatialCols = entry->second;
+        }
+    }
+    for (const auto& colName : bitmapCols) {
+        if (const int colIdx = csv.getColumnIndex(colName); colIdx != -1) {
+            createBitmapIndex(csv, colIdx);
+        }
+    }
+    for (const auto& colName : textCols) {
+        if (const int colIdx = csv.getColumnIndex(colName); colIdx != -1) {
+            createTextIndex(csv, colIdx);
+        }
+    }
+    if (spatialCols.size() == 2) {
+        const int latCol = csv.getColumnIndex(spatialCols[0]);
+        const int lonCol = csv.getColumnIndex(spatialCols[1]);
+        if (latCol != -1 && lonCol != -1) {
+            createSpatialIndex(csv, latCol, lonCol);
+        }
+    }
+}
+
+void SQLAir::createBitmapIndex(CSV& csv, const int colIdx) {
+    auto index = std::make_unique<BitmapIndex>();
+    for (size_t rowIdx = 0; rowIdx < csv.size(); rowIdx++) {
+        index->add(rowIdx, csv[rowIdx].at(colIdx));
+    }
+    csv.bitmapIndexes.resize(csv.getColumnCount());
+    csv.bitmapIndexes[colIdx] = std::move(index);
+}
+
+void SQLAir::createTextIndex(CSV& csv, const int colIdx) {
+    auto index = std::make_unique<TextIndex>();
+    for (size_t rowIdx = 0; rowIdx < csv.size(); rowIdx++) {
+        index->add(rowIdx, csv[rowIdx].at(colIdx));
+    }
+    csv.textIndexes.resize(csv.getColumnCount());
+    csv.textIndexes[colIdx] = std::move(index);
+}
+
+void SQLAir::createSpatialIndex(CSV& csv, const int latCol,
+                                const int lonCol) {
+    auto index = std::make_unique<SpatialIndex>(latCol, lonCol);
+    for (size_t rowIdx = 0; rowIdx < csv.size(); rowIdx++) {
+        index->add(rowIdx, csv[rowIdx].at(latCol), csv[rowIdx].at(lonCol));
+    }
+    csv.spatialIndex = std::move(index);
+}
+
+void SQLAir::updateColumn(CSV& csv, const std::vector<size_t>& rows,
+                          const int colIdx, const std::string& newValue,
+                          const ColumnDictionary::Code code) {
+    const auto dict = csv.getDictionary(colIdx);
+    const auto zoneMap = csv.getZoneMap(colIdx);
+    const auto filter = csv.getBloomFilter(colIdx);
+    const auto index = csv.getBitmapIndex(colIdx);
+    const auto textIndex = csv.getTextIndex(colIdx);
+    const auto spatialIndex = csv.getSpatialIndex(colIdx);
+    logUndo(csv, rows, colIdx);
+    size_t bytes = 0;  // The change in the memory used by the cells
+    for (size_t first = 0, last = 0; first < rows.size(); first = last) {
+        const size_t block = rows[first] / ZoneMap::BlockSize;
+        size_t numOldNulls = 0;
+        for (; last < rows.size() && rows[last] / ZoneMap::BlockSize == block;
+             last++) {
+            const size_t rowIdx = rows[last];
+            std::string& cell = csv[rowIdx][colIdx];
+            numOldNulls += cell.empty();
+            if (dict != nullptr) {
+                dict->rowCodes[rowIdx] = code;
+            }
+            if (index != nullptr) {
+                index->update(rowIdx, cell, newValue);
+            }
+            if (textIndex != nullptr) {
+                textIndex->update(rowIdx, cell, newValue);
+            }
+            bytes -= CSV::cellMemory(cell);
+            cell = newValue;
+            bytes += CSV::cellMemory(cell);
+            if (spatialIndex != nullptr) {
+                spatialIndex->update(rowIdx,
+                                     csv[rowIdx][spatialIndex->getLatColumn()],
+                                     csv[rowIdx][spatialIndex->getLonColumn()]);
+            }
+        }
+        if (zoneMap != nullptr) {
+            zoneMap->update(block, last - first, numOldNulls, newValue);
+        }
+        if (filter != nullptr) {
+            filter->update(block, last - first, newValue);
+        }
+    }
+    csv.addMemory(bytes);
+}
+
+void SQLAir::updateColumn(CSV& csv, const std::vector<size_t>& rows,
+                          const int colIdx, StrVec&& newValues) {
+    const auto dict = csv.getDictionary(colIdx);
+    const auto zoneMap = csv.getZoneMap(colIdx);
+    const auto filter = csv.getBloomFilter(colIdx);
+    const auto index = csv.getBitmapIndex(colIdx);
+    const auto textIndex = csv.getTextIndex(colIdx);
+    const auto spatialIndex = csv.getSpatialIndex(colIdx);
+    logUndo(csv, rows, colIdx);
+    size_t bytes = 0;  // The change in the memory used by the cells
+    for (size_t i = 0; i < rows.size(); i++) {
+        const size_t rowIdx = rows[i], block = rowIdx / ZoneMap::BlockSize;
+        std::string& cell = csv[rowIdx][colIdx];
+        if (dict != nullptr) {
+            dict->rowCodes[rowIdx] = dict->encode(newValues[i]);
+        }
+        if (zoneMap != nullptr) {
+            zoneMap->update(block, 1, cell.empty(), newValues[i]);
+        }
+        if (filter != nullptr) {
+            filter->update(block, 1, newValues[i]);
+        }
+        if (index != nullptr) {
+            index->update(rowIdx, cell, newValues[i]);
+        }
+        if (textIndex != nullptr) {
+            textIndex->update(rowIdx, cell, newValues[i]);
+        }
+        bytes -= CSV::cellMemory(cell);
+        cell = std::move(newValues[i]);
+        bytes += CSV::cellMemory(cell);
+        if (spatialIndex != nullptr) {
+            spatialIndex->update(rowIdx,
+                                 csv[rowIdx][spatialIndex->getLatColumn()],
+                                 csv[rowIdx][spatialIndex->getLonColumn()]);
+        }
+    }
+    csv.addMemory(bytes);
+}
+
+void SQLAir::addToColumnIndexes(CSV& csv, const size_t rowIdx,
+                                const CSVRow& row) {
+    for (int colIdx = 0; colIdx < csv.getColumnCount(); colIdx++) {
+        if (auto dict = csv.getDictionary(colIdx)) {
+            dict->rowCodes.push_back(dict->encode(row.at(colIdx)));
+        }
+        if (auto zoneMap = csv.getZoneMap(colIdx)) {
+            zoneMap->add(rowIdx, row.at(colIdx));
+        }
+        if (auto filter = csv.getBloomFilter(colIdx)) {
+            filter->add(rowIdx, row.at(colIdx));
+        }
+        if (auto index = csv.getBitmapIndex(colIdx)) {
+            index->add(rowIdx, row.at(colIdx));
+        }
+        if (auto index = csv.getTextIndex(colIdx)) {
+            index->add(rowIdx, row.at(colIdx));
+        }
+    }
+    if (csv.spatialIndex) {
+        csv.spatialIndex->add(rowIdx, row.at(csv.spatialIndex->getLatColumn()),
+                              row.at(csv.spatialIndex->getLonColumn()));
+    }
+}
+
+void SQLAir::encodeColumns(CSV& csv) const {
+    // Only reasonably large CSVs with few distinct values in a column (at
+    // most 1 in 10 rows) are dictionary encoded.
+    const size_t MinRows = 256, MaxDistinctRatio = 10;
+    csv.dictionaries.clear();
+    csv.dictionaries.resize(csv.getColumnCount());
+    if (csv.size() < MinRows) {
+        return;
+    }
+    for (int col = 0; col < csv.getColumnCount(); col++) {
+        auto dict = std::make_unique<ColumnDictionary>(csv.size() /
+                                                       MaxDistinctRatio);
+        dict->rowCodes.reserve(csv.size());
+        for (const auto& row : csv) {
+            const auto code = dict->encode(row.at(col));
+            if (code == ColumnDictionary::NoCode) {
+                break;  // Too many distinct values
+            }
+            dict->rowCodes.push_back(code);
+        }
+        if (dict->rowCodes.size() == csv.size()) {
+            csv.dictionaries[col] = std::move(dict);
+        }
+    }
+}
+
+void SQLAir::refreshBloomFilter(CSV& csv, const int colIdx,
+                                BloomFilter& filter) const {
+    for (const size_t block : filter.getStaleBlocks()) {
+        filter.rebuild(block, [&](const auto& add) {
+            const size_t end = std::min(csv.size(),
+                                        (block + 1) * ZoneMap::BlockSize);
+            for (size_t rowIdx = block * ZoneMap::BlockSize; rowIdx < end;
+                 rowIdx++) {
+                auto& row = csv[rowIdx];
+                std::unique_lock<std::mutex> lock(row.rowMutex);
+                add(row.at(colIdx));
+            }
+        });
+    }
+}
+
+std::vector<bool> SQLAir::mayMatchBlocks(CSV& csv, const int colIdx,
+                                         const std::string& cond,
+                                         const std::string& value) const {
+    std::vector<bool> blocks;
+    if (auto zoneMap = csv.getZoneMap(colIdx)) {
+        blocks = zoneMap->mayMatch(cond, value);
+    }
+    if (auto filter = csv.getBloomFilter(colIdx); filter && cond == "=") {
+        refreshBloomFilter(csv, colIdx, *filter);
+        // Only blocks that may match per the zone map and filter are checked
+        const auto mayContain = filter->mayContain(value);
+        if (blocks.size() < mayContain.size()) {
+            blocks.resize(mayContain.size(), true);
+        }
+        for (size_t block = 0; block < mayContain.size(); block++) {
+            blocks[block] = blocks[block] && mayContain[block];
+        }
+    }
+    return blocks;
+}
+
+WhereClause SQLAir::prepareInList(CSV& csv, const int colIdx,
+                                  const StrVec& values) const {
+    WhereClause where{colIdx, "in"};
+    where.inValues.insert(values.begin(), values.end());
+    if (auto index = csv.getBitmapIndex(colIdx)) {
+        // Probe the bitmap index for each value.
+        std::vector<size_t> rows;
+        for (const auto& value : where.inValues) {
+            index->find(value)->forEach([&rows](const size_t rowIdx) {
+                rows.push_back(rowIdx);
+            });
+        }
+        std::sort(rows.begin(), rows.end());
+        auto bitmap = std::make_shared<RowBitmap>();
+        for (const size_t rowIdx : rows) {
+            bitmap->add(rowIdx);
+        }
+        where.rows = std::move(bitmap);
+        return where;
+    }
+    // A block may match if it may have any one of the values.
+    for (auto value = where.inValues.begin(); value != where.inValues.end();
+         value++) {
+        const auto blocks = mayMatchBlocks(csv, colIdx, "=", *value);
+        if (value == where.inValues.begin()) {
+            where.blockMayMatch = blocks;
+        }
+        // Blocks past the end of either vector may match.
+        where.blockMayMatch.resize(std::min(blocks.size(),
+                                            where.blockMayMatch.size()));
+        for (size_t block = 0; block < where.blockMayMatch.size(); block++) {
+            where.blockMayMatch[block] = where.blockMayMatch[block] ||
+                blocks[block];
+        }
+    }
+    where.dict = csv.getDictionary(colIdx);
+    if (where.dict != nullptr) {
+        // Check membership once for each distinct value in the column.
+        where.dict->forEachValue([&where](std::string_view distinctVal) {
+            where.codeMatches.push_back(
+                where.inValues.count(std::string(distinctVal)) > 0);
+        });
+    }
+    return where;
+}
+
+WhereClause SQLAir::prepareWhere(CSV& csv, const int whereColIdx,
+                                 const std::string& cond,
+                                 const std::string& value) const {
+    WhereClause where{whereColIdx, cond, value};
+    if (Matcher::handles(cond)) {
+        // The pattern is compiled just once for all the rows.
+        where.matcher = std::make_shared<const Matcher>(cond, value);
+    }
+    if (auto index = csv.getBitmapIndex(whereColIdx); index && cond == "=") {
+        // The bitmap index has exactly the rows with the value.
+        where.rows = index->find(value);
+        return where;
+    }
+    where.blockMayMatch = mayMatchBlocks(csv, whereColIdx, cond, value);
+    if ((where.dict = csv.getDictionary(whereColIdx)) != nullptr) {
+        // Check the condition once for each distinct value in the column.
+        std::string colVal;
+        where.dict->forEachValue([&](std::string_view distinctVal) {
+            if (where.matcher) {
+                where.codeMatches.push_back(
+                    where.matcher->matches(distinctVal));
+                return;
+            }
+            colVal.assign(distinctVal.begin(), distinctVal.end());
+            where.codeMatches.push_back(matches(colVal, cond, value));
+        });
+    }
+    return where;
+}
+
+bool SQLAir::matchesRow(const WhereClause& where, const CSV& csv,
+                        const size_t rowIdx) const {
+    if (where.colIdx == -1) {
+        return true;  // No where clause.
+    }
+    if (where.rows && !where.rows->contains(rowIdx)) {
+        return false;  // Not in the rows from the bitmap index
+    }
+    const size_t block = rowIdx / ZoneMap::BlockSize;
+    if (block < where.blockMayMatch.size() && !where.blockMayMatch[block]) {
+        return false;  // No row in this block meets the condition
+    }
+    if (where.dict != nullptr && rowIdx < where.dict->rowCodes.size()) {
+        // Values added to the dictionary after the where clause was prepared
+        // are checked directly below.
+        const auto code = where.dict->rowCodes[rowIdx];
+        if (code < where.codeMatches.size()) {
+            return where.codeMatches[code];
+        }
+    }
+    if (where.cond == "in") {
+        return where.inValues.count(csv[rowIdx].at(where.colIdx)) > 0;
+    }
+    if (where.matcher) {
+        return where.matcher->matches(csv[rowIdx].at(where.colIdx));
+    }
+    return matches(csv[rowIdx].at(where.colIdx), where.cond, where.value);
+}
+
+size_t SQLAir::nextCandidate(const WhereClause& where,
+                             size_t rowIdx) const {
+    if (where.rows) {
+        return where.rows->next(rowIdx);
+    }
+    for (size_t block = rowIdx / ZoneMap::BlockSize;
+         block < where.blockMayMatch.size() && !where.blockMayMatch[block];
+         block++) {
+        rowIdx = (block + 1) * ZoneMap::BlockSize;
+    }
+    return rowIdx;
+}
+
+ColumnPlan SQLAir::planColumns(const CSV& csv, const StrVec& colNames,
+                               const StrVec& values) const {
+    ColumnPlan plan;
+    // With a wildcard column name, a select prints all of the columns.
+    plan.colNames = (values.empty() && colNames.size() == 1 &&
+                     colNames.front() == "*" ? csv.getColumnNames() :
+                     colNames);
+    plan.values = values;
+    for (size_t i = 0; i < plan.colNames.size(); i++) {
+        const int colIdx = csv.getColumnIndex(plan.colNames[i]);
+        if (colIdx == -1) {
+            throw Exp("Invalid column name " + plan.colNames[i]);
+        }
+        plan.colIdx.push_back(colIdx);
+    }
+    return plan;
+}
+
+int SQLAir::selectHelper(CSV& csv, const ColumnPlan& plan,
+                         const int whereColIdx, const std::string& cond,
+                         const std::string& value, std::ostream& os) {
+    const auto table = readLock(csv);
     int rowCount = 0;
-    // Convert any "*" to suitable column names.
-    if (colNames.size() == 1 && colNames.front() == "*") {
-        // With a wildcard column name, we print all of the columns in CSV
-        colNames = csv.getColumnNames();
+    // Matching rows are printed in batches, so that expressions (if any)
+    // are evaluated for a batch of rows at a time.
+    std::vector<size_t> batch;
+    const auto printBatch = [&]() {
+        if (rowCount == 0 && !batch.empty()) {
+            os << plan.colNames << std::endl;
+        }
+        printRows(csv, plan, batch, os);
+        rowCount += batch.size();
+        batch.clear();
+    };
+    const WhereClause where = prepareWhere(csv, whereColIdx, cond, value);
+    // Print each row that matches an optional condition.
+    for (size_t rowIdx = nextCandidate(where, 0); rowIdx < csv.size();
+         rowIdx = nextCandidate(where, rowIdx + 1)) {
+        // Determine if this row matches "where" clause condition, if any
+        // see SQLAirBase::matches() helper method.
+        std::unique_lock<std::mutex> lock(csv[rowIdx].rowMutex);
+        if (matchesRow(where, csv, rowIdx)) {
+            batch.push_back(rowIdx);
+        }
+        lock.unlock();
+        if (batch.size() == ZoneMap::BlockSize) {
+            printBatch();
+        }
+    }
+    printBatch();
+    return rowCount;
+}
+
+/*#include <functional>
+
+bool fn(const StrVec& vec, std::function<bool(const StrVec&)> lmb) {
+    return lmb(vec);
+}
+
+void SQLAir::testfunc() {
+    int whereCol = 1;
+    std::string cond = "like";
+    std::string val = "The";
+    auto testFunc = [whereCol, cond, val](const StrVec& row) {
+        return matches(row[whereCol], cond, val);
+    };
+    fn(vec, testFunc);
+}
+*/
+// API method to perform operations associated with a "select" statement
+// to print columns that match an optional condition.
+void SQLAir::selectQuery(CSV& csv, bool mustWait, StrVec colNames,
+                         const int whereColIdx, const std::string& cond,
+                         const std::string& value, std::ostream& os) {
+    selectQuery(csv, mustWait, planColumns(csv, colNames), whereColIdx, cond,
+                value, os);
+}
+
+void SQLAir::selectQuery(CSV& csv, bool mustWait, const ColumnPlan& plan,
+                         const int whereColIdx, const std::string& cond,
+                         const std::string& value, std::ostream& os) {
+    // The version is noted before the rows are checked, so that rows added
+    // while checking are not missed when waiting for them.
+    size_t version = csv.version;
+    int rowCount = selectHelper(csv, plan, whereColIdx, cond, value, os);
+    while (rowCount == 0 && mustWait) {
+        csv.waitForChange(version);
+        version = csv.version;
+        rowCount = selectHelper(csv, plan, whereColIdx, cond, value, os);
+    }
+    os << rowCount << " row(s) selected." << std::endl;
+}
+
+void SQLAir::validateAndProcessSelect(const StrVec& sql, bool mustWait,
+                                      std::ostream& os) {
+    const auto where = std::find(sql.begin(), sql.end(), "where");
+    const bool isCount = (sql.size() > 4 && sql[1] == "count" &&
+                          sql[2] == "(" && sql[3] == "*" && sql[4] == ")");
+    // The column names (or expressions) are followed by an optional "from"
+    // clause. Without it, the most recently used CSV is used.
+    const auto from = std::find(std::min(sql.begin() + 1, where), where,
+                                "from");
+    const StrVec colNames(std::min(sql.begin() + 1, from), from);
+    const bool isExpr = !isCount && hasExpressions(colNames);
+    // Simple where clauses (just "where col cond value") are handled by the
+    // base class, except for "select count(*) ...", expressions, and
+    // conditions checked by a Matcher (e.g., "ilike").
+    const bool isMatch = (sql.end() - where == 4 && Matcher::handles(where[2]));
+    if (!isCount && !isExpr && !isMatch && sql.end() - where <= 4) {
+        SQLAirBase::validateAndProcessSelect(sql, mustWait, os);
+        return;
+    }
+    if (colNames.empty()) {
+        throw Exp("Specify column names or just * to select");
+    }
+    if (from != where && from + 1 == where) {
+        throw Exp("Missing file/URL before where");
+    }
+    CSV& csv = loadAndGet(from != where ? *(from + 1) : "");
+    if (isCount && where == sql.end()) {
+        countQuery(csv, nullptr, os);
+        return;
+    }
+    ColumnPlan plan;
+    // A "score" or "distance" in the select list (unless the CSV has a
+    // column with that name) is computed from the full-text or spatial
+    // conditions. See RankClause.
+    const bool hasRankValue = (where != sql.end() &&
+                               std::any_of(colNames.begin(), colNames.end(),
+                                           [&csv](const std::string& name) {
+                                               return isRankValue(csv, name);
+                                           }));
+    if (isExpr || hasRankValue) {
+        plan = planSelectList(csv, splitParens(colNames.begin(),
+                                               colNames.end()));
+    } else if (!isCount) {
+        checkColNames(csv, colNames);
+        plan = planColumns(csv, colNames);
+    }
+    if (where == sql.end()) {
+        selectQuery(csv, mustWait, plan, -1, "", "", os);
+        return;
+    }
+    const StrVec tokens = splitParens(where + 1, sql.end());
+    size_t pos = 0;
+    const auto expr = parseWhere(csv, tokens, pos);
+    if (isCount) {
+        if (pos != tokens.size()) {
+            throw Exp("Invalid where clause in query");
+        }
+        countQuery(csv, expr.get(), os);
+    } else {
+        selectQuery(csv, mustWait, plan, *expr, parseRankClause(tokens, pos),
+                    os);
+    }
+}
+
+RankClause SQLAir::parseRankClause(const StrVec& tokens, size_t pos) const {
+    RankClause rank;
+    if (pos < tokens.size() && tokens[pos] == "order") {
+        if (pos + 2 >= tokens.size() || tokens[pos + 1] != "by" ||
+            (tokens[pos + 2] != "score" && tokens[pos + 2] != "distance")) {
+            throw Exp("Invalid order by clause. Use: order by "
+                      "{score|distance}");
+        }
+        // Scores are always in decreasing order and distances in
+        // increasing order.
+        rank.orderBy = tokens[pos + 2];
+        const std::string dir = (rank.orderBy == "score" ? "desc" : "asc");
+        pos += (pos + 3 < tokens.size() && tokens[pos + 3] == dir ? 4 : 3);
+    }
+    if (pos < tokens.size() && tokens[pos] == "limit") {
+        if (pos + 1 >= tokens.size() || tokens[pos + 1].empty() ||
+            tokens[pos + 1].find_first_not_of("0123456789") !=
+            std::string::npos) {
+            throw Exp("Invalid limit clause. Use: limit <number of rows>");
+        }
+        rank.limit = std::strtoull(tokens[pos + 1].c_str(), nullptr, 10);
+        pos += 2;
+    }
+    if (pos != tokens.size()) {
+        throw Exp("Invalid where clause in query");
+    }
+    return rank;
+}
+
+ColumnPlan SQLAir::planSelectList(const CSV& csv,
+                                  const StrVec& tokens) const {
+    ColumnPlan plan;
+    for (size_t pos = 0; pos < tokens.size();) {
+        const ExprPtr expr = Expr::compile(csv, tokens, pos);
+        // Plain columns are printed directly from the rows.
+        const int colIdx = expr->getColumn();
+        plan.colNames.push_back(expr->getText());
+        plan.colIdx.push_back(colIdx);
+        plan.exprs.push_back(colIdx == -1 ? expr : nullptr);
+    }
+    return plan;
+}
+
+void SQLAir::validateAndProcessUpdate(const StrVec& sql, bool mustWait,
+                                      std::ostream& os) {
+    // Set clauses with just "col = value" pairs are handled by the base
+    // class, unless the condition is checked by a Matcher (e.g., "ilike").
+    const auto set = std::find(sql.begin(), sql.end(), "set");
+    const auto where = std::find(set, sql.end(), "where");
+    bool isExpr = (set != sql.end() && (where - set - 1) % 3 != 0);
+    for (auto tok = set; !isExpr && tok < where && tok + 2 < where;
+         tok += 3) {
+        isExpr = (*(tok + 2) != "=");
+    }
+    if (!isExpr && (sql.end() - where != 4 || !Matcher::handles(where[2]))) {
+        SQLAirBase::validateAndProcessUpdate(sql, mustWait, os);
+        return;
+    }
+    // The statement is "update [<csv>] set <col> = <expr>, ... [where ...]"
+    if (set - sql.begin() > 2) {
+        throw Exp("Invalid update statement. Use: update <csv> set "
+                  "<column> = <expression>, ... [where <condition>]");
+    }
+    CSV& csv = loadAndGet(set - sql.begin() == 2 ? sql[1] : "");
+    const ColumnPlan plan = planSetClause(csv, splitParens(set + 1, where));
+    // Only simple where clauses (just "where col cond value") are supported.
+    const auto [whereColIdx, cond, value] = parseSimpleWhere(csv, where,
+                                                             sql.end());
+    updateQuery(csv, mustWait, plan, whereColIdx, cond, value, os);
+}
+
+void SQLAir::validateAndProcessDelete(const StrVec& sql, bool mustWait,
+                                      std::ostream& os) {
+    // Conditions checked by a Matcher (e.g., "ilike") are handled here and
+    // all other delete statements are handled by the base class.
+    const auto where = std::find(sql.begin(), sql.end(), "where");
+    if (sql.end() - where != 4 || !Matcher::handles(where[2])) {
+        SQLAirBase::validateAndProcessDelete(sql, mustWait, os);
+        return;
+    }
+    // The statement is "delete from <csv> where <col> <cond> <value>"
+    if (sql.size() < 2 || sql[1] != "from" || where - sql.begin() > 3) {
+        throw Exp("Invalid delete statement. Use: delete from <csv> "
+                  "[where <condition>]");
+    }
+    if (where - sql.begin() == 2) {
+        throw Exp("Missing file/URL before where");
+    }
+    CSV& csv = loadAndGet(sql[2]);
+    const auto [whereColIdx, cond, value] = parseSimpleWhere(csv, where,
+                                                             sql.end());
+    deleteQuery(csv, mustWait, whereColIdx, cond, value, os);
+}
+
+std::tuple<int, std::string, std::string>
+SQLAir::parseSimpleWhere(const CSV& csv, StrVec::const_iterator where,
+                         StrVec::const_iterator end) const {
+    if (where == end) {
+        return {-1, "", ""};
+    }
+    if (end - where != 4 || (where[2] != "=" && where[2] != "<>" &&
+                             where[2] != "like" &&
+                             !Matcher::handles(where[2]))) {
+        throw Exp("Invalid where clause in query");
+    }
+    const int colIdx = csv.getColumnIndex(where[1]);
+    if (colIdx == -1) {
+        throw Exp("Invalid column " + where[1] + " in where clause.");
+    }
+    if (Matcher::handles(where[2])) {
+        // Report an invalid pattern now, rather than when the rows are
+        // checked (which is at commit for writes in a transaction).
+        Matcher check(where[2], where[3]);
+    }
+    return {colIdx, where[2], where[3]};
+}
+
+ColumnPlan SQLAir::planSetClause(const CSV& csv, const StrVec& tokens) const {
+    ColumnPlan plan;
+    for (size_t pos = 0; pos < tokens.size();) {
+        if (pos + 2 >= tokens.size() || tokens[pos + 1] != "=") {
+            throw Exp("Invalid set clause in update query");
+        }
+        const int colIdx = csv.getColumnIndex(tokens[pos]);
+        if (colIdx == -1) {
+            throw Exp("Invalid column name " + tokens[pos]);
+        }
+        plan.colNames.push_back(tokens[pos]);
+        plan.colIdx.push_back(colIdx);
+        const size_t start = (pos += 2);
+        const ExprPtr expr = Expr::compile(csv, tokens, pos);
+        if (pos == start + 1) {
+            // Just one token is a literal value, as in the base class.
+            plan.values.push_back(tokens[start]);
+            plan.exprs.push_back(nullptr);
+        } else {
+            plan.values.emplace_back();
+            plan.exprs.push_back(expr);
+        }
+    }
+    return plan;
+}
+
+void SQLAir::countQuery(CSV& csv, const WhereExpr* where, std::ostream& os) {
+    const auto table = readLock(csv);
+    const size_t count = (where != nullptr ? selectRows(csv, *where)->count() :
+                          csv.size());
+    os << "count(*)\n" << count << "\n1 row(s) selected." << std::endl;
+}
+
+void SQLAir::validateAndProcessCreate(const StrVec& sql, bool mustWait,
+                                      std::ostream& os) {
+    // The statement is "create {bitmap|text} index [name] on <csv> (<column>)"
+    // or "create spatial index [name] on <csv> (<latitude>, <longitude>)"
+    const auto on = std::find(sql.begin(), sql.end(), "on");
+    StrVec colNames;
+    std::copy_if((on == sql.end() ? on : on + 2), sql.end(),
+                 std::back_inserter(colNames),
+                 [](const std::string& tok) {
+                     return tok.find_first_not_of("()") != std::string::npos;
+                 });
+    const std::string kind = (sql.size() > 1 ? sql[1] : "");
+    if (sql.size() < 3 || (kind != "bitmap" && kind != "text" &&
+                           kind != "spatial") ||
+        sql[2] != "index" || on == sql.end() || on + 1 == sql.end() ||
+        colNames.size() != (kind == "spatial" ? 2u : 1u) ||
+        on - sql.begin() > 4) {
+        throw Exp("Invalid create statement. Use: create {bitmap|text} index "
+                  "on <csv> (<column>) or create spatial index on <csv> "
+                  "(<latitude>, <longitude>)");
+    }
+    const std::string fileOrURL = *(on + 1);
+    CSV& csv = loadAndGet(fileOrURL);
+    checkColNames(csv, colNames, false, false);
+    const int colIdx = csv.getColumnIndex(colNames.front());
+    const int lonCol = csv.getColumnIndex(colNames.back());
+    {
+        // The vectors of indexes may be resized. So concurrent queries on
+        // this CSV are blocked while the index is built.
+        const auto table = writeLock(csv);
+        if (kind == "spatial" && (csv.spatialIndex == nullptr ||
+                                  csv.spatialIndex->getLatColumn() != colIdx ||
+                                  csv.spatialIndex->getLonColumn() != lonCol)) {
+            createSpatialIndex(csv, colIdx, lonCol);
+        } else if (kind == "text" && csv.getTextIndex(colIdx) == nullptr) {
+            createTextIndex(csv, colIdx);
+        } else if (kind == "bitmap" && csv.getBitmapIndex(colIdx) == nullptr) {
+            createBitmapIndex(csv, colIdx);
+        }
+        csv.measureMemory();
+    }
+    {
+        // Record the index so that it is recreated if the CSV is reloaded.
+        std::scoped_lock<std::mutex> guard(catalogMutex);
+        if (kind == "spatial") {
+            spatialIndexCols[fileOrURL] = colNames;
+        } else {
+            auto& indexed = (kind == "text" ? textIndexCols :
+                             bitmapIndexCols)[fileOrURL];
+            if (std::find(indexed.begin(), indexed.end(), colNames.front()) ==
+                indexed.end()) {
+                indexed.push_back(colNames.front());
+            }
+        }
+    }
+    if (kind == "spatial") {
+        os << "Spatial index created on " << colNames.front() << ", "
+           << colNames.back() << " (" << csv.spatialIndex->size()
+           << " rows with valid coordinates)." << std::endl;
+    } else if (kind == "text") {
+        os << "Text index created on " << colNames.front() << " ("
+           << csv.getTextIndex(colIdx)->size() << " distinct terms)."
+           << std::endl;
+    } else {
+        os << "Bitmap index created on " << colNames.front() << " ("
+           << csv.getBitmapIndex(colIdx)->size() << " distinct values)."
+           << std::endl;
+    }
+}
+
+std::unique_ptr<WhereExpr> SQLAir::parseWhere(const CSV& csv,
+                                              const StrVec& sql, size_t& pos,
+                                              const int precedence) const {
+    if (precedence < 2) {
+        // Left-associative chain of operators at this precedence level.
+        const std::string op = (precedence == 0 ? "or" : "and");
+        auto expr = parseWhere(csv, sql, pos, precedence + 1);
+        while (pos < sql.size() && sql[pos] == op) {
+            auto combined = std::make_unique<WhereExpr>();
+            combined->op = sql[pos++];
+            combined->lhs = std::move(expr);
+            combined->rhs = parseWhere(csv, sql, pos, precedence + 1);
+            expr = std::move(combined);
+        }
+        return expr;
+    }
+    if (pos < sql.size() && sql[pos] == "(") {
+        auto expr = parseWhere(csv, sql, ++pos);
+        if (pos >= sql.size() || sql[pos++] != ")") {
+            throw Exp("Invalid where clause in query");
+        }
+        return expr;
+    }
+    if (pos + 1 < sql.size() && sql[pos] == "match" && sql[pos + 1] == "(") {
+        // A full-text condition of the form "match ( col terms )"
+        if (pos + 4 >= sql.size() || sql[pos + 4] != ")") {
+            throw Exp("Invalid match condition. Use: "
+                      "match(<column>, '<terms>')");
+        }
+        auto expr = std::make_unique<WhereExpr>();
+        expr->colIdx = csv.getColumnIndex(sql[pos + 2]);
+        if (expr->colIdx == -1) {
+            throw Exp("Invalid column " + sql[pos + 2] + " in where clause.");
+        }
+        textIndexOf(csv, expr->colIdx);  // Throws if there is no index
+        expr->cond = "match";
+        expr->values = {sql[pos + 3]};
+        pos += 5;
+        return expr;
+    }
+    if (pos + 1 < sql.size() && SpatialIndex::handles(sql[pos]) &&
+        sql[pos + 1] == "(") {
+        // A spatial condition of the form "within_radius ( lat lon km )" or
+        // "nearest ( lat lon k )"
+        // "nearest" needs an integral number of rows that fits a size_t.
+        const bool isNearest = (sql[pos] == "nearest");
+        double lat = 0, lon = 0, arg = 0;
+        if (pos + 5 >= sql.size() || sql[pos + 5] != ")" ||
+            !ZoneMap::toNumber(sql[pos + 2], lat) || !(std::abs(lat) <= 90) ||
+            !ZoneMap::toNumber(sql[pos + 3], lon) || !(std::abs(lon) <= 180) ||
+            !ZoneMap::toNumber(sql[pos + 4], arg) || !(arg >= 0) ||
+            (isNearest && (arg != std::floor(arg) ||
+                           arg >= std::ldexp(1.0, 63)))) {
+            throw Exp(isNearest ? "Invalid nearest condition. Use: "
+                      "nearest(<latitude>, <longitude>, <number of rows>)" :
+                      "Invalid within_radius condition. Use: "
+                      "within_radius(<latitude>, <longitude>, <km>)");
+        }
+        spatialIndexOf(csv);  // Throws if there is no index
+        auto expr = std::make_unique<WhereExpr>();
+        expr->colIdx = csv.spatialIndex->getLatColumn();
+        expr->cond = sql[pos];
+        expr->values = {sql[pos + 2], sql[pos + 3], sql[pos + 4]};
+        pos += 6;
+        return expr;
+    }
+    // A single condition of the form "col cond value" or an "in" condition
+    // of the form "col in ( value1 value2 ... )"
+    const bool isIn = (pos + 3 < sql.size() && sql[pos + 1] == "in" &&
+                       sql[pos + 2] == "(");
+    if (pos + 3 > sql.size() || (sql[pos + 1] != "=" &&
+                                 sql[pos + 1] != "<>" &&
+                                 sql[pos + 1] != "like" && !isIn &&
+                                 !Matcher::handles(sql[pos + 1]))) {
+        throw Exp("Invalid where clause in query");
+    }
+    auto expr = std::make_unique<WhereExpr>();
+    expr->colIdx = csv.getColumnIndex(sql[pos]);
+    if (expr->colIdx == -1) {
+        throw Exp("Invalid column " + sql[pos] + " in where clause.");
+    }
+    expr->cond = sql[pos + 1];
+    if (!isIn) {
+        expr->values = {sql[pos + 2]};
+        pos += 3;
+        return expr;
+    }
+    for (pos += 3; pos < sql.size() && sql[pos] != ")"; pos++) {
+        expr->values.push_back(sql[pos]);
+    }
+    if (pos++ >= sql.size() || expr->values.empty()) {
+        throw Exp("Invalid where clause in query");
+    }
+    return expr;
+}
+
+std::shared_ptr<const RowBitmap> SQLAir::selectRows(CSV& csv,
+                                                    const int colIdx,
+                                                    const std::string& cond,
+                                                    const StrVec& values) {
+    std::string key = std::to_string(colIdx) + '\t' + cond;
+    for (const auto& value : values) {
+        key += '\t' + value;
+    }
+    // The version must be noted before the rows are checked, so that
+    // concurrent changes make the bitmap stale.
+    const size_t version = csv.version;
+    if (auto bitmap = csv.bitmapCache.find(key, version)) {
+        return bitmap;
+    }
+    auto bitmap = std::make_shared<RowBitmap>();
+    const WhereClause where = (cond == "in" ?
+                               prepareInList(csv, colIdx, values) :
+                               prepareWhere(csv, colIdx, cond, values.at(0)));
+    for (size_t rowIdx = nextCandidate(where, 0); rowIdx < csv.size();
+         rowIdx = nextCandidate(where, rowIdx + 1)) {
+        std::unique_lock<std::mutex> lock(csv[rowIdx].rowMutex);
+        if (matchesRow(where, csv, rowIdx)) {
+            bitmap->add(rowIdx);
+        }
+    }
+    csv.bitmapCache.insert(key, version, bitmap);
+    return bitmap;
+}
+
+std::shared_ptr<const RowBitmap> SQLAir::selectRows(CSV& csv,
+                                                    const WhereExpr& where) {
+    if (where.op.empty() && where.cond == "match") {
+        auto bitmap = std::make_shared<RowBitmap>();
+        const auto& index = textIndexOf(csv, where.colIdx);
+        for (const auto& result : index.search(where.values.front())) {
+            bitmap->add(result.first);
+        }
+        return bitmap;
+    }
+    if (where.op.empty() && SpatialIndex::handles(where.cond)) {
+        // The bitmap is built with the rows in ascending order.
+        std::vector<size_t> rows;
+        for (const auto& result : spatialSearch(csv, where)) {
+            rows.push_back(result.first);
+        }
+        std::sort(rows.begin(), rows.end());
+        auto bitmap = std::make_shared<RowBitmap>();
+        for (const size_t rowIdx : rows) {
+            bitmap->add(rowIdx);
+        }
+        return bitmap;
+    }
+    if (where.op.empty()) {
+        auto index = csv.getBitmapIndex(where.colIdx);
+        return (index != nullptr && where.cond == "=" ?
+                index->find(where.values.front()) :
+                selectRows(csv, where.colIdx, where.cond, where.values));
+    }
+    const auto lhs = selectRows(csv, *where.lhs);
+    const auto rhs = selectRows(csv, *where.rhs);
+    return std::make_shared<RowBitmap>(where.op == "and" ? *lhs & *rhs :
+                                       *lhs | *rhs);
+}
+
+int SQLAir::selectHelper(CSV& csv, const ColumnPlan& plan,
+                         const WhereExpr& where, const RankClause& rank,
+                         std::ostream& os) {
+    const auto table = readLock(csv);
+    const auto selected = selectRows(csv, where);
+    // The scores or distances of the rows are needed to rank rows or to
+    // print them. They are computed at most once per query.
+    std::unordered_map<std::string, std::unordered_map<size_t, double>> values;
+    const auto valuesOf = [&](const std::string& name) -> const auto& {
+        const auto [entry, added] = values.try_emplace(name);
+        if (added) {
+            addRankValues(csv, where, name, entry->second);
+        }
+        return entry->second;
+    };
+    ColumnPlan ranked = plan;
+    for (size_t i = 0; i < plan.colNames.size(); i++) {
+        if (plan.colIdx[i] == -1 && isRankValue(csv, plan.colNames[i])) {
+            ranked.exprs[i] = std::make_shared<RankExpr>(
+                plan.colNames[i], valuesOf(plan.colNames[i]));
+        }
     }
-    // Print each row that matches an optional condition.
-    for (auto& row : csv) {
-        // Determine if this row matches "where" clause condition, if any
-        // see SQLAirBase::matches() helper method.
-        bool isMatch;
-        {
-            std::unique_lock<std::mutex> lock(row.rowMutex);
-            isMatch = (whereColIdx == -1)
-                          ? true
-                          : matches(row.at(whereColIdx), cond, value);
-        }
-        if (isMatch) {
-            if (rowCount == 0) {
-                os << colNames << std::endl;
+    // Print just the rows in the bitmap, in batches. See the other overload.
+    int rowCount = 0;
+    std::vector<size_t> batch;
+    const auto printBatch = [&]() {
+        if (rowCount == 0 && !batch.empty()) {
+            os << plan.colNames << std::endl;
+        }
+        printRows(csv, ranked, batch, os);
+        rowCount += batch.size();
+        batch.clear();
+    };
+    const auto addRow = [&](const size_t rowIdx) {
+        batch.push_back(rowIdx);
+        if (batch.size() == ZoneMap::BlockSize) {
+            printBatch();
+        }
+    };
+    if (rank.orderBy.empty() && rank.limit == RankClause().limit) {
+        selected->forEach([&](const size_t rowIdx) {
+            if (rowIdx < csv.size()) {
+                addRow(rowIdx);
             }
-            printRow(row, colNames, csv, os);
-            rowCount++;
+        });
+    } else {
+        for (const size_t rowIdx : rankRows(csv, *selected,
+                                            valuesOf(rank.orderBy), rank)) {
+            addRow(rowIdx);
         }
     }
+    printBatch();
     return rowCount;
 }
 
-/*#include <functional>
-
-bool fn(const StrVec& vec, std::function<bool(const StrVec&)> lmb) {
-    return lmb(vec);
-}
-
-void SQLAir::testfunc() {
-    int whereCol = 1;
-    std::string cond = "like";
-    std::string val = "The";
-    auto testFunc = [whereCol, cond, val](const StrVec& row) {
-        return matches(row[whereCol], cond, val);
-    };
-    fn(vec, testFunc);
-}
-*/
-// API method to perform operations associated with a "select" statement
-// to print columns that match an optional condition.
-void SQLAir::selectQuery(CSV& csv, bool mustWait, StrVec colNames,
-                         const int whereColIdx, const std::string& cond,
-                         const std::string& value, std::ostream& os) {
-    // Convert any "*" to suitable column names. See CSV::getColumnNames()
-    int rowCount = selectHelper(csv, colNames, whereColIdx, cond, value, os);
+void SQLAir::selectQuery(CSV& csv, bool mustWait, const ColumnPlan& plan,
+                         const WhereExpr& where, const RankClause& rank,
+                         std::ostream& os) {
+    size_t version = csv.version;  // See the other selectQuery()
+    int rowCount = selectHelper(csv, plan, where, rank, os);
     while (rowCount == 0 && mustWait) {
-        rowCount = selectHelper(csv, colNames, whereColIdx, cond, value, os);
-        std::unique_lock<std::mutex> lock(csv.csvMutex);
-        csv.csvCondVar.wait(lock);
+        csv.waitForChange(version);
+        version = csv.version;
+        rowCount = selectHelper(csv, plan, where, rank, os);
     }
     os << rowCount << " row(s) selected." << std::endl;
 }
 
-int SQLAir::updateHelper(CSV& csv, StrVec colNames, StrVec values,
+int SQLAir::updateHelper(CSV& csv, const ColumnPlan& plan,
                          const int whereColIdx, const std::string& cond,
                          const std::string& value, std::ostream& os) {
-    if (std::find(colNames.begin(), colNames.end(), "*") != colNames.end()) {
-        colNames = csv.getColumnNames();
+    // The table is locked exclusively just once (rather than locking each
+    // row) so that the rows can be updated in tight loops.
+    const auto table = writeLock(csv);
+    // First, the rows that meet the where clause are selected.
+    std::vector<size_t> rows;
+    const WhereClause where = prepareWhere(csv, whereColIdx, cond, value);
+    for (size_t rowIdx = nextCandidate(where, 0); rowIdx < csv.size();
+         rowIdx = nextCandidate(where, rowIdx + 1)) {
+        if (matchesRow(where, csv, rowIdx)) {
+            rows.push_back(rowIdx);
+        }
     }
-    int rowCount = 0;
-    for (auto& row : csv) {
-        // Determine if this row matches "where" clause condition, if any
-        // see SQLAirBase::matches() helper method.
-        std::unique_lock<std::mutex> lock(row.rowMutex);
-        if (whereColIdx == -1 || matches(row.at(whereColIdx), cond, value)) {
-            for (size_t i = 0; i < colNames.size(); i++) {
-                auto colIdx = csv.getColumnIndex(colNames[i]);
-                row.at(colIdx) = values[i];
-            }
-            rowCount++;
+    // Next, expressions (if any) are evaluated using the values in the
+    // rows before they are changed.
+    std::vector<StrVec> computed(plan.exprs.size());
+    for (size_t i = 0; i < plan.exprs.size(); i++) {
+        if (plan.exprs[i] != nullptr) {
+            plan.exprs[i]->eval(csv, rows, computed[i]);
+        }
+    }
+    // Finally, the value for each column is set in all the selected rows.
+    for (size_t i = 0; i < plan.colIdx.size(); i++) {
+        if (i < plan.exprs.size() && plan.exprs[i] != nullptr) {
+            updateColumn(csv, rows, plan.colIdx[i], std::move(computed[i]));
+        } else {
+            // Encoding the value just once saves a look-up for each row.
+            // This is done under the table lock, as deletes rebuild the
+            // dictionaries.
+            const auto dict = csv.getDictionary(plan.colIdx[i]);
+            updateColumn(csv, rows, plan.colIdx[i], plan.values[i],
+                         dict != nullptr && !rows.empty() ?
+                         dict->encode(plan.values[i]) :
+                         ColumnDictionary::NoCode);
         }
     }
+    const int rowCount = rows.size();
     if (rowCount > 0) {
-        csv.csvCondVar.notify_all();
+        markModified(csv);
     }
     return rowCount;
 }
@@ -149,63 +1542,337 @@ void SQLAir::updateQuery(CSV& csv, bool mustWait, StrVec colNames,
                          StrVec values, const int whereColIdx,
                          const std::string& cond, const std::string& value,
                          std::ostream& os) {
-    int rowCount =
-        updateHelper(csv, colNames, values, whereColIdx, cond, value, os);
+    updateQuery(csv, mustWait, planColumns(csv, colNames, values),
+                whereColIdx, cond, value, os);
+}
+
+void SQLAir::updateQuery(CSV& csv, bool mustWait, const ColumnPlan& plan,
+                         const int whereColIdx, const std::string& cond,
+                         const std::string& value, std::ostream& os) {
+    if (deferWrite(csv, [=, &csv](std::ostream& out) {
+            updateQuery(csv, false, plan, whereColIdx, cond, value, out);
+        }, os)) {
+        return;
+    }
+    size_t version = csv.version;  // See selectQuery()
+    int rowCount = updateHelper(csv, plan, whereColIdx, cond, value, os);
     // Update each row that matches an optional condition.
-    // throw Exp("update is not yet implemented.");
     while (rowCount == 0 && mustWait) {
-        rowCount =
-            updateHelper(csv, colNames, values, whereColIdx, cond, value, os);
-        std::unique_lock lock(csv.csvMutex);
-        csv.csvCondVar.wait(lock);
+        csv.waitForChange(version);
+        version = csv.version;
+        rowCount = updateHelper(csv, plan, whereColIdx, cond, value, os);
     }
     os << rowCount << " row(s) updated." << std::endl;
 }
 
 void SQLAir::insertQuery(CSV& csv, bool mustWait, StrVec colNames,
                          StrVec values, std::ostream& os) {
-    CSVRow row;
-    for (int i = 0; i < csv.getColumnCount(); i++) {
-        row.push_back("");  // Add an empty value for each column
+    if (deferWrite(csv, [=, &csv](std::ostream& out) {
+            insertQuery(csv, false, colNames, values, out);
+        }, os)) {
+        return;
     }
+    std::vector<CSVRow> rows(1, CSVRow(StrVec(csv.getColumnCount())));
     for (size_t i = 0; i < colNames.size(); i++) {
         auto colIdx = csv.getColumnIndex(colNames[i]);
-        row.at(colIdx) = values[i];
+        rows.front().at(colIdx) = values[i];
     }
-    csv.push_back(row);
+    appendRows(csv, std::move(rows));
     os << "1 row inserted." << std::endl;
 }
+
+size_t SQLAir::appendRows(CSV& csv, std::vector<CSVRow>&& rows) {
+    if (rows.empty()) {
+        return 0;
+    }
+    {
+        const auto table = writeLock(csv);
+        if (isCommitting(csv)) {
+            // The appended rows are removed to undo the write.
+            undoLog.push_back([&csv, oldSize = csv.size()] {
+                csv.erase(csv.begin() + oldSize, csv.end());
+            });
+        }
+        // Grow geometrically so that repeated single row inserts do not
+        // reallocate each time either.
+        const size_t newSize = csv.size() + rows.size();
+        if (newSize > csv.capacity()) {
+            const size_t oldCapacity = csv.capacity();
+            csv.reserve(std::max(newSize, csv.capacity() * 2));
+            csv.addMemory((csv.capacity() - oldCapacity) * sizeof(CSVRow));
+        }
+        for (int colIdx = 0; colIdx < csv.getColumnCount(); colIdx++) {
+            if (auto dict = csv.getDictionary(colIdx)) {
+                dict->rowCodes.reserve(newSize);
+            }
+        }
+        for (auto& row : rows) {
+            addToColumnIndexes(csv, csv.size(), row);
+            csv.addMemory(CSV::rowMemory(row));
+            csv.push_back(std::move(row));
+        }
+        markModified(csv);
+    }
+    // The CSV (which is pinned) has grown. So other CSVs may be evicted.
+    enforceMemoryBudget();
+    return rows.size();
+}
+
+void SQLAir::validateAndProcessInsert(const StrVec& sql, bool mustWait,
+                                      std::ostream& os) {
+    // Statements with just one row of values are handled by the base class.
+    const auto values = std::find(sql.begin(), sql.end(), "values");
+    const StrVec tokens = splitParens(values == sql.end() ? values :
+                                      values + 1, sql.end());
+    if (std::count(tokens.begin(), tokens.end(), "(") <= 1) {
+        SQLAirBase::validateAndProcessInsert(sql, mustWait, os);
+        return;
+    }
+    // The statement is "insert [into] <csv> (<cols>) values (...), (...)"
+    const auto first = sql.begin() + (sql.size() > 1 && sql[1] == "into" ?
+                                      2 : 1);
+    const StrVec header = splitParens(first, values);
+    if (header.size() < 4 || header[1] != "(" || header.back() != ")") {
+        throw Exp("Invalid insert statement. Use: insert into <csv> "
+                  "(<columns>) values (<values>), (<values>), ...");
+    }
+    const StrVec colNames(header.begin() + 2, header.end() - 1);
+    CSV& csv = loadAndGet(header.front());
+    checkColNames(csv, colNames, false, false);
+    std::vector<int> colIdx;
+    for (const auto& col : colNames) {
+        colIdx.push_back(csv.getColumnIndex(col));
+    }
+    // Build all the rows before adding any of them to the CSV.
+    std::vector<CSVRow> rows;
+    for (auto tok = tokens.begin(); tok != tokens.end(); tok++) {
+        const auto end = std::find(tok, tokens.end(), ")");
+        if (*tok != "(" || end == tokens.end() ||
+            end - tok - 1 != static_cast<long>(colIdx.size())) {
+            throw Exp("Invalid values for row " +
+                      std::to_string(rows.size() + 1) + " in insert. Specify "
+                      "one value for each column in parentheses.");
+        }
+        rows.emplace_back(StrVec(csv.getColumnCount()));
+        for (size_t i = 0; i < colIdx.size(); i++) {
+            rows.back().at(colIdx[i]) = *(tok + 1 + i);
+        }
+        tok = end;
+    }
+    auto batch = std::make_shared<std::vector<CSVRow>>(std::move(rows));
+    auto append = [this, &csv, batch](std::ostream& out) {
+        out << appendRows(csv, std::move(*batch)) << " row(s) inserted."
+            << std::endl;
+    };
+    if (!deferWrite(csv, append, os)) {
+        append(os);
+    }
+}
+
+void SQLAir::validateAndProcessCopy(const StrVec& sql, bool mustWait,
+                                    std::ostream& os) {
+    // The statement is "copy <csv> from <file|url>"
+    if (sql.size() != 4 || sql[2] != "from") {
+        throw Exp("Invalid copy statement. Use: copy <csv> from <file|url>");
+    }
+    // Load the new rows without any locks and outside the critical section.
+    CSV source;
+    if (sql[3].find("http://") == 0) {
+        std::string host, port, path;
+        std::tie(host, port, path) = Helper::breakDownURL(sql[3]);
+        loadFromURL(source, host, port, path);
+    } else {
+        std::ifstream data(sql[3]);
+        if (!data.good()) {
+            throw Exp("Unable to read " + sql[3]);
+        }
+        loadCSV(source, data);
+    }
+    CSV& csv = loadAndGet(sql[1]);
+    const StrVec srcCols = source.getColumnNames();
+    checkColNames(csv, srcCols, false, false);
+    std::vector<int> colIdx;
+    for (const auto& col : srcCols) {
+        colIdx.push_back(csv.getColumnIndex(col));
+    }
+    // Columns are matched by name. Columns not in the source are empty.
+    std::vector<CSVRow> rows;
+    rows.reserve(source.size());
+    for (auto& srcRow : source) {
+        rows.emplace_back(StrVec(csv.getColumnCount()));
+        for (size_t i = 0; i < colIdx.size(); i++) {
+            rows.back().at(colIdx[i]) = std::move(srcRow.at(i));
+        }
+    }
+    auto batch = std::make_shared<std::vector<CSVRow>>(std::move(rows));
+    auto append = [this, &csv, batch](std::ostream& out) {
+        out << appendRows(csv, std::move(*batch)) << " row(s) copied."
+            << std::endl;
+    };
+    if (!deferWrite(csv, append, os)) {
+        append(os);
+    }
+}
+
 void SQLAir::deleteQuery(CSV& csv, bool mustWait, const int whereColIdx,
                          const std::string& cond, const std::string& value,
                          std::ostream& os) {
+    if (deferWrite(csv, [=, &csv](std::ostream& out) {
+            deleteQuery(csv, false, whereColIdx, cond, value, out);
+        }, os)) {
+        return;
+    }
+    // Rows are moved and renumbered. So block all other queries on the CSV.
+    const auto table = writeLock(csv);
     int counts = 0;
     CSV newCSV;
-    for (auto& row : csv) {
+    newCSV.reserve(csv.size());
+    const WhereClause where = prepareWhere(csv, whereColIdx, cond, value);
+    // The deleted rows (with their indexes) are kept to undo the write
+    // only if it is being committed.
+    const bool undoable = isCommitting(csv);
+    std::vector<std::pair<size_t, CSVRow>> deleted;
+    for (size_t rowIdx = 0; rowIdx < csv.size(); rowIdx++) {
         // Determine if this row matches "where" clause condition, if any
         // see SQLAirBase::matches() helper method.
-        if (whereColIdx == -1 || !matches(row.at(whereColIdx), cond, value)) {
-            newCSV.push_back(row);
+        if (whereColIdx == -1 || !matchesRow(where, csv, rowIdx)) {
+            // Move (rather than copy) the cells of rows being retained
+            newCSV.push_back(std::move(csv[rowIdx]));
             counts++;
+        } else if (undoable) {
+            deleted.emplace_back(rowIdx, std::move(csv[rowIdx]));
         }
     }
     csv.swap(newCSV);
+    if (undoable) {
+        // The deleted rows are merged back in order of their indexes.
+        undoLog.push_back([&csv, deleted = std::move(deleted)]() mutable {
+            std::vector<CSVRow> rows;
+            rows.reserve(csv.size() + deleted.size());
+            size_t next = 0;  // The next retained row in the CSV
+            for (auto& [rowIdx, row] : deleted) {
+                while (rows.size() < rowIdx) {
+                    rows.push_back(std::move(csv[next++]));
+                }
+                rows.push_back(std::move(row));
+            }
+            while (next < csv.size()) {
+                rows.push_back(std::move(csv[next++]));
+            }
+            csv.std::vector<CSVRow>::swap(rows);
+        });
+    }
+    indexColumns(csv);  // Row numbers have changed
+    csv.measureMemory();
+    markModified(csv);
     os << counts << " row(s) Deleted." << std::endl;
 }
 
+/**
+ * Helper method to send an HTTP error response to a client.
+ *
+ * @param client The stream to which the response is to be written.
+ *
+ * @param status The HTTP status code and reason (e.g., "400 Bad Request").
+ *
+ * @param msg An optional message to be included in the body of the
+ * response. If it is empty, then the status is used as the body.
+ */
+void sendError(std::ostream& client, const std::string& status,
+               const std::string& msg = "") {
+    const std::string body = "Error: " + (msg.empty() ? status : msg) + "\n";
+    client << "HTTP/1.1 " << status << "\r\n"
+           << "Server: localhost\r\n"
+           << "Connection: Close\r\n"
+           << "Content-Type: text/plain\r\n"
+           << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+}
+
+/**
+ * Helper method to read the body of a request (i.e., a batch of
+ * statements). The body is read in chunks, so the memory used grows only
+ * with the data actually sent by the client.
+ *
+ * @param client The stream from which the body is to be read.
+ *
+ * @param length The length of the body (from the Content-Length header),
+ * which must not exceed MaxBodySize.
+ *
+ * @return The body of the request. Form data (i.e., "query=...") is
+ * URL-decoded.
+ */
+std::string readBody(std::istream& client, const size_t length) {
+    std::string body;
+    std::vector<char> chunk(BodyChunkSize);
+    while (body.size() < length) {
+        client.read(chunk.data(),
+                    std::min(BodyChunkSize, length - body.size()));
+        if (client.gcount() == 0) {
+            break;  // The client sent less than the stated length.
+        }
+        body.append(chunk.data(), client.gcount());
+    }
+    client.clear();  // A short body must not stop the response being sent
+    if (body.find("query=") == 0) {
+        body = Helper::url_decode(body.substr(6));  // Form data
+    }
+    return body;
+}
+
 void SQLAir::clientThread(TcpStreamPtr client) {
-    // Extract the SQL query from the first line for processing
-    std::string req;
-    *client >> req >> req;
+    // Extract the HTTP method and the request from the first line
+    std::string method, req;
+    *client >> method >> req;
     // Skip over all the HTTP request headers. Without this loop the
-    // web-server will not operate correctly with all the web-browsers
+    // web-server will not operate correctly with all the web-browsers.
+    // The length of the body (of POST requests) is noted.
+    // An empty status indicates the headers are valid.
+    size_t contentLength = 0;
+    std::string status;
     for (std::string hdr;
          (std::getline(*client, hdr) && !hdr.empty() && hdr != "\r");) {
+        if (CSV::toLower(hdr).find("content-length:") == 0) {
+            const std::string len = Helper::trim(hdr.substr(15));
+            if (len.empty() ||
+                len.find_first_not_of("0123456789") != std::string::npos) {
+                status = "400 Bad Request";
+            } else if (len.size() > 9 || std::stoul(len) > MaxBodySize) {
+                status = "413 Payload Too Large";
+            } else {
+                contentLength = std::stoul(len);
+            }
+        }
     }
     // URL-decode the request to translate special/encoded characters
     req = Helper::url_decode(req);
+    // Requests with a session token (which must precede the query, if any)
+    // continue that session. Otherwise, the request is its own session.
+    auto reqSession = std::make_shared<Session>();
+    const size_t tokPos = req.substr(0, req.find("query=")).find("session=");
+    if (tokPos != std::string::npos) {
+        const size_t tokEnd = std::min(req.find('&', tokPos), req.size());
+        reqSession = getSession(req.substr(tokPos + 8, tokEnd - tokPos - 8));
+        req.erase(tokPos, tokEnd + 1 - tokPos);  // Also removes the '&'
+    }
+    session = reqSession.get();
     // Check and do the necessary processing based on type of request
     const std::string prefix = "/sql-air?query=";
-    if (req.find(prefix) != 0) {
+    const std::string batchPrefix = "/sql-air/batch";
+    if (!status.empty()) {
+        sendError(*client, status);
+    } else if (method == "POST" && req.find(batchPrefix) == 0) {
+        // This is a batch of statements in the body of the request.
+        try {
+            const std::string batch = readBody(*client, contentLength);
+            std::ostringstream os;
+            processBatch(batch, req.find("parallel=1") != std::string::npos,
+                         os);
+            const std::string resp = os.str();
+            *client << HTTPRespHeader << resp.size() << "\r\n\r\n" << resp;
+        } catch (const std::exception& exp) {
+            sendError(*client, "500 Internal Server Error", exp.what());
+        }
+    } else if (req.find(prefix) != 0) {
         // This is request for a data file. So send the data file out.
         *client << http::file("./" + req);
     } else {
@@ -226,12 +1893,272 @@ void SQLAir::clientThread(TcpStreamPtr client) {
         // Send response back to the client.
         *client << HTTPRespHeader << resp.size() << "\r\n\r\n" << resp;
     }
+    // A request without a session token is its own session, which ends
+    // here. So a transaction left open by it is rolled back.
+    session = nullptr;
     numThreads.fetch_sub(1, std::memory_order_relaxed);
     thrCond.notify_one();
 }
+
+StrVec SQLAir::splitParens(StrVec::const_iterator first,
+                           StrVec::const_iterator last) {
+    // Consecutive special characters (e.g., "((" or "=(") are a single
+    // token. Split the parentheses from them for parsing.
+    StrVec tokens;
+    for (; first != last; first++) {
+        if (first->size() > 1 &&
+            first->find_first_not_of("<>=!()") == std::string::npos) {
+            std::string run;  // Characters (e.g., "<>") between parentheses
+            for (const char chr : *first) {
+                if (chr != '(' && chr != ')') {
+                    run += chr;
+                    continue;
+                }
+                if (!run.empty()) {
+                    tokens.push_back(run);
+                    run.clear();
+                }
+                tokens.push_back(std::string(1, chr));
+            }
+            if (!run.empty()) {
+                tokens.push_back(run);
+            }
+        } else {
+            tokens.push_back(*first);
+        }
+    }
+    return tokens;
+}
+
+std::tuple<StrVec, bool, int> SQLAir::preprocess(const std::string& sql)
+    const {
+    // Trim blank spaces and then any trailing semicolons.
+    const char* const blanks = " \t\n\v\f\r";
+    std::string_view query(sql);
+    query.remove_prefix(std::min(query.find_first_not_of(blanks),
+                                 query.size()));
+    query = query.substr(0, query.find_last_not_of(blanks) + 1);
+    query = query.substr(0, query.find_last_not_of(';') + 1);
+    // Count the tokens so that the vector is allocated just once.
+    Token tok;
+    size_t count = 0;
+    for (Lexer counter(query); counter.next(tok);) {
+        count++;
+    }
+    StrVec tokens;
+    tokens.reserve(count);
+    bool mustWait = false;
+    int cmd = -1;
+    static constexpr std::string_view Commands[] = {"exit", "select",
+        "update", "insert", "delete", "use", "save"};
+    for (Lexer lexer(query); lexer.next(tok);) {
+        if (tokens.empty() && !mustWait && tok.is("wait")) {
+            mustWait = true;  // The "wait" clause is not a token
+            continue;
+        }
+        if (tokens.empty()) {
+            const auto match = std::find_if(std::begin(Commands),
+                std::end(Commands), [&tok](auto kw) { return tok.is(kw); });
+            cmd = (match != std::end(Commands) ?
+                   match - std::begin(Commands) : -1);
+        }
+        tokens.push_back(tok.str());
+    }
+    return {std::move(tokens), mustWait, cmd};
+}
+
+/**
+ * Helper method to split CSV data into rows and values via the Lexer.
+ *
+ * @param csv The CSV into which the rows are to be loaded.
+ *
+ * @param data The CSV data, with a header line of column names.
+ *
+ * @return This method returns false if the data is unusual (e.g., has
+ * duplicate column names, a stray CR, or rows with a different number of
+ * values than the header). In this case, the CSV may have some rows.
+ */
+bool loadRows(CSV& csv, std::string_view data) {
+    // Only CRs at the end of lines (i.e., CR-LF) are handled.
+    for (size_t cr = data.find('\r'); cr != std::string_view::npos;
+         cr = data.find('\r', cr + 1)) {
+        if (cr + 1 == data.size() || data[cr + 1] != '\n') {
+            return false;
+        }
+    }
+    Lexer lexer(data, false, "", true);
+    StrVec colNames;
+    for (Token tok; lexer.next(tok);) {
+        colNames.push_back(CSV::toLower(tok.str(false)));
+        if (std::count(colNames.begin(), colNames.end(), colNames.back()) > 1) {
+            return false;
+        }
+    }
+    csv.reserve(std::count(data.begin(), data.end(), '\n') + 1);
+    while (lexer.nextRow()) {
+        CSVRow row;
+        row.reserve(colNames.size());
+        for (Token tok; lexer.next(tok);) {
+            if (row.size() == colNames.size()) {
+                return false;
+            }
+            row.push_back(tok.str(false));
+        }
+        if (row.size() != colNames.size()) {
+            return false;
+        }
+        csv.push_back(std::move(row));
+    }
+    csv.setColumnNames(colNames);
+    return true;
+}
+
+void SQLAir::loadCSV(CSV& csv, std::istream& is) {
+    if (!is.good()) {
+        csv.load(is);  // Reports errors as usual
+        return;
+    }
+    std::ostringstream buffer;
+    buffer << is.rdbuf();
+    const std::string data = buffer.str();
+    if (data.empty() || !loadRows(csv, data)) {
+        csv.clear();
+        std::istringstream unusual(data);
+        csv.load(unusual);
+    }
+}
+
+StrVec SQLAir::splitStatements(const std::string& batch) {
+    StrVec statements;
+    std::string sql;
+    char quote = '\0';  // The quote character of the current quoted value
+    for (const char chr : batch) {
+        if (quote == '\0' && (chr == ';' || chr == '\n')) {
+            statements.push_back(Helper::trim(sql, "\r"));
+            sql.clear();
+            continue;
+        }
+        if (chr == '\'' || chr == '"') {
+            quote = (quote == '\0' ? chr : (quote == chr ? '\0' : quote));
+        }
+        sql += chr;
+    }
+    statements.push_back(Helper::trim(sql, "\r"));
+    // Remove the blank statements (e.g., from blank lines)
+    statements.erase(std::remove(statements.begin(), statements.end(), ""),
+                     statements.end());
+    return statements;
+}
+
+std::string SQLAir::getCSVName(const std::string& sql) const {
+    try {
+        StrVec tokens;
+        bool mustWait;
+        int cmd;
+        std::tie(tokens, mustWait, cmd) = preprocess(sql);
+        std::string name;
+        switch (cmd) {
+            case 1:
+            case 4: name = Helper::getCSVInfo(tokens, "from"); break;
+            case 2: name = Helper::getCSVInfo(tokens, "update"); break;
+            case 3: name = Helper::getCSVInfo(tokens, "into"); break;
+        }
+        // Different spellings of a path (e.g., "./test.csv" and
+        // "test.csv") name the same file and must be in the same group.
+        if (!name.empty() && name.find("http://") != 0) {
+            name = std::filesystem::path(name).lexically_normal().string();
+        }
+        return name;
+    } catch (const std::exception&) {
+        // Invalid statements are not independent. The error is reported
+        // when the statement is processed.
+    }
+    return "";
+}
+
+void SQLAir::processBatch(const std::string& batch, const bool parallel,
+                          std::ostream& os) {
+    const StrVec statements = splitStatements(batch);
+    StrVec results(statements.size());
+    // Flags are chars (rather than bools) so threads can set them safely.
+    std::vector<char> failed(statements.size(), false);
+    // Lambda to process a statement, recording its results.
+    auto run = [&](const size_t idx) {
+        std::ostringstream out;
+        try {
+            process(statements[idx], out);
+        } catch (const std::exception& exp) {
+            out << "Error: " << exp.what() << std::endl;
+            failed[idx] = true;
+        }
+        results[idx] = out.str();
+    };
+    // Statements on different CSVs are independent. Statements that do not
+    // explicitly name their CSV (e.g., "use" or "save") are not.
+    std::unordered_map<std::string, std::vector<size_t>> groups;
+    // A transaction in progress must be updated by one thread at a time.
+    bool independent = parallel && !currentSession().inTransaction;
+    for (size_t idx = 0; (idx < statements.size() && independent); idx++) {
+        const std::string csvName = getCSVName(statements[idx]);
+        independent = !csvName.empty();
+        groups[csvName].push_back(idx);
+    }
+    if (independent && groups.size() > 1) {
+        // The statements on each CSV are run in order by one thread, with
+        // the groups of statements run concurrently by a few threads.
+        std::vector<std::vector<size_t>> work;
+        for (auto& group : groups) {
+            work.push_back(std::move(group.second));
+        }
+        std::atomic<size_t> next = {0};
+        auto runGroups = [&] {
+            for (size_t grp = next++; grp < work.size(); grp = next++) {
+                std::for_each(work[grp].begin(), work[grp].end(), run);
+            }
+        };
+        // The helper threads count against the limit on the number of
+        // threads (see runServer). If no threads are available, then the
+        // groups are just run by this thread.
+        int numHelpers = std::min<size_t>(work.size(),
+            std::max(1u, std::thread::hardware_concurrency())) - 1;
+        {
+            std::scoped_lock<std::mutex> lock(thrMutex);
+            numHelpers = std::max(0, std::min(numHelpers,
+                                              maxThreads - numThreads));
+            numThreads.fetch_add(numHelpers, std::memory_order_relaxed);
+        }
+        std::vector<std::thread> helpers;
+        Session* const batchSession = session;
+        for (int thr = 0; thr < numHelpers; thr++) {
+            helpers.emplace_back([&] {
+                session = batchSession;  // Statements run in this session
+                runGroups();
+                numThreads.fetch_sub(1, std::memory_order_relaxed);
+                thrCond.notify_one();
+            });
+        }
+        runGroups();
+        std::for_each(helpers.begin(), helpers.end(),
+                      [](auto& thr) { thr.join(); });
+    } else {
+        for (size_t idx = 0; idx < statements.size(); idx++) {
+            run(idx);
+        }
+    }
+    // Frame the results of each statement with a header line.
+    for (size_t idx = 0; idx < statements.size(); idx++) {
+        os << "--- " << (idx + 1) << (failed[idx] ? " error " : " ok ")
+           << results[idx].size() << '\n' << results[idx];
+    }
+}
+
 // The method to have this class run as a web-server.
 void SQLAir::runServer(boost::asio::ip::tcp::acceptor& server,
                        const int maxThr) {
+    {
+        std::scoped_lock<std::mutex> lock(thrMutex);
+        maxThreads = maxThr;  // Also limits the threads used by batches
+    }
     for (bool done = false; !done;) {
         // Creates garbage-collected connection on heap
         TcpStreamPtr client = std::make_shared<tcp::iostream>();
@@ -273,6 +2200,14 @@ void checkQuery(boost::asio::ip::tcp::iostream& data, const std::string& host,
          std::getline(data, hdr) && !hdr.empty() && hdr != "\r";) {
     }
 }
+void SQLAir::loadFromURL(CSV& csv, const std::string& hostName,
+                         const std::string& port, const std::string& path) {
+    boost::asio::ip::tcp::iostream is;
+    setupDownload(hostName, path, is);
+    checkQuery(is, hostName, path, port);
+    loadCSV(csv, is);
+}
+
 /** Convenience method to decode HTML/URL encoded strings.
  *
  * This method must be used to decode query string parameters supplied
@@ -289,53 +2224,447 @@ void checkQuery(boost::asio::ip::tcp::iostream& data, const std::string& host,
 CSV& SQLAir::loadAndGet(std::string fileOrURL) {
     // Check if the specified fileOrURL is already loaded in a thread-safe
     // manner to avoid race conditions on the unordered_map
+    bool spilled = false;
+    if (fileOrURL.empty() || usingCSV) {
+        // Only queries that do not name their CSV and "use" statements
+        // access the recent CSV. So other queries do not lock the session.
+        Session& current = currentSession();
+        std::scoped_lock<std::mutex> guard(current.recentMutex);
+        if (fileOrURL.empty()) {
+            fileOrURL = current.recentCSV;
+        } else {
+            current.recentCSV = fileOrURL;
+        }
+    }
+    {
+        // Look up CSVs that are already in memory (which is the common
+        // case) without locking catalogMutex or the session. The thread's
+        // snapshot of the catalog is refreshed only if the catalog changed.
+        const Catalog& catalog = getCatalog();
+        const auto entry = catalog.find(fileOrURL);
+        if (entry != catalog.end()) {
+            // The CSV is pinned before checking if it is being evicted.
+            CachedCSV& cached = *entry->second;
+            cached.pins++;
+            if (!cached.excluded) {
+                cached.lastUse.store(now(), std::memory_order_relaxed);
+                return pin(entry->second);
+            }
+            // The CSV may be being evicted. Look it up again below.
+            cached.pins--;
+        }
+    }
     {
-        std::scoped_lock<std::mutex> guard(recentCSVMutex);
-        // Use recent CSV if parameter was empty string.
-        fileOrURL = (fileOrURL.empty() ? recentCSV : fileOrURL);
-        // Update the most recently used CSV for the next round
-        recentCSV = fileOrURL;
-        if (inMemoryCSV.find(fileOrURL) != inMemoryCSV.end()) {
+        std::scoped_lock<std::mutex> guard(catalogMutex);
+        const auto entry = inMemoryCSV->find(fileOrURL);
+        if (entry != inMemoryCSV->end()) {
             // Requested CSV is already in memory. Just return it.
-            return inMemoryCSV.at(fileOrURL);
+            entry->second->pins++;
+            entry->second->lastUse = now();
+            return pin(entry->second);
         }
+        // Evicted CSVs with unsaved changes are reloaded from spill file
+        spilled = (spilledCSV.find(fileOrURL) != spilledCSV.end());
     }
     // When control drops here, we need to load the CSV into memory.
     // Loading or I/O is being done outside critical sections
-    CSV csv;  // Load data into this csv
-    if (fileOrURL.find("http://") == 0) {
+    auto csv = std::make_shared<CSV>();  // Load data into this csv
+    if (spilled) {
+        // The spill file is loaded below while holding the lock.
+    } else if (fileOrURL.find("http://") == 0) {
         // This is an URL. We have to get the stream from a web-server
-        // Implement this feature.
         std::string host, port, path;
         std::tie(host, port, path) = Helper::breakDownURL(fileOrURL);
-        boost::asio::ip::tcp::iostream is;
-        setupDownload(host, path, is);
-        checkQuery(is, host, path, port);
-        csv.load(is);
-        // throw Exp("Loading CSV from ULR not implemented.");
+        loadFromURL(*csv, host, port, path);
     } else {
         // We assume it is a local file on the server. Load that file.
         std::ifstream data(fileOrURL);
         // This method may throw exceptions on errors.
-        csv.load(data);
+        loadCSV(*csv, data);
     }
+    indexColumns(*csv);
+    createIndexes(fileOrURL, *csv);
+    csv->measureMemory();
     // We get to this line of code only if the above if-else to load the
     // CSV did not throw any exceptions. In this case we have a valid CSV
     // to add to our inMemoryCSV list. We need to do that in a thread-safe
     // manner.
-    std::scoped_lock<std::mutex> guard(recentCSVMutex);
-    // Move (instead of copy) the CSV data into our in-memory CSVs
-    inMemoryCSV[fileOrURL].move(csv);
+    std::vector<std::shared_ptr<CSV>> evicted;  // Freed after unlocking
+    SpillList spills;
+    CSV* result = nullptr;
+    {
+        std::scoped_lock<std::mutex> guard(catalogMutex);
+        auto entry = inMemoryCSV->find(fileOrURL);
+        if (entry == inMemoryCSV->end()) {
+            const auto spilled = spilledCSV.find(fileOrURL);
+            if (spilled != spilledCSV.end() && spilled->second.csv) {
+                // The CSV was evicted with unsaved changes that have not
+                // been written to the spill file yet. Just put it back.
+                csv = std::move(spilled->second.csv);
+                spilledCSV.erase(spilled);
+            } else if (spilled != spilledCSV.end()) {
+                // The CSV was evicted with unsaved changes. Reload the
+                // changes from the spill file while holding the lock so
+                // that the changes are reloaded exactly once.
+                std::ifstream data(spilled->second.path);
+                csv = std::make_shared<CSV>();
+                loadCSV(*csv, data);
+                indexColumns(*csv);
+                createIndexes(fileOrURL, *csv, false);
+                csv->measureMemory();
+                csv->dirty = true;
+                std::filesystem::remove(spilled->second.path);
+                spilledCSV.erase(spilled);
+            }
+            auto cached = std::make_shared<CachedCSV>();
+            cached->csv = csv;
+            auto catalog = std::make_shared<Catalog>(*inMemoryCSV);
+            entry = catalog->emplace(fileOrURL, std::move(cached)).first;
+            publishCatalog(std::move(catalog));
+        }
+        // Otherwise another thread loaded this CSV while we were loading it.
+        entry->second->pins++;
+        entry->second->lastUse = now();
+        result = &pin(entry->second);
+        evictIfNeeded(evicted, spills);
+    }
+    // Writing spill files is done outside critical sections.
+    for (const auto& [spillFileOrURL, spilled] : spills) {
+        spill(spillFileOrURL, spilled);
+    }
     // Return a reference to the in-memory CSV (not temporary one)
-    return inMemoryCSV.at(fileOrURL);
+    return *result;
+}
+
+CSV& SQLAir::pin(const std::shared_ptr<CachedCSV>& entry) {
+    // The pin is released when the last copy of the pointer is released.
+    pinnedCSV.emplace_back(entry->csv.get(),
+                           [entry](CSV*) { entry->pins--; });
+    // The version is noted before the rows are read. So a write by
+    // another query after this point fails the validation at commit.
+    Session& current = currentSession();
+    if (!current.inTransaction) {
+        return *entry->csv;
+    }
+    std::scoped_lock<std::mutex> guard(current.transactionMutex);
+    if (const auto& txn = current.transaction) {
+        auto& readSet = txn->readSet;
+        if (std::find_if(readSet.begin(), readSet.end(), [&](const auto& used) {
+                return used.first == pinnedCSV.back(); }) == readSet.end()) {
+            readSet.emplace_back(pinnedCSV.back(), entry->csv->version);
+        }
+    }
+    return *entry->csv;
+}
+
+const SQLAir::Catalog& SQLAir::getCatalog() const {
+    // The snapshot of the current version, cached by each thread. This
+    // avoids contention on the reference count of the shared snapshot.
+    thread_local std::pair<size_t, std::shared_ptr<const Catalog>> cached;
+    const size_t version = catalogVersion.load(std::memory_order_acquire);
+    if (cached.first != version) {
+        cached = {version, std::atomic_load(&inMemoryCSV)};
+    }
+    return *cached.second;
+}
+
+void SQLAir::publishCatalog(std::shared_ptr<const Catalog> catalog) {
+    std::atomic_store(&inMemoryCSV, std::move(catalog));
+    catalogVersion.store(++lastCatalogVersion, std::memory_order_release);
+}
+
+bool SQLAir::exclude(CachedCSV& entry) {
+    // Queries increment pins before checking excluded. So either the query
+    // sees the flag or its pin is seen here.
+    entry.excluded = true;
+    if (entry.pins == 0) {
+        return true;
+    }
+    entry.excluded = false;
+    return false;
+}
+
+std::shared_ptr<Session> SQLAir::getSession(const std::string& token) {
+    // Sessions that are idle for longer than maxIdle are removed. The
+    // transactions of sessions idle for longer than maxTxnIdle are rolled
+    // back, so that abandoned transactions do not keep CSVs pinned.
+    const auto maxIdle = std::chrono::minutes(30);
+    const auto maxTxnIdle = std::chrono::minutes(5);
+    const auto now = std::chrono::steady_clock::now();
+    std::scoped_lock<std::mutex> guard(sessionsMutex);
+    auto& entry = sessions[token];
+    if (!entry || now - lastSessionCheck > std::chrono::minutes(1)) {
+        lastSessionCheck = now;
+        for (auto iter = sessions.begin(); iter != sessions.end();) {
+            // Sessions in use by a request (which holds a reference to the
+            // session) are not idle.
+            Session* other = (iter->second.use_count() == 1 ?
+                              iter->second.get() : nullptr);
+            if (other != nullptr && now - other->lastUse > maxIdle &&
+                &iter->second != &entry) {
+                iter = sessions.erase(iter);
+                continue;
+            }
+            if (other != nullptr && now - other->lastUse > maxTxnIdle &&
+                other->inTransaction) {
+                std::scoped_lock<std::mutex> txnGuard(other->transactionMutex);
+                other->transaction.reset();
+                other->inTransaction = false;
+            }
+            iter++;
+        }
+    }
+    if (!entry) {
+        entry = std::make_shared<Session>();
+    }
+    entry->lastUse = now;
+    return entry;
+}
+
+void SQLAir::validateAndProcessTransaction(const StrVec& sql,
+                                           std::ostream& os) {
+    if (sql.size() > 2 || (sql.size() == 2 && sql[1] != "transaction")) {
+        throw Exp("Invalid " + sql[0] + " statement. Use: " + sql[0] +
+                  " [transaction]");
+    }
+    Session& current = currentSession();
+    std::unique_lock<std::mutex> guard(current.transactionMutex);
+    if (sql[0] == "begin") {
+        if (current.transaction) {
+            throw Exp("A transaction is already in progress");
+        }
+        current.transaction = std::make_unique<Transaction>();
+        current.inTransaction = true;
+        os << "Transaction started." << std::endl;
+        return;
+    }
+    // Ending the transaction here ensures writes are applied directly below
+    // (and that concurrent requests in the session apply their writes
+    // directly too). The commit itself does not need the lock.
+    const auto txn = std::move(current.transaction);
+    current.inTransaction = false;
+    guard.unlock();
+    if (!txn) {
+        throw Exp("No transaction in progress");
+    }
+    if (sql[0] == "rollback") {
+        os << "Transaction rolled back." << std::endl;
+        return;
+    }
+    // Lock all the CSVs (in a fixed order to avoid deadlocks between
+    // commits) so that other queries observe all or none of the writes.
+    // The CSVs that are only read are locked in shared mode.
+    auto used = txn->readSet;
+    std::sort(used.begin(), used.end());
+    std::vector<std::unique_lock<std::shared_mutex>> writeLocks;
+    std::vector<std::shared_lock<std::shared_mutex>> readLocks;
+    for (const auto& [csv, version] : used) {
+        if (std::find(txn->writeSet.begin(), txn->writeSet.end(),
+                      csv.get()) != txn->writeSet.end()) {
+            writeLocks.emplace_back(csv->tableMutex);
+        } else {
+            readLocks.emplace_back(csv->tableMutex);
+        }
+    }
+    for (const auto& [csv, version] : used) {
+        if (csv->version != version) {
+            throw Exp("Transaction aborted as the data it used was "
+                      "modified by another query. Transaction rolled back.");
+        }
+    }
+    // The writes are applied directly (rather than deferred again) and
+    // record how to undo them. They do not change the versions of the CSVs.
+    committingCSV.assign(txn->writeSet.begin(), txn->writeSet.end());
+    struct Done {
+        ~Done() {
+            committingCSV.clear();
+            undoLog.clear();
+        }
+    } done;
+    try {
+        for (const auto& write : txn->writes) {
+            write(os);
+        }
+    } catch (const std::exception& exp) {
+        // Undo the writes (in reverse order) and rebuild the auxiliary
+        // data of each CSV. The versions and dirty flags are unchanged.
+        for (auto undo = undoLog.rbegin(); undo != undoLog.rend(); undo++) {
+            (*undo)();
+        }
+        for (CSV* csv : txn->writeSet) {
+            indexColumns(*csv);
+            csv->measureMemory();
+        }
+        throw Exp(std::string(exp.what()) + ". Transaction rolled back.");
+    }
+    committingCSV.clear();  // So that the CSVs are marked as modified
+    for (CSV* csv : txn->writeSet) {
+        markModified(*csv);
+    }
+    os << "Transaction committed." << std::endl;
+}
+
+bool SQLAir::deferWrite(CSV& csv, std::function<void(std::ostream&)> write,
+                        std::ostream& os) {
+    // The writes being committed are applied, even if the session has
+    // started another transaction since.
+    Session& current = currentSession();
+    if (!current.inTransaction || isCommitting(csv)) {
+        return false;
+    }
+    std::scoped_lock<std::mutex> guard(current.transactionMutex);
+    const auto& transaction = current.transaction;
+    if (!transaction) {
+        return false;
+    }
+    // The CSV is in the read set (and kept in memory) as it was pinned
+    // by the current query. See pin().
+    if (std::find(transaction->writeSet.begin(), transaction->writeSet.end(),
+                  &csv) == transaction->writeSet.end()) {
+        transaction->writeSet.push_back(&csv);
+    }
+    transaction->writes.push_back(std::move(write));
+    os << "Deferred until commit." << std::endl;
+    return true;
+}
+
+bool SQLAir::isCommitting(const CSV& csv) {
+    return std::find(committingCSV.begin(), committingCSV.end(), &csv) !=
+        committingCSV.end();
+}
+
+void SQLAir::markModified(CSV& csv) {
+    if (!isCommitting(csv)) {
+        csv.markModified();
+    }
+}
+
+void SQLAir::logUndo(CSV& csv, const std::vector<size_t>& rows,
+                     const int colIdx) {
+    if (!isCommitting(csv) || rows.empty()) {
+        return;
+    }
+    StrVec oldValues;
+    oldValues.reserve(rows.size());
+    for (const size_t rowIdx : rows) {
+        oldValues.push_back(csv[rowIdx][colIdx]);
+    }
+    undoLog.push_back([&csv, rows, colIdx,
+                       oldValues = std::move(oldValues)]() mutable {
+        for (size_t i = 0; i < rows.size(); i++) {
+            csv[rows[i]][colIdx] = std::move(oldValues[i]);
+        }
+    });
+}
+
+std::shared_lock<std::shared_mutex> SQLAir::readLock(CSV& csv) {
+    if (isCommitting(csv)) {
+        return std::shared_lock<std::shared_mutex>(csv.tableMutex,
+                                                   std::defer_lock);
+    }
+    return std::shared_lock<std::shared_mutex>(csv.tableMutex);
+}
+
+std::unique_lock<std::shared_mutex> SQLAir::writeLock(CSV& csv) {
+    if (isCommitting(csv)) {
+        return std::unique_lock<std::shared_mutex>(csv.tableMutex,
+                                                   std::defer_lock);
+    }
+    return std::unique_lock<std::shared_mutex>(csv.tableMutex);
+}
+
+void SQLAir::evictIfNeeded(std::vector<std::shared_ptr<CSV>>& evicted,
+                           SpillList& spills) {
+    if (memoryBudget == 0) {
+        return;  // Unlimited memory budget
+    }
+    // The memory estimates are maintained as the CSVs are changed. So they
+    // are just added up here (rather than scanning the rows).
+    size_t totalBytes = 0;
+    for (const auto& entry : *inMemoryCSV) {
+        totalBytes += entry.second->csv->getMemoryEstimate();
+    }
+    if (totalBytes <= memoryBudget) {
+        return;
+    }
+    // The CSVs are considered in least recently used order.
+    std::vector<std::pair<std::chrono::steady_clock::rep, std::string>> lru;
+    for (const auto& entry : *inMemoryCSV) {
+        lru.emplace_back(entry.second->lastUse, entry.first);
+    }
+    std::sort(lru.begin(), lru.end());
+    std::shared_ptr<Catalog> catalog;  // Copied when first CSV is evicted
+    for (size_t i = 0; (i < lru.size() && totalBytes > memoryBudget); i++) {
+        // CSVs pinned by a query cannot be evicted.
+        CachedCSV& victim = *inMemoryCSV->at(lru[i].second);
+        if (!exclude(victim)) {
+            continue;
+        }
+        if (victim.csv->dirty) {
+            // The unsaved changes are written by spill(), without holding
+            // catalogMutex. The spill file is unique to this process.
+            SpilledCSV& spilled = spilledCSV[lru[i].second];
+            spilled.path = (std::filesystem::temp_directory_path() /
+                            ("sqlair_spill_" + std::to_string(::getpid()) +
+                             "_" + std::to_string(++numSpillFiles) +
+                             ".csv")).string();
+            spilled.csv = victim.csv;
+            spills.emplace_back(lru[i].second, spilled);
+        }
+        // Queries that look up the victim in an older snapshot find it
+        // excluded. So its CSV is not used after it is moved here.
+        totalBytes -= victim.csv->getMemoryEstimate();
+        evicted.push_back(std::move(victim.csv));
+        if (!catalog) {
+            catalog = std::make_shared<Catalog>(*inMemoryCSV);
+        }
+        catalog->erase(lru[i].second);
+    }
+    if (catalog) {
+        publishCatalog(std::move(catalog));
+    }
+}
+
+void SQLAir::spill(const std::string& fileOrURL, const SpilledCSV& spilled) {
+    bool saved = false;
+    {
+        // The CSV may be put back in memory and modified in the meantime.
+        const auto table = readLock(*spilled.csv);
+        std::ofstream data(spilled.path);
+        spilled.csv->save(data);
+        saved = data.good();
+    }
+    std::shared_ptr<CSV> written;  // Freed after unlocking
+    std::scoped_lock<std::mutex> guard(catalogMutex);
+    const auto entry = spilledCSV.find(fileOrURL);
+    if (entry == spilledCSV.end() || entry->second.csv != spilled.csv) {
+        // The CSV was put back in memory. So the file is not needed.
+        std::filesystem::remove(spilled.path);
+    } else if (saved) {
+        written = std::move(entry->second.csv);
+    } else {
+        // The CSV is kept (in spilledCSV) until it is used again.
+        std::filesystem::remove(spilled.path);
+    }
 }
+
 // Save the currently loaded CSV file to a local file.
 void SQLAir::saveQuery(std::ostream& os) {
-    if (recentCSV.empty() || recentCSV.find("http://") == 0) {
+    std::string fileName;
+    {
+        Session& current = currentSession();
+        std::scoped_lock<std::mutex> guard(current.recentMutex);
+        fileName = current.recentCSV;
+    }
+    if (fileName.empty() || fileName.find("http://") == 0) {
         throw Exp("Saving CSV to an URL using POST is not implemented");
     }
+    // The CSV may have been evicted. So (re)load it if needed.
+    CSV& csv = loadAndGet(fileName);
     // Create a local file and have the CSV write itself.
-    std::ofstream csvData(recentCSV);
-    inMemoryCSV.at(recentCSV).save(csvData);
-    os << recentCSV << " saved.\n";
+    std::ofstream csvData(fileName);
+    const auto table = readLock(csv);
+    csv.save(csvData);
+    csv.dirty = false;
+    os << fileName << " saved.\n";
 }
@@ -9,21 +9,167 @@
  * Copyright (C) 2021 raodm@miamioh.edu
  */
 
+#include <algorithm>
 #include <atomic>
 #include <boost/asio.hpp>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <shared_mutex>
 #include <string>
 #include <thread>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "Expr.h"
+#include "Lexer.h"
+#include "Matcher.h"
 #include "SQLAirBase.h"
 
 // Shortcut to smart pointer with TcpStream
 using TcpStreamPtr = std::shared_ptr<boost::asio::ip::tcp::iostream>;
 
+/**
+ * A 'where' clause that has been prepared for evaluation over the rows of a
+ * given CSV. Preparing the clause once per query enables conditions on
+ * dictionary encoded columns to be evaluated once per distinct value rather
+ * than once per row.
+ */
+struct WhereClause {
+    /** The index of the column in the where clause or -1 if none. */
+    int colIdx = -1;
+    /** The condition to be checked. E.g., "=", "<>", "like", or "ilike" */
+    std::string cond;
+    /** The value specified by the user in the where clause. */
+    std::string value;
+    /** The compiled matcher for "ilike" and "regexp" conditions. */
+    MatcherPtr matcher;
+    /** The dictionary for the column (if any) in the where clause. */
+    const ColumnDictionary* dict = nullptr;
+    /** Flags indicating if the value for each code meets the condition. */
+    std::vector<bool> codeMatches;
+    /** Flags indicating if each block of rows (see ZoneMap::BlockSize) may
+     * have rows that meet the condition, based on the zone map and Bloom
+     * filters of the column. Empty if blocks cannot be skipped. */
+    std::vector<bool> blockMayMatch;
+    /** The rows that may meet the condition, obtained from a bitmap index.
+     * If null, then all rows (in blocks that may match) are checked. */
+    std::shared_ptr<const RowBitmap> rows;
+    /** The values in the list of an "in" condition. */
+    std::unordered_set<std::string> inValues;
+};
+
+/**
+ * A compound 'where' clause (e.g., "where country = 'Canada' and dst = A")
+ * parsed into a tree. Each leaf is a single condition and each inner node
+ * combines the rows that meet its two sub-expressions.
+ */
+struct WhereExpr {
+    /** Either "and" or "or" for an inner node. Empty for a leaf. */
+    std::string op;
+    /** The index of the column in the condition (leaf nodes only). */
+    int colIdx = -1;
+    /** The condition to be checked. E.g., "=", "<>", "like", "in", "match"
+     * (for "match(col, 'terms')"), "within_radius", or "nearest" */
+    std::string cond;
+    /** The value specified by the user in the condition. An "in" condition
+     * has the list of values, a "match" condition has the terms, and the
+     * spatial conditions have their arguments. */
+    StrVec values;
+    /** The two sub-expressions combined by an inner node. */
+    std::unique_ptr<WhereExpr> lhs, rhs;
+};
+
+/**
+ * The optional "order by" and "limit" clauses of a select statement, e.g.,
+ * "select title, score from movies.csv where match(title, 'war') order by
+ * score limit 10". Rows are ordered either by decreasing score, which is
+ * their BM25 score for the full-text ("match") conditions in the where
+ * clause (see TextIndex), or by increasing distance, which is their
+ * distance in km from the point in the spatial ("within_radius" and
+ * "nearest") conditions (see SpatialIndex).
+ */
+struct RankClause {
+    /** Either "score" or "distance". Empty to keep the order of the rows. */
+    std::string orderBy;
+    /** The maximum number of rows to be printed. */
+    size_t limit = std::numeric_limits<size_t>::max();
+};
+
+/**
+ * The columns of a select or update statement resolved against a given CSV
+ * once per statement. The rows are then processed using just the column
+ * indexes without looking-up column names for each row.
+ */
+struct ColumnPlan {
+    /** The names of the columns, with a "*" expanded to all the columns.
+     * These are the header for the rows printed by a select. */
+    StrVec colNames;
+    /** The index of each column in the rows of the CSV. */
+    std::vector<int> colIdx;
+    /** The value to be set in each column (updates only). */
+    StrVec values;
+    /** The expression for each column, if the statement has expressions.
+     * It is null for plain columns (and values). For a select, the colIdx
+     * of an expression is -1. See Expr. */
+    std::vector<ExprPtr> exprs;
+};
+
+/**
+ * The state of a transaction started by a "begin" statement. Transactions
+ * use optimistic concurrency control. The writes (updates, inserts, and
+ * deletes) in the transaction are validated when they are issued but are
+ * buffered and applied together, atomically, when the transaction is
+ * committed. Queries in the transaction read the committed data (and not
+ * the transaction's own buffered writes) without blocking other queries.
+ * The commit is aborted if any CSV used by the transaction has been
+ * modified by other queries since the transaction first used it.
+ */
+struct Transaction {
+    /** The CSVs read or modified by the transaction with their versions
+     * (see CSV::version) when the transaction first used them. The CSVs
+     * are pinned in memory until the transaction ends. */
+    std::vector<std::pair<std::shared_ptr<CSV>, size_t>> readSet;
+    /** The CSVs modified by the transaction. They are in readSet too. */
+    std::vector<CSV*> writeSet;
+    /** The buffered writes, in the order in which they were issued. Each
+     * one writes its results to the given stream when it is applied. */
+    std::vector<std::function<void(std::ostream&)>> writes;
+};
+
+/**
+ * The state of a client's session. Clients that supply a session token
+ * (e.g., "/sql-air?session=<token>&query=...") with their requests
+ * continue the same session across requests. Each request without a token
+ * is a session of its own, so that concurrent clients do not share state.
+ * The console uses the default session. The requests in a session may run
+ * concurrently.
+ */
+struct Session {
+    /** The CSV named by the most recent "use" statement. It is used by
+     * queries that do not name their CSV (e.g., "save"). */
+    std::string recentCSV;
+    /** Mutex for recentCSV, as the statements in a batch may be run
+     * concurrently. Queries that name their CSV do not lock it. */
+    std::mutex recentMutex;
+    /** The transaction (if any) in progress in this session. Guarded by
+     * transactionMutex. */
+    std::unique_ptr<Transaction> transaction;
+    /** Flag to check if a transaction is in progress without locking. */
+    std::atomic<bool> inTransaction = {false};
+    /** Mutex to update the transaction (and the transaction's state), as
+     * the requests in a session may run concurrently. */
+    std::mutex transactionMutex;
+    /** The time when this session was last used, to expire idle sessions.
+     * Guarded by sessionsMutex. */
+    std::chrono::steady_clock::time_point lastUse;
+};
+
 /**
  * The top-level class that facilitates processing SQL-like queries on CSV
  * files. The methods in this class override the default/dummy implementations
@@ -31,6 +177,105 @@ using TcpStreamPtr = std::shared_ptr<boost::asio::ip::tcp::iostream>;
  */
 class SQLAir : public SQLAirBase {
    public:
+    /**
+     * The default constructor. The memory budget for in-memory CSVs is
+     * initialized from the optional SQLAIR_MEMORY_BUDGET_MB environment
+     * variable. If the variable is not set (or is not a valid number of
+     * megabytes), the memory budget is unlimited. Dictionary encoding and
+     * Bloom filters are enabled by setting the optional
+     * SQLAIR_DICTIONARY_ENCODING and SQLAIR_BLOOM_FILTERS environment
+     * variables to 1.
+     */
+    SQLAir();
+
+    /**
+     * The destructor removes the spill files of the evicted CSVs with
+     * unsaved changes.
+     */
+    ~SQLAir();
+
+    /**
+     * Top-level method to process a SQL-air query. The statement is
+     * tokenized (by preprocess()) and processed by the validateAndProcess
+     * method for its command. Commands not supported by the base class
+     * (e.g., "create", "copy", and transactions) are handled here. Any CSVs
+     * that were pinned in memory (via loadAndGet) while processing the query
+     * are then released.
+     *
+     * @param sql The SQL-air query to be processed by this method.
+     *
+     * @param os The output stream to where results from the processing are
+     * to be written.
+     *
+     * @return This method returns true if further queries are to be processed.
+     * This method returns false if the command was "exit;"
+     */
+    bool process(const std::string& sql, std::ostream& os) override;
+
+    /**
+     * Process a batch of statements, separated by semicolons or newlines.
+     * This method is used to process a HTTP POST request to
+     * "/sql-air/batch", where the body of the request has the statements.
+     * The results of each statement are framed by a header line of the form
+     * "--- <statement number> <ok|error> <length of results>" followed by
+     * the results of the statement.
+     *
+     * @param batch The statements to be processed.
+     *
+     * @param parallel If this flag is true, then statements on different
+     * CSVs are processed concurrently. Statements on the same CSV are
+     * always processed in order. If any statement does not name its CSV
+     * then all statements are processed in order. The additional threads
+     * used count against the limit on the number of threads (see
+     * runServer). So statements may be processed in order by this thread
+     * if the server is busy.
+     *
+     * @param os The output stream to where the results are to be written.
+     */
+    void processBatch(const std::string& batch, const bool parallel,
+                      std::ostream& os);
+
+    /**
+     * Method to print the estimated memory used by each in-memory CSV. This
+     * method is called to process a "show memory" command.
+     *
+     * @param os The output stream to where the memory usage is to be written.
+     */
+    void showMemory(std::ostream& os);
+
+    /**
+     * Set the memory budget for the CSVs held in memory. When the estimated
+     * memory used by the in-memory CSVs exceeds this budget, the least
+     * recently used CSVs that are not being used by a query are evicted.
+     * Evicted CSVs are transparently reloaded on next access.
+     *
+     * @param bytes The memory budget in bytes. Zero disables eviction.
+     */
+    void setMemoryBudget(size_t bytes);
+
+    /**
+     * Enable or disable per-block Bloom filters on the columns that are not
+     * dictionary encoded. The filters enable scans with equality conditions
+     * (e.g., "where icao = 'AYGA'") to skip blocks of rows that cannot have
+     * the value, at the cost of about one byte of memory per cell.  This
+     * setting applies to CSVs that are loaded (or rebuilt) after this call.
+     *
+     * @param enable If this flag is true, then Bloom filters are built.
+     */
+    void setBloomFilters(bool enable);
+
+    /**
+     * Enable or disable dictionary encoding of the low-cardinality columns
+     * (see encodeColumns()). Encoding speeds-up filters on such columns
+     * (e.g., "where country = 'Canada'" on large CSVs) but adds about four
+     * bytes per cell to the memory used, as the cells are not changed. So
+     * it is disabled by default. This setting applies to CSVs that are
+     * loaded (or rebuilt) after this call.
+     *
+     * @param enable If this flag is true, then columns are encoded.
+     */
+    void setDictionaryEncoding(bool enable);
+
     /**
      * Method to perform the actual operations associated with printing a
      * given set of columns in a given CSV that match an optional condition.
@@ -76,6 +321,43 @@ class SQLAir : public SQLAirBase {
                      const int whereColIdx, const std::string& cond,
                      const std::string& value, std::ostream& os) override;
 
+    /**
+     * Method to print the given set of columns in rows of a CSV that meet
+     * a compound 'where' clause. The rows meeting each condition are
+     * gathered into a bitmap and the bitmaps are combined with AND/OR.
+     * Only the rows in the final bitmap are printed.
+     *
+     * @param csv The CSV data to be used.
+     *
+     * @param mustWait If this flag is true, then this query must keep trying
+     * until at least one row is selected.
+     *
+     * @param plan The columns (or expressions) to be printed. See
+     * planColumns() and planSelectList(). A column named "score" (and
+     * without an expression) is the score of each row.
+     *
+     * @param where The parsed 'where' clause.
+     *
+     * @param rank The order and number of rows to be printed.
+     *
+     * @param os The output stream to where the results are to be written.
+     */
+    void selectQuery(CSV& csv, bool mustWait, const ColumnPlan& plan,
+                     const WhereExpr& where, const RankClause& rank,
+                     std::ostream& os);
+
+    /**
+     * Method to print the given columns (or expressions) in rows of a CSV
+     * that meet an optional simple 'where' clause. See the overridden
+     * selectQuery() method for details on the parameters.
+     *
+     * @param plan The columns (or expressions) to be printed. See
+     * planColumns() and planSelectList().
+     */
+    void selectQuery(CSV& csv, bool mustWait, const ColumnPlan& plan,
+                     const int whereColIdx, const std::string& cond,
+                     const std::string& value, std::ostream& os);
+
     /**
      * Method that is called to perform actual operations to update specified
      * values in the CSV. This method's documentation uses the following query
@@ -123,6 +405,21 @@ class SQLAir : public SQLAirBase {
                      const int whereColIdx, const std::string& cond,
                      const std::string& value, std::ostream& os) override;
 
+    /**
+     * Method to update columns (with values or expressions) in the rows of
+     * a CSV that meet an optional simple 'where' clause. The expressions
+     * are evaluated (with the values in the rows before the update) and
+     * set while the CSV is locked. Hence, updates such as
+     * "set raters = raters + 1" are atomic. See the overridden
+     * updateQuery() method for details on the parameters.
+     *
+     * @param plan The columns to be updated and their values (or
+     * expressions). See planColumns() and planSetClause().
+     */
+    void updateQuery(CSV& csv, bool mustWait, const ColumnPlan& plan,
+                     const int whereColIdx, const std::string& cond,
+                     const std::string& value, std::ostream& os);
+
     /**
      * Helper method to perform the actual operations associated with inserting
      * a new row into a given CSV. This method's documentation uses the
@@ -197,10 +494,11 @@ class SQLAir : public SQLAirBase {
                      std::ostream& os) override;
 
     /**
-     * Saves the recently used CSV using the name specified in the recentCSV
-     * string. If the recent CSV was downloaded from an URL, then this method
-     * throws an exception (as this feature is not yet implemented). If the CSV
-     * was loaded from a a file, then the data in the file is overwritten.
+     * Saves the recently used CSV in the current session (see
+     * Session::recentCSV) to a local file. If the recent CSV was downloaded
+     * from an URL, then this method throws an exception (as this feature is
+     * not yet implemented). If the CSV was loaded from a a file, then the
+     * data in the file is overwritten.
      *
      * @param os The output stream to where the result of saving (if any) is
      * to be written.
@@ -212,10 +510,11 @@ class SQLAir : public SQLAirBase {
     /**
      * Helper method to obtain a reference to a pre-loaded CSV file from the
      * inMemoryCSV map.  If the requested file is not present, then this
-     * method loads the data into the inMemoryCSV.
+     * method loads the data into the inMemoryCSV.  If the file had been
+     * evicted with unsaved changes, it is reloaded from its spill file.
      *
-     * @note Currently, this method is not MT-safe. So avoid calling this
-     * method from multiple threads simultaneously.
+     * @note The returned CSV is pinned in memory (and hence cannot be evicted)
+     * until the current call to process() finishes.
      *
      * @param fileOrURL Path to a CSV file or a URL to a CSV data to be returned
      * by this method.  If the path is empty string, then this method returns
@@ -245,7 +544,7 @@ class SQLAir : public SQLAirBase {
      * @param maxThr An optional maximum number of threads to be used by this
      * method.
      */
-    void runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr);\
+    void runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr);
     
     /**
     * This method is to  process GET requests corresponding to the 
@@ -258,6 +557,44 @@ class SQLAir : public SQLAirBase {
     void serveClient(std::istream& is, std::ostream& os);
 
    protected:
+    /**
+     * Information about each CSV held in inMemoryCSV.
+     */
+    struct CachedCSV {
+        /** The CSV data. It is changed only when the CSV is evicted. */
+        std::shared_ptr<CSV> csv;
+        /** The number of pins (see pin()) on the CSV. */
+        std::atomic<int> pins = {0};
+        /** Flag set (with catalogMutex locked) when the CSV is being
+         * evicted or inspected. The CSV can then be pinned only with
+         * catalogMutex locked. */
+        std::atomic<bool> excluded = {false};
+        /** The time (in steady_clock ticks) at which this CSV was last used
+         * (for LRU). */
+        std::atomic<std::chrono::steady_clock::rep> lastUse = {0};
+    };
+
+    /**
+     * Information about each dirty CSV that has been evicted from
+     * inMemoryCSV.
+     */
+    struct SpilledCSV {
+        /** The temporary file holding the data of the CSV. */
+        std::string path;
+        /** The CSV until its data has been written to the spill file (or if
+         * the data could not be written). If the CSV is used in the
+         * meantime, it is just put back in inMemoryCSV. */
+        std::shared_ptr<CSV> csv;
+    };
+
+    /** The dirty CSVs evicted by evictIfNeeded(), with the paths or URLs
+     * of the CSVs. They are spilled after catalogMutex is unlocked. */
+    using SpillList = std::vector<std::pair<std::string, SpilledCSV>>;
+
+    /** The CSVs in memory. The key is the path or URL of the CSV. */
+    using Catalog = std::unordered_map<std::string,
+                                       std::shared_ptr<CachedCSV>>;
+
     /**
      * This method is a refactored utility method. This method is called from
      * the seqlectQuery method. This method performs the actual operations
@@ -275,11 +612,8 @@ class SQLAir : public SQLAirBase {
      *
      * @param csv The CSV data to be used.
      *
-     * @param mustWait If this flag is true, then this query must keep trying
-     * until at least one row is selected.
-     *
-     * @param colNames The column names in the CSV file to be printed by this
-     * method. The colNames will be just {"*"} or valid column names in the CSV.
+     * @param plan The columns to be printed by this method. See
+     * planColumns().
      *
      * @param whereColIdx An optional column specified in a 'where' clause in
      * the query for checking. If a 'where' clause was not specified, then this
@@ -301,9 +635,342 @@ class SQLAir : public SQLAirBase {
      *
      * @return The number of rows printed by this method.
      */
-    int trySelect(CSV& csv, bool mustWait, StrVec colNames,
-                  const int whereColIdx, const std::string& cond,
-                  const std::string& value, std::ostream& os);
+    int selectHelper(CSV& csv, const ColumnPlan& plan, const int whereColIdx,
+                     const std::string& cond, const std::string& value,
+                     std::ostream& os);
+
+    /**
+     * Overloaded helper method to print the rows of a CSV that meet a
+     * compound 'where' clause.  This method is called from the corresponding
+     * selectQuery method.
+     *
+     * @param csv The CSV data to be used.
+     *
+     * @param plan The columns to be printed. See planColumns().
+     *
+     * @param where The parsed 'where' clause.
+     *
+     * @param rank The order and number of rows to be printed.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @return The number of rows printed by this method.
+     */
+    int selectHelper(CSV& csv, const ColumnPlan& plan, const WhereExpr& where,
+                     const RankClause& rank, std::ostream& os);
+
+    /**
+     * Resolve the columns of a select or update statement against a CSV.
+     * This is done once per statement, so that the rows are processed
+     * without looking-up column names for each row.
+     *
+     * @param csv The CSV whose columns are referenced by the statement.
+     *
+     * @param colNames The names of the columns. A select may use just {"*"}
+     * for all the columns.
+     *
+     * @param values The values to be set in the columns by an update. It is
+     * empty for a select.
+     *
+     * @return The plan with the index of each column.
+     *
+     * @exception Exp This method throws an exception if a column name is
+     * invalid (e.g., a "*" in an update).
+     */
+    ColumnPlan planColumns(const CSV& csv, const StrVec& colNames,
+                           const StrVec& values = {}) const;
+
+    /**
+     * Checks if a select statement has a compound 'where' clause (with
+     * "and", "or", or parentheses) or a condition that is checked by a
+     * Matcher (e.g., "where title ilike 'road'"). Such statements are parsed
+     * and processed by this method. All other statements are processed by
+     * the base class.
+     *
+     * @param sql The tokens in the select statement to be processed.
+     *
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 matching row is found.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessSelect(const StrVec& sql, bool mustWait,
+                                  std::ostream& os) override;
+
+    /**
+     * Checks if an update statement has expressions in its set clause
+     * (e.g., "update test.csv set raters = raters + 1 where ...") or a
+     * condition that is checked by a Matcher. Such statements are parsed
+     * and processed by this method. All other statements are processed by
+     * the base class.
+     *
+     * @param sql The tokens in the update statement to be processed.
+     *
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 row is updated.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessUpdate(const StrVec& sql, bool mustWait,
+                                  std::ostream& os) override;
+
+    /**
+     * Checks if a delete statement has a condition that is checked by a
+     * Matcher (e.g., "delete from test.csv where title regexp '^the'").
+     * Such statements are parsed and processed by this method. All other
+     * statements are processed by the base class.
+     *
+     * @param sql The tokens in the delete statement to be processed.
+     *
+     * @param mustWait Flag to indicate if the query must keep trying until
+     * a row is deleted.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessDelete(const StrVec& sql, bool mustWait,
+                                  std::ostream& os) override;
+
+    /**
+     * Compile the select list of a select statement with expressions (e.g.,
+     * "select title, upper(city), raters + 1 from ...").
+     *
+     * @param csv The CSV whose columns are referenced by the expressions.
+     *
+     * @param tokens The tokens in the select list. See splitParens().
+     *
+     * @return The plan with the column (or expression) for each item.
+     */
+    ColumnPlan planSelectList(const CSV& csv, const StrVec& tokens) const;
+
+    /**
+     * Compile the set clause of an update statement with expressions (e.g.,
+     * "set raters = raters + 1, title = upper(title)"). As with the base
+     * class, a value that is just one token is a literal value.
+     *
+     * @param csv The CSV whose columns are to be updated.
+     *
+     * @param tokens The tokens in the set clause. See splitParens().
+     *
+     * @return The plan with the value (or expression) for each column.
+     */
+    ColumnPlan planSetClause(const CSV& csv, const StrVec& tokens) const;
+
+    /**
+     * Checks if a create statement is valid and processes it. The create
+     * statements are:
+     *
+     *   - "create bitmap index [name] on <csv> (<column>)", which builds a
+     *     bitmap index on the given column. It is used for equality
+     *     conditions and "select count(*)" statements.
+     *
+     *   - "create text index [name] on <csv> (<column>)", which builds a
+     *     full-text index on the given column. It is used for
+     *     "match(<column>, '<terms>')" conditions. See TextIndex.
+     *
+     *   - "create spatial index [name] on <csv> (<latitude>, <longitude>)",
+     *     which builds a spatial index on the given pair of columns (in
+     *     degrees), replacing the previous spatial index of the CSV (if
+     *     any). It is used for "within_radius" and "nearest" conditions.
+     *     See SpatialIndex.
+     *
+     * The indexes are maintained as rows are updated, inserted, and
+     * deleted.
+     *
+     * @param sql The tokens in the create statement to be processed.
+     *
+     * @param mustWait This flag is not applicable for this statement.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessCreate(const StrVec& sql, bool mustWait,
+                                  std::ostream& os);
+
+    /**
+     * Method to print the number of rows in a CSV that meet an optional
+     * 'where' clause. This method is called to process a
+     * "select count(*) ..." statement. Equality conditions on columns with
+     * bitmap indexes are answered without checking the rows.
+     *
+     * @param csv The CSV data to be used.
+     *
+     * @param where The parsed 'where' clause or nullptr if there is none.
+     *
+     * @param os The output stream to where the results are to be written.
+     */
+    void countQuery(CSV& csv, const WhereExpr* where, std::ostream& os);
+
+    /**
+     * Checks if an insert statement is valid and processes it. Statements
+     * with multiple rows of values -- e.g.,
+     * "insert into <csv> (<cols>) values (...), (...), ..." -- are
+     * processed by this method. All other statements are processed by the
+     * base class.
+     *
+     * @param sql The tokens in the insert statement to be processed.
+     *
+     * @param mustWait This flag is not applicable for this statement.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessInsert(const StrVec& sql, bool mustWait,
+                                  std::ostream& os) override;
+
+    /**
+     * Checks if a "copy <csv> from <file|url>" statement is valid and
+     * processes it. The rows in the given file or URL are appended to the
+     * CSV in one batch. Columns are matched by name and the columns in
+     * the CSV that are not in the source are left empty.
+     *
+     * @param sql The tokens in the copy statement to be processed.
+     *
+     * @param mustWait This flag is not applicable for this statement.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessCopy(const StrVec& sql, bool mustWait,
+                                std::ostream& os);
+
+    /**
+     * Helper method to append a batch of rows to a CSV. The table lock is
+     * acquired once, the rows are reallocated at most once, and the
+     * auxiliary data (dictionaries, zone maps, Bloom filters, and bitmap
+     * indexes) is updated in one pass for the whole batch.
+     *
+     * @param csv The CSV to which the rows are to be appended.
+     *
+     * @param rows The rows to be appended. Each row must have a value for
+     * every column in the CSV. The rows are moved into the CSV.
+     *
+     * @return The number of rows appended.
+     */
+    size_t appendRows(CSV& csv, std::vector<CSVRow>&& rows);
+
+    /**
+     * Helper method to parse a compound 'where' clause. The conditions are
+     * combined with "and" and "or" (where "and" has higher precedence) and
+     * may be grouped using parentheses. In addition to the conditions
+     * supported by matches() and Matcher (i.e., "ilike" and "regexp"), a
+     * condition may be a list of values of the form
+     * "col in (value1, value2, ...)", a full-text condition of the form
+     * "match(col, 'terms')", or a spatial condition. A full-text condition
+     * requires a text index on the column. The spatial conditions use the
+     * spatial index of the CSV (with latitudes and longitudes in degrees):
+     *
+     *   - "within_radius(lat, lon, km)" is met by rows within the given
+     *     distance (in km) of the point.
+     *
+     *   - "nearest(lat, lon, k)" is met by the k rows nearest to the point
+     *     (before any other conditions are applied).
+     *
+     * @param csv The CSV used to look-up the columns in the conditions.
+     *
+     * @param sql The tokens in the statement being parsed.
+     *
+     * @param[in,out] pos The index of the next token to be parsed. It is
+     * advanced past the tokens consumed by this method.
+     *
+     * @param precedence The lowest precedence of the operators to be parsed
+     * by this call: 0 for "or", 1 for "and", and 2 for just a single (or
+     * a parenthesized) condition.
+     *
+     * @return The parsed expression.
+     *
+     * @exception Exp This method throws an exception if the clause is
+     * invalid.
+     */
+    std::unique_ptr<WhereExpr> parseWhere(const CSV& csv, const StrVec& sql,
+                                          size_t& pos,
+                                          const int precedence = 0) const;
+
+    /**
+     * Helper method to parse the optional "order by" and "limit" clauses
+     * after the 'where' clause of a select statement.
+     *
+     * @param tokens The tokens in the 'where' clause (and the clauses
+     * after it).
+     *
+     * @param pos The index of the first token after the 'where' clause.
+     *
+     * @return The parsed clauses.
+     *
+     * @exception Exp This method throws an exception if the tokens are not
+     * valid clauses.
+     */
+    RankClause parseRankClause(const StrVec& tokens, size_t pos) const;
+
+    /**
+     * Helper method to parse a simple 'where' clause of the form
+     * "where col cond value", where the condition is one supported by
+     * matches() or a Matcher (e.g., "ilike" or "regexp").
+     *
+     * @param csv The CSV used to look-up the column in the condition.
+     *
+     * @param where The "where" token in the statement being parsed (or
+     * end if the statement does not have a where clause).
+     *
+     * @param end The end of the tokens in the statement.
+     *
+     * @return The index of the column (or -1 if there is no where clause),
+     * the condition, and the value.
+     *
+     * @exception Exp This method throws an exception if the clause is
+     * invalid, including invalid regular expressions.
+     */
+    std::tuple<int, std::string, std::string>
+    parseSimpleWhere(const CSV& csv, StrVec::const_iterator where,
+                     StrVec::const_iterator end) const;
+
+    /**
+     * Helper method to obtain the bitmap of rows in a CSV that meet a single
+     * condition. The bitmap is looked-up in (or added to) the bitmap cache
+     * of the CSV so that repeated conditions are evaluated only once.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param colIdx The index of the column in the condition.
+     *
+     * @param cond The condition to be applied. See matches() method. The
+     * condition may also be "in".
+     *
+     * @param values The value to be used for comparison or the list of
+     * values for an "in" condition.
+     *
+     * @return The bitmap of the rows that meet the condition.
+     */
+    std::shared_ptr<const RowBitmap> selectRows(CSV& csv, const int colIdx,
+                                                const std::string& cond,
+                                                const StrVec& values);
+
+    /**
+     * Helper method to obtain the bitmap of rows in a CSV that meet a
+     * compound 'where' clause.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param where The parsed 'where' clause.
+     *
+     * @return The bitmap of the rows that meet the where clause.
+     */
+    std::shared_ptr<const RowBitmap> selectRows(CSV& csv,
+                                                const WhereExpr& where);
 
     /**
      * Method that is called to perform actual operations to update specified
@@ -320,18 +987,10 @@ class SQLAir : public SQLAirBase {
      * the CSV will correspond to the data for "test.csv" (loaded into memory
      * via call to the loadAndGet() method).
      *
-     * @param mustWait If this flag is true then this method must repeatedly
-     * try performing the update operation until at least 1 row is updated.
-     *
-     * @param colNames The names of the columns to be updated in each row.
-     * This method may assume the colNames are valid (as they are validated
-     * in the the update method). Given the above example query, this vector
-     * will contain {"rating", "raters"}.
-     *
-     * @param values The values to be set for each column. This method may
-     * assume the values and colNames match (as it is validated in the update
-     * method).  Given the above example query, this vector will contain
-     * {"2.5", "2"}.
+     * @param plan The columns to be updated in each row along with the
+     * values to be set. Given the above example query, the plan has the
+     * indexes of the "rating" and "raters" columns and the values
+     * {"2.5", "2"}. See planColumns().
      *
      * @param whereColIdx The integer value corresponding to the column in the
      * the where clause if any. If a where clause is not present then this
@@ -345,20 +1004,25 @@ class SQLAir : public SQLAirBase {
      * @param value The value to be compared against. Given the above query,
      * this parameter will contain the value "12345" (without quotes)
      *
+     * @param os The output stream for any messages. Currently unused.
+     *
      * @return This method returns the number of rows updated by this method.
      */
-    int tryUpdate(CSV& csv, bool mustWait, StrVec colNames, StrVec values,
-                  const int whereColIdx, const std::string& cond,
-                  const std::string& value);
+    int updateHelper(CSV& csv, const ColumnPlan& plan,
+                     const int whereColIdx, const std::string& cond,
+                     const std::string& value, std::ostream& os);
 
     /**
      * A thread-main method to process each request from a web-client in a
      * separate thread. This method is called from the runServer method
      * each time a client connects, when sql-air is running as a web-server.
-     * This web-server will get the following 2 types of HTTP-GET requests:
+     * This web-server will get the following 3 types of HTTP requests:
      *     1. Request to run a query where the request starts with the prefix
      *        "/sql-air?query=select;"
-     *     2. All other requests are assumed to be requests for files that are
+     *     2. POST requests to "/sql-air/batch" (optionally with
+     *        "?parallel=1") with a batch of statements in the body. See
+     *        the processBatch() method.
+     *     3. All other requests are assumed to be requests for files that are
      *        returned back to the client using http::file() helper method in
      *        the HTTPFile class.
      *
@@ -395,28 +1059,621 @@ class SQLAir : public SQLAirBase {
     void loadFromURL(CSV& csv, const std::string& hostName,
                      const std::string& port, const std::string& path);
 
-   private:
     /**
-     * The most recently referenced CSV in a query. This value is updated
-     * int he getOrLoadCSV method.
+     * Helper method to split a batch of statements on semicolons or
+     * newlines that are not in quoted values.
+     *
+     * @param batch The batch of statements to be split.
+     *
+     * @return The non-blank statements in the batch.
      */
-    std::string recentCSV;
+    static StrVec splitStatements(const std::string& batch);
 
+    /**
+     * Helper method to split tokens that consist of consecutive
+     * parentheses (such as "))" or ")(") into individual parentheses.
+     * Parentheses in other runs of special characters (such as "=(") are
+     * split from the rest of the run (e.g., into "=" and "(").
+     *
+     * @param first The first token to be included.
+     *
+     * @param last The token after the last one to be included.
+     *
+     * @return The tokens with each parenthesis as a separate token.
+     */
+    static StrVec splitParens(StrVec::const_iterator first,
+                              StrVec::const_iterator last);
+
+    /**
+     * Break a given query into tokens. This method overrides the base
+     * class method to use the Lexer, which matches keywords (e.g., "wait"
+     * or "select") without converting tokens to lower case. Other than
+     * the vector of tokens, short tokens do not need memory allocations.
+     *
+     * @param sql The query to be tokenized.
+     *
+     * @return The tokens, the "wait" flag, and the command in the query.
+     * See SQLAirBase::preprocess().
+     */
+    std::tuple<StrVec, bool, int>
+        preprocess(const std::string& sql) const override;
+
+    /**
+     * Load CSV data from a given stream. The data is read into memory and
+     * split into rows and values in place by the Lexer, which is faster
+     * than CSV::load(). Unusual data (such as rows with a different number
+     * of values than the header) is loaded via CSV::load(), which also
+     * reports any errors.
+     *
+     * @param csv The CSV into which the data is to be loaded.
+     *
+     * @param is The input stream from where the CSV data is to be loaded.
+     */
+    static void loadCSV(CSV& csv, std::istream& is);
+
+    /**
+     * Helper method to obtain the CSV explicitly named in a statement (e.g.,
+     * "test.csv" in "select * from test.csv"). This method is used to
+     * determine if statements in a batch are independent.
+     *
+     * @param sql The statement to be checked.
+     *
+     * @return The path (in normal form, so that different spellings of a
+     * path are the same) or URL of the CSV. If the statement does not name
+     * a CSV (or is not valid), then this method returns an empty string.
+     */
+    std::string getCSVName(const std::string& sql) const;
+
+    /**
+     * Helper method to build the auxiliary data (optional dictionaries,
+     * zone maps, and optional Bloom filters) used to speed-up queries on the
+     * columns of a given CSV. This method is called after a CSV is loaded
+     * and after rows are deleted from a CSV. Any existing auxiliary data is
+     * rebuilt.
+     *
+     * @note This method must be called only when no other thread is using
+     * the CSV.
+     *
+     * @param csv The CSV whose columns are to be indexed.
+     */
+    void indexColumns(CSV& csv);
+
+    /**
+     * Helper method to dictionary encode the low-cardinality columns in a
+     * given CSV. Any existing dictionaries are rebuilt. The cells are not
+     * changed, so the dictionaries add to the memory used by the CSV. This
+     * method is called by indexColumns() only if dictionary encoding is
+     * enabled (see setDictionaryEncoding()).
+     *
+     * @note This method must be called only when no other thread is using
+     * the CSV.
+     *
+     * @param csv The CSV whose columns are to be dictionary encoded.
+     */
+    void encodeColumns(CSV& csv) const;
+
+    /**
+     * Helper method to build (or rebuild) the bitmap index for a given
+     * column in a CSV.
+     *
+     * @note This method must be called only when no other thread is
+     * modifying the CSV.
+     *
+     * @param csv The CSV whose column is to be indexed.
+     *
+     * @param colIdx The index of the column to be indexed.
+     */
+    void createBitmapIndex(CSV& csv, const int colIdx);
+
+    /**
+     * Helper method to build (or rebuild) the full-text index for a given
+     * column in a CSV.
+     *
+     * @note This method must be called only when no other thread is
+     * modifying the CSV.
+     *
+     * @param csv The CSV whose column is to be indexed.
+     *
+     * @param colIdx The index of the column to be indexed.
+     */
+    void createTextIndex(CSV& csv, const int colIdx);
+
+    /**
+     * Helper method to build (or rebuild) the spatial index on a pair of
+     * columns in a CSV.
+     *
+     * @note This method must be called only when no other thread is
+     * modifying the CSV.
+     *
+     * @param csv The CSV whose columns are to be indexed.
+     *
+     * @param latCol The index of the latitude column.
+     *
+     * @param lonCol The index of the longitude column.
+     */
+    void createSpatialIndex(CSV& csv, const int latCol, const int lonCol);
+
+    /**
+     * Helper method to build the bitmap, full-text, and spatial indexes
+     * previously created (via "create ... index") on the columns of a CSV
+     * that is being loaded (or reloaded after being evicted).
+     *
+     * @param fileOrURL The path or URL of the CSV.
+     *
+     * @param csv The CSV whose columns are to be indexed.
+     *
+     * @param lock If this flag is true, then catalogMutex is locked by
+     * this method. Otherwise, the caller must have locked it.
+     */
+    void createIndexes(const std::string& fileOrURL, CSV& csv,
+                       const bool lock = true);
+
+    /**
+     * Helper method to set a value in a column of the given rows, along with
+     * the auxiliary data (dictionaries, zone maps, Bloom filters, and
+     * indexes) for the column. The rows are processed one block (see
+     * ZoneMap::BlockSize) at a time so that the zone map and Bloom filter
+     * are updated just once per block.
+     *
+     * @note The caller must hold the table lock of the CSV exclusively.
+     * Hence, the rowMutex of each row is not locked.
+     *
+     * @param csv The CSV containing the rows.
+     *
+     * @param rows The indexes of the rows to be changed, in ascending order.
+     *
+     * @param colIdx The index of the column being changed.
+     *
+     * @param newValue The new value to be stored in the rows.
+     *
+     * @param code The dictionary code of newValue, if the column is
+     * dictionary encoded. It is obtained (just once per statement) while
+     * the CSV is locked, as deletes rebuild the dictionaries.
+     */
+    void updateColumn(CSV& csv, const std::vector<size_t>& rows,
+                      const int colIdx, const std::string& newValue,
+                      const ColumnDictionary::Code code);
+
+    /**
+     * Overloaded helper method to set a different value (e.g., computed by
+     * an expression) in each of the given rows. See the other overload.
+     *
+     * @param newValues The value for each row. The values are moved into
+     * the rows.
+     */
+    void updateColumn(CSV& csv, const std::vector<size_t>& rows,
+                      const int colIdx, StrVec&& newValues);
+
+    /**
+     * Helper method to add the values in a new row to the auxiliary data
+     * (dictionaries, zone maps, Bloom filters, and indexes) of a CSV.
+     *
+     * @param csv The CSV to which the row is being added.
+     *
+     * @param rowIdx The index of the new row.
+     *
+     * @param row The values in the new row.
+     */
+    void addToColumnIndexes(CSV& csv, const size_t rowIdx,
+                            const CSVRow& row);
+
+    /**
+     * Helper method to rebuild the Bloom filters of the blocks in a column
+     * that have become stale due to updates. Filters are rebuilt lazily, when
+     * they are next used by a query, rather than when the rows are updated.
+     *
+     * @param csv The CSV whose column is to be refreshed.
+     *
+     * @param colIdx The index of the column whose filters are refreshed.
+     *
+     * @param filter The Bloom filters of the column.
+     */
+    void refreshBloomFilter(CSV& csv, const int colIdx,
+                            BloomFilter& filter) const;
+
+    /**
+     * Helper method to prepare a 'where' clause for evaluation over the rows
+     * of a given CSV. If the column in the where clause is dictionary
+     * encoded, the condition is checked once for each distinct value.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param whereColIdx The index of the column in the where clause. If a
+     * where clause was not specified, then this parameter is -1.
+     *
+     * @param cond The condition to be applied. See matches() method.
+     *
+     * @param value The value to be used for comparison.
+     *
+     * @return The where clause prepared for use with the matchesRow method.
+     */
+    WhereClause prepareWhere(CSV& csv, const int whereColIdx,
+                             const std::string& cond,
+                             const std::string& value) const;
+
+    /**
+     * Helper method to prepare an "in" condition (e.g.,
+     * "where id in (1, 2, 3)") for evaluation over the rows of a given CSV.
+     * The values are placed in a hash set to check each row. If the column
+     * has a bitmap index, then the index is probed for each value instead.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param colIdx The index of the column in the condition.
+     *
+     * @param values The list of values in the condition.
+     *
+     * @return The where clause prepared for use with the matchesRow method.
+     */
+    WhereClause prepareInList(CSV& csv, const int colIdx,
+                              const StrVec& values) const;
+
+    /**
+     * Helper method to determine the blocks of rows in a column that may
+     * have rows meeting a condition, based on the zone map and Bloom
+     * filters (if any) of the column.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param colIdx The index of the column in the condition.
+     *
+     * @param cond The condition to be applied. See matches() method.
+     *
+     * @param value The value to be used for comparison.
+     *
+     * @return A flag for each block (see ZoneMap::BlockSize) that may have
+     * rows meeting the condition. Blocks past the end of the vector may
+     * have matching rows.
+     */
+    std::vector<bool> mayMatchBlocks(CSV& csv, const int colIdx,
+                                     const std::string& cond,
+                                     const std::string& value) const;
+
+    /**
+     * Helper method to check if a given row in a CSV meets the condition in
+     * a prepared where clause.
+     *
+     * @note The caller must hold the rowMutex of the row being checked.
+     *
+     * @param where The where clause returned by prepareWhere().
+     *
+     * @param csv The CSV containing the row.
+     *
+     * @param rowIdx The index of the row to be checked.
+     *
+     * @return This method returns true if the row meets the condition or if
+     * the where clause is empty.
+     */
+    bool matchesRow(const WhereClause& where, const CSV& csv,
+                    const size_t rowIdx) const;
+
+    /**
+     * Helper method to skip over rows that cannot meet the condition in a
+     * prepared where clause -- i.e., rows that are not in the rows from a
+     * bitmap index or are in blocks that cannot have matching rows.
+     *
+     * @param where The where clause returned by prepareWhere().
+     *
+     * @param rowIdx The index of the next row to be checked.
+     *
+     * @return The index of the first row, at or after rowIdx, that may meet
+     * the condition.
+     */
+    size_t nextCandidate(const WhereClause& where, size_t rowIdx) const;
+
+    /**
+     * Internal helper method to pin a CSV in memory for the duration of the
+     * current query. The pins are released at the end of process(). If a
+     * transaction is in progress, the version of the CSV is noted (before
+     * its rows are read) the first time the transaction uses it.
+     *
+     * @note The caller must have incremented the pins of the CSV, which
+     * are decremented when the pin is released.
+     *
+     * @param entry The entry for the CSV to be pinned.
+     *
+     * @return A reference to the pinned CSV.
+     */
+    CSV& pin(const std::shared_ptr<CachedCSV>& entry);
+
+    /**
+     * Internal helper method to obtain the current snapshot of the
+     * in-memory CSVs without any locks. The snapshot is cached by each
+     * thread until a new snapshot is published.
+     *
+     * @return The current snapshot. It is valid until the next call to
+     * this method by the same thread.
+     */
+    const Catalog& getCatalog() const;
+
+    /**
+     * Internal helper method to publish a new snapshot of the in-memory
+     * CSVs.
+     *
+     * @note This method must be called with catalogMutex locked.
+     *
+     * @param catalog The new snapshot to be published.
+     */
+    void publishCatalog(std::shared_ptr<const Catalog> catalog);
+
+    /**
+     * Internal helper method to prevent an in-memory CSV from being pinned
+     * by queries (without catalogMutex locked), so that it can be safely
+     * inspected or evicted.
+     *
+     * @note This method must be called with catalogMutex locked.
+     *
+     * @param entry The entry for the CSV.
+     *
+     * @return This method returns true if the CSV is not pinned and has
+     * been excluded. The caller must reset the excluded flag (unless the CSV
+     * is evicted). It returns false if the CSV is pinned.
+     */
+    static bool exclude(CachedCSV& entry);
+
+    /**
+     * Checks if a "begin", "commit", or "rollback" statement is valid and
+     * processes it. Transactions are scoped to the current session (see
+     * Session and Transaction). A transaction is rolled back if its
+     * session ends without a commit (e.g., at the end of a request without
+     * a session token) or if its session is idle for a few minutes (see
+     * getSession()).
+     *
+     * A commit locks the CSVs used by the transaction (in a fixed order),
+     * validates their versions, and then applies the buffered writes. If
+     * the validation fails or a write throws an exception, then the
+     * transaction is rolled back and none of its writes are applied. To
+     * undo partial writes, each write records just the data it changes
+     * (see undoLog). The versions of the CSVs are changed only once all
+     * the writes have been applied.
+     *
+     * @param sql The tokens in the statement to be processed.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessTransaction(const StrVec& sql, std::ostream& os);
+
+    /**
+     * Obtain the session of the request being run by the current thread.
+     *
+     * @return The current session. If the thread is not running a request
+     * for a client, then this method returns the default session.
+     */
+    Session& currentSession() {
+        return (session != nullptr ? *session : defaultSession);
+    }
+
+    /**
+     * Obtain the session for a given session token, creating a new session
+     * if needed. When new sessions are created (or at most once a minute),
+     * sessions that have been idle for a while are removed and the
+     * transactions of sessions that have been idle for a few minutes are
+     * rolled back. Sessions in use by a request are not idle.
+     *
+     * @param token The session token supplied by the client.
+     *
+     * @return The session for the token.
+     */
+    std::shared_ptr<Session> getSession(const std::string& token);
+
+    /**
+     * Helper method to buffer a write (an update, insert, or delete) on a
+     * CSV if a transaction is in progress.
+     *
+     * @param csv The CSV to be modified. It must have been pinned by the
+     * current query.
+     *
+     * @param write The function to apply the write when the transaction is
+     * committed.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @return This method returns true if the write was buffered. If no
+     * transaction is in progress it returns false and the write must be
+     * applied by the caller.
+     */
+    bool deferWrite(CSV& csv, std::function<void(std::ostream&)> write,
+                    std::ostream& os);
+
+    /**
+     * Check if a CSV is locked exclusively by the commit of a transaction
+     * in the current thread (see committingCSV).
+     *
+     * @param csv The CSV to be checked.
+     *
+     * @return This method returns true if the CSV is being committed.
+     */
+    static bool isCommitting(const CSV& csv);
+
+    /**
+     * Mark a CSV as modified (see CSV::markModified()) after a write, unless
+     * the write is being committed by the current thread. A commit marks
+     * its CSVs once all its writes are applied. So a commit that is rolled
+     * back does not change the versions of the CSVs (or wake queries
+     * waiting for changes).
+     *
+     * @param csv The CSV that has been modified.
+     */
+    static void markModified(CSV& csv);
+
+    /**
+     * Record the values in a column of the given rows in undoLog, if the
+     * CSV is being committed by the current thread. This method must be
+     * called just before the values are changed.
+     *
+     * @param csv The CSV whose values are to be changed.
+     *
+     * @param rows The indexes of the rows whose values are to be changed.
+     *
+     * @param colIdx The index of the column to be changed.
+     */
+    static void logUndo(CSV& csv, const std::vector<size_t>& rows,
+                        const int colIdx);
+
+    /**
+     * Lock a CSV's tableMutex in shared mode (for scanning rows), unless
+     * the current thread already holds it exclusively for a commit.
+     *
+     * @param csv The CSV to be locked.
+     *
+     * @return The lock, which is released when it goes out of scope.
+     */
+    static std::shared_lock<std::shared_mutex> readLock(CSV& csv);
+
+    /**
+     * Lock a CSV's tableMutex in exclusive mode (for adding or removing
+     * rows), unless the current thread already holds it for a commit.
+     *
+     * @param csv The CSV to be locked.
+     *
+     * @return The lock, which is released when it goes out of scope.
+     */
+    static std::unique_lock<std::shared_mutex> writeLock(CSV& csv);
+
+    /**
+     * Internal helper method to evict CSVs (see evictIfNeeded()) if the
+     * memory used by the in-memory CSVs exceeds the memory budget. It is
+     * called when the budget is set and after rows are appended to a CSV.
+     * The dirty CSVs that are evicted are spilled after unlocking
+     * catalogMutex.
+     */
+    void enforceMemoryBudget();
+
+    /**
+     * Internal helper method to evict the least recently used CSVs until the
+     * memory used by the in-memory CSVs is within the memory budget. Only
+     * CSVs that are not pinned by any query are evicted. Dirty CSVs are
+     * recorded in spilledCSV, to be written to a temporary file by spill().
+     * The memory used by the CSVs is obtained from their (incrementally
+     * maintained) estimates. See CSV::getMemoryEstimate().
+     *
+     * @note This method must be called with catalogMutex locked.
+     *
+     * @param[out] evicted The CSVs evicted by this method. The caller frees
+     * them after releasing catalogMutex.
+     *
+     * @param[out] spills The dirty CSVs evicted by this method. The caller
+     * must call spill() for each of them after releasing catalogMutex.
+     */
+    void evictIfNeeded(std::vector<std::shared_ptr<CSV>>& evicted,
+                       SpillList& spills);
+
+    /**
+     * Internal helper method to write a dirty CSV (evicted by
+     * evictIfNeeded()) to its spill file. Once written, the CSV is released
+     * from spilledCSV. If the data could not be written, the CSV is kept in
+     * spilledCSV (so that it is put back in memory when it is used again).
+     *
+     * @note This method must be called without catalogMutex locked.
+     *
+     * @param fileOrURL The path or URL of the CSV being spilled.
+     *
+     * @param spilled The CSV and its spill file.
+     */
+    void spill(const std::string& fileOrURL, const SpilledCSV& spilled);
+
+   private:
     /**
      * This is a convenience mutex that is used to enable thread-safe
-     * operations on the recentCSV instance variable in this class. This
-     * mutex is locked and unlocked in the loadAndGet method in this class.
+     * operations on the CSVs in memory (i.e., inMemoryCSV and spilledCSV)
+     * and the columns with indexes. This mutex is locked and unlocked in the
+     * loadAndGet method in this class.
      */
-    std::mutex recentCSVMutex;
+    std::mutex catalogMutex;
+
+    /** The sessions of clients that supplied a session token. The key is
+     * the token. */
+    std::unordered_map<std::string, std::shared_ptr<Session>> sessions;
+
+    /** The time when sessions were last checked for idle sessions (and
+     * idle transactions) by getSession. Guarded by sessionsMutex. */
+    std::chrono::steady_clock::time_point lastSessionCheck;
+
+    /** Mutex to enable thread-safe operations on sessions. */
+    std::mutex sessionsMutex;
+
+    /** The session used by the console (and by threads without a
+     * session). */
+    Session defaultSession;
+
+    /** The session of the request being run by the current thread. */
+    static thread_local Session* session;
 
     /**
-     * An unordered map to maintain the CSV files that have been accessed
-     * in recent queries.  This map is used to provide convenient/rapid
+     * An immutable snapshot of the CSV files that have been accessed in
+     * recent queries.  This map is used to provide convenient/rapid
      * access to CSV files that the user has recently worked with. The most
-     * recent CSV used is tracked by the recentCSV instance variable. See the
-     * getOrLoadCSV() method in this class.
+     * recent CSV used is tracked by each session. See the loadAndGet()
+     * method in this class.
+     *
+     * Queries look up CSVs in the snapshot without any locks. Loading or
+     * evicting CSVs (with catalogMutex locked) publishes a new snapshot
+     * via publishCatalog(). This pointer must be accessed only via
+     * std::atomic_load/atomic_store, except with catalogMutex locked.
+     */
+    std::shared_ptr<const Catalog> inMemoryCSV = std::make_shared<Catalog>();
+
+    /**
+     * The version of the inMemoryCSV snapshot. Versions are unique across
+     * all SQLAir objects so that threads can cache the snapshot of the
+     * current version. See getCatalog().
+     */
+    std::atomic<size_t> catalogVersion = {0};
+
+    /**
+     * The dirty CSVs that have been evicted from inMemoryCSV. The key is the
+     * path or URL of the CSV.
+     */
+    std::unordered_map<std::string, SpilledCSV> spilledCSV;
+
+    /**
+     * The names of the columns with bitmap indexes in each CSV. The key is
+     * the path or URL of the CSV. The indexes are rebuilt when a CSV is
+     * reloaded.
      */
-    std::unordered_map<std::string, CSV> inMemoryCSV;
+    std::unordered_map<std::string, StrVec> bitmapIndexCols;
+
+    /**
+     * The names of the columns with full-text indexes in each CSV. The key
+     * is the path or URL of the CSV. The indexes are rebuilt when a CSV is
+     * reloaded.
+     */
+    std::unordered_map<std::string, StrVec> textIndexCols;
+
+    /**
+     * The names of the latitude and longitude columns with the spatial
+     * index of each CSV. The key is the path or URL of the CSV. The index
+     * is rebuilt when a CSV is reloaded.
+     */
+    std::unordered_map<std::string, StrVec> spatialIndexCols;
+
+    /** The memory budget (in bytes) for inMemoryCSV. Zero is unlimited. */
+    std::atomic<size_t> memoryBudget = {0};
+
+    /** Flag to indicate if per-block Bloom filters are to be built. */
+    std::atomic<bool> bloomFilters = {false};
+
+    /** Flag to indicate if low-cardinality columns are to be encoded. */
+    std::atomic<bool> dictionaryEncoding = {false};
+
+    /** The CSVs pinned in memory by the query run by the current thread. */
+    static thread_local std::vector<std::shared_ptr<CSV>> pinnedCSV;
+
+    /** Flag to indicate if the query run by the current thread is a "use"
+     * statement, which sets the recentCSV of the session. */
+    static thread_local bool usingCSV;
+
+    /** The CSVs locked exclusively by the commit in the current thread. */
+    static thread_local std::vector<const CSV*> committingCSV;
+
+    /** The functions to undo the writes applied so far by the commit in
+     * the current thread, in the order in which the writes were applied.
+     * They restore changed values, remove appended rows, and restore
+     * deleted rows. The auxiliary data must be rebuilt afterwards. */
+    static thread_local std::vector<std::function<void()>> undoLog;
 
     // -------------[ Limit number of threads ]-------------------
     /** The atomic counter that tracks the number of active threads.
@@ -430,6 +1687,14 @@ class SQLAir : public SQLAirBase {
      * clientThread method call notify.
      */
     std::condition_variable thrCond;
+
+    /** The mutex used with thrCond to wait for threads to finish. */
+    std::mutex thrMutex;
+
+    /** The maximum number of threads, including the threads used to run
+     * the statements of batches in parallel (see processBatch). It is set
+     * by runServer. Guarded by thrMutex. */
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
     // -----------------------------------------------------------
 };
 
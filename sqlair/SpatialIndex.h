@@ -0,0 +1,398 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+/**
+ * A spatial (grid) index on a pair of latitude and longitude columns in a
+ * CSV. The rows are placed in cells of CellSize x CellSize degrees based
+ * on their coordinates. Searches for rows within a distance of a point
+ * check just the cells that overlap the bounding box of the search circle
+ * and then compute the great-circle (haversine) distance of the rows in
+ * those cells.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ZoneMap.h"
+
+/**
+ * An MT-safe spatial index for one pair of latitude and longitude columns
+ * (in degrees). Rows whose coordinates are not valid numbers (or are out
+ * of range) are not indexed and are never found by searches.
+ *
+ * The coordinates of the rows in a cell are stored in arrays (in radians,
+ * along with the cosine of the latitude) rather than in the rows. So the
+ * distances of the rows in a cell are computed by a simple loop over the
+ * arrays that the compiler can vectorize.
+ */
+class SpatialIndex {
+public:
+    /** The mean radius of the Earth in kilometers. */
+    static constexpr double EarthRadius = 6371.0088;
+
+    /** The size of each cell of the grid, in degrees. */
+    static constexpr double CellSize = 1;
+
+    /** The rows found by a search and the distance (in km) of each row
+     * from the point being searched. */
+    using Results = std::vector<std::pair<size_t, double>>;
+
+    /**
+     * Determine if a condition in a where clause is checked using a spatial
+     * index.
+     *
+     * @param cond The condition, e.g., "=" or "nearest".
+     *
+     * @return This method returns true for "within_radius" and "nearest".
+     */
+    static bool handles(const std::string& cond) {
+        return cond == "within_radius" || cond == "nearest";
+    }
+
+    /**
+     * Create an empty index on a pair of columns.
+     *
+     * @param latCol The index of the latitude column.
+     *
+     * @param lonCol The index of the longitude column.
+     */
+    SpatialIndex(const int latCol, const int lonCol) :
+        latCol(latCol), lonCol(lonCol) {}
+
+    /**
+     * Obtain the index of the latitude column.
+     *
+     * @return The index of the latitude column.
+     */
+    int getLatColumn() const { return latCol; }
+
+    /**
+     * Obtain the index of the longitude column.
+     *
+     * @return The index of the longitude column.
+     */
+    int getLonColumn() const { return lonCol; }
+
+    /**
+     * Add the coordinates in a new row (for example, from a newly loaded
+     * or inserted row) to the index.
+     *
+     * @param rowIdx The zero-based index of the row.
+     *
+     * @param lat The value in the latitude column of the row.
+     *
+     * @param lon The value in the longitude column of the row.
+     */
+    void add(size_t rowIdx, const std::string& lat, const std::string& lon) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        insert(rowIdx, lat, lon);
+    }
+
+    /**
+     * Update the index when the latitude or longitude of a row is changed.
+     *
+     * @param rowIdx The zero-based index of the row being updated.
+     *
+     * @param lat The (new) value in the latitude column of the row.
+     *
+     * @param lon The (new) value in the longitude column of the row.
+     */
+    void update(size_t rowIdx, const std::string& lat,
+                const std::string& lon) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (rowIdx < rowCells.size() && rowCells[rowIdx] != NoCell) {
+            // Remove the row from its cell by moving the last entry in the
+            // cell into its place.
+            Cell& cell = cells[rowCells[rowIdx]];
+            const size_t pos = std::find(cell.rows.begin(), cell.rows.end(),
+                                         rowIdx) - cell.rows.begin();
+            cell.rows[pos] = cell.rows.back();
+            cell.lat[pos] = cell.lat.back();
+            cell.lon[pos] = cell.lon.back();
+            cell.cosLat[pos] = cell.cosLat.back();
+            cell.rows.pop_back();
+            cell.lat.pop_back();
+            cell.lon.pop_back();
+            cell.cosLat.pop_back();
+            rowCells[rowIdx] = NoCell;
+            numRows--;
+        }
+        insert(rowIdx, lat, lon);
+    }
+
+    /**
+     * Find the rows within a given distance of a point.
+     *
+     * @param lat The latitude of the point in degrees.
+     *
+     * @param lon The longitude of the point in degrees.
+     *
+     * @param km The distance from the point, in kilometers.
+     *
+     * @return The rows within the distance, in no particular order.
+     */
+    Results withinRadius(double lat, double lon, double km) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return search(lat, lon, km);
+    }
+
+    /**
+     * Find the k rows nearest to a point. The search radius starts small
+     * and grows until at least k rows are found.
+     *
+     * @param lat The latitude of the point in degrees.
+     *
+     * @param lon The longitude of the point in degrees.
+     *
+     * @param k The number of rows to be found.
+     *
+     * @return The k nearest rows (or all the rows, if there are fewer) in
+     * increasing order of distance.
+     */
+    Results nearest(double lat, double lon, size_t k) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        const double maxKm = M_PI * EarthRadius;
+        Results results;
+        for (double km = 50; ; km *= 4) {
+            results = search(lat, lon, std::min(km, maxKm));
+            if (results.size() >= k || km >= maxKm) {
+                break;
+            }
+        }
+        k = std::min(k, results.size());
+        std::partial_sort(results.begin(), results.begin() + k, results.end(),
+                          [](const auto& res1, const auto& res2) {
+                              return res1.second < res2.second ||
+                                  (res1.second == res2.second &&
+                                   res1.first < res2.first);
+                          });
+        results.resize(k);
+        return results;
+    }
+
+    /**
+     * Obtain the number of rows (with valid coordinates) in the index.
+     *
+     * @return The number of rows in the index.
+     */
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return numRows;
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this index.
+     *
+     * @return An estimate of the memory used by this index.
+     */
+    size_t memoryUsage() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        size_t bytes = sizeof(*this) + cells.bucket_count() * sizeof(void*) +
+            rowCells.capacity() * sizeof(int32_t);
+        for (const auto& entry : cells) {
+            bytes += sizeof(entry) + entry.second.rows.capacity() *
+                (sizeof(size_t) + 3 * sizeof(double));
+        }
+        return bytes;
+    }
+
+private:
+    /** The number of cells around each circle of latitude. */
+    static constexpr int LonCells = 360 / CellSize;
+
+    /** The number of cells from pole to pole. */
+    static constexpr int LatCells = 180 / CellSize;
+
+    /** The cell of rows that are not in the index. */
+    static constexpr int32_t NoCell = -1;
+
+    /** The rows in a cell and their coordinates, as parallel arrays. */
+    struct Cell {
+        /** The rows in the cell. */
+        std::vector<size_t> rows;
+        /** The latitude and longitude of each row, in radians. */
+        std::vector<double> lat, lon;
+        /** The cosine of the latitude of each row. */
+        std::vector<double> cosLat;
+    };
+
+    /**
+     * Obtain the cell with a given latitude and longitude.
+     *
+     * @param lat The latitude in degrees, in the range [-90, 90].
+     *
+     * @param lon The longitude in degrees, in the range [-180, 180].
+     *
+     * @return The number of the cell.
+     */
+    static int32_t cellOf(double lat, double lon) {
+        return cellOf(static_cast<int>(std::floor((lat + 90) / CellSize)),
+                      static_cast<int>(std::floor((lon + 180) / CellSize)));
+    }
+
+    /**
+     * Obtain the cell at a given row and column of the grid. The columns
+     * wrap around at the antimeridian.
+     *
+     * @param row The row of the grid, from the south pole. It is clamped
+     * to the valid rows.
+     *
+     * @param col The column of the grid, from the antimeridian.
+     *
+     * @return The number of the cell.
+     */
+    static int32_t cellOf(int row, int col) {
+        row = std::clamp(row, 0, LatCells - 1);
+        col = ((col % LonCells) + LonCells) % LonCells;
+        return row * LonCells + col;
+    }
+
+    /**
+     * Add the coordinates of a row to its cell.
+     *
+     * @note This method must be called with the mutex locked.
+     *
+     * @param rowIdx The row to be added.
+     *
+     * @param latStr The value in the latitude column of the row.
+     *
+     * @param lonStr The value in the longitude column of the row.
+     */
+    void insert(size_t rowIdx, const std::string& latStr,
+                const std::string& lonStr) {
+        if (rowIdx >= rowCells.size()) {
+            rowCells.resize(rowIdx + 1, NoCell);
+        }
+        double lat = 0, lon = 0;
+        if (!ZoneMap::toNumber(latStr, lat) || !ZoneMap::toNumber(lonStr, lon)
+            || !(std::abs(lat) <= 90) || !(std::abs(lon) <= 180)) {
+            return;  // Not a valid location
+        }
+        rowCells[rowIdx] = cellOf(lat, lon);
+        Cell& cell = cells[rowCells[rowIdx]];
+        cell.rows.push_back(rowIdx);
+        cell.lat.push_back(lat * M_PI / 180);
+        cell.lon.push_back(lon * M_PI / 180);
+        cell.cosLat.push_back(std::cos(lat * M_PI / 180));
+        numRows++;
+    }
+
+    /**
+     * Find the rows within a given distance of a point.
+     *
+     * @note This method must be called with the mutex locked.
+     *
+     * @return The rows within the distance. See withinRadius().
+     */
+    Results search(double lat, double lon, double km) const {
+        Results results;
+        if (!(std::abs(lat) <= 90) || !(std::abs(lon) <= 180) || !(km >= 0)) {
+            return results;
+        }
+        // The bounding box (in cells) of the circle. Circles including a
+        // pole span all longitudes.
+        const double radians = std::min(km / EarthRadius, M_PI);
+        const double latDelta = radians * 180 / M_PI;
+        const bool hasPole = (lat + latDelta >= 90 || lat - latDelta <= -90);
+        const double lonDelta = (hasPole ? 180 :
+                                 std::asin(std::min(1.0, std::sin(radians) /
+                                          std::cos(lat * M_PI / 180))) *
+                                 180 / M_PI);
+        const int minRow = std::floor((lat - latDelta + 90) / CellSize);
+        const int maxRow = std::floor((lat + latDelta + 90) / CellSize);
+        const int minCol = std::floor((lon - lonDelta + 180) / CellSize);
+        const int maxCol = std::min<int>(std::floor((lon + lonDelta + 180) /
+                                                    CellSize),
+                                         minCol + LonCells - 1);
+        // The rows within the distance have a haversine of the central
+        // angle of at most maxHav.
+        const double maxHav = std::pow(std::sin(radians / 2), 2);
+        const Point point{lat * M_PI / 180, lon * M_PI / 180,
+                          std::cos(lat * M_PI / 180)};
+        const size_t numCells = static_cast<size_t>(maxRow - minRow + 1) *
+            (maxCol - minCol + 1);
+        if (numCells > cells.size()) {
+            // Checking every non-empty cell is quicker than the box.
+            for (const auto& entry : cells) {
+                refine(entry.second, point, maxHav, results);
+            }
+            return results;
+        }
+        for (int row = std::max(minRow, 0);
+             row <= std::min(maxRow, LatCells - 1); row++) {
+            for (int col = minCol; col <= maxCol; col++) {
+                const auto cell = cells.find(cellOf(row, col));
+                if (cell != cells.end()) {
+                    refine(cell->second, point, maxHav, results);
+                }
+            }
+        }
+        return results;
+    }
+
+    /** A point being searched, in radians. */
+    struct Point {
+        double lat, lon, cosLat;
+    };
+
+    /**
+     * Add the rows in a cell that are within a distance of a point to the
+     * results. The haversine of the central angle between the point and
+     * each row is computed in a loop without branches, so that it can be
+     * vectorized. The distance (which needs an arcsine) is then computed
+     * just for the rows within the distance.
+     *
+     * @param cell The cell whose rows are to be checked.
+     *
+     * @param point The point being searched.
+     *
+     * @param maxHav The haversine of the central angle of the distance.
+     *
+     * @param[in,out] results The rows found so far.
+     */
+    static void refine(const Cell& cell, const Point& point,
+                       const double maxHav, Results& results) {
+        thread_local std::vector<double> hav;
+        const size_t size = cell.rows.size();
+        hav.resize(size);
+        const double* lat = cell.lat.data();
+        const double* lon = cell.lon.data();
+        const double* cosLat = cell.cosLat.data();
+        for (size_t i = 0; i < size; i++) {
+            const double sinLat = std::sin((lat[i] - point.lat) / 2);
+            const double sinLon = std::sin((lon[i] - point.lon) / 2);
+            hav[i] = sinLat * sinLat +
+                point.cosLat * cosLat[i] * sinLon * sinLon;
+        }
+        for (size_t i = 0; i < size; i++) {
+            if (hav[i] <= maxHav) {
+                const double angle = 2 * std::asin(std::sqrt(
+                                                   std::min(hav[i], 1.0)));
+                results.emplace_back(cell.rows[i], angle * EarthRadius);
+            }
+        }
+    }
+
+    /** The indexes of the latitude and longitude columns. */
+    const int latCol, lonCol;
+
+    /** The non-empty cells of the grid. */
+    std::unordered_map<int32_t, Cell> cells;
+
+    /** The cell of each row (or NoCell if the row is not in the index). */
+    std::vector<int32_t> rowCells;
+
+    /** The number of rows in the index. */
+    size_t numRows = 0;
+
+    /** Reader-writer lock to enable MT-safe access to the index. */
+    mutable std::shared_mutex mutex;
+};
+
+#endif /* SPATIAL_INDEX_H */
@@ -0,0 +1,90 @@
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+
+/**
+ * A simple bump (or arena) allocator for character data. Strings are copied
+ * into large chunks of memory and are referenced via std::string_view.
+ * Storing many strings this way needs only a handful of memory allocations
+ * and all of the memory is released at once when the arena is destroyed.
+ *
+ * The arena holds the distinct values of column dictionaries (see
+ * ColumnDictionary). The cells of CSV rows are not stored in an arena, as
+ * CSVRow (a vector of strings) is used by the code in libsqlair_lib.a
+ * (e.g., CSV::save() and SQLAirBase).
+ */
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * An arena for storing strings. Strings stored in the arena are never moved
+ * or freed until the arena is destroyed. Hence, the string_views returned by
+ * the store() method remain valid for the lifetime of the arena.
+ *
+ * @note This class is not MT-safe. Calls to store() must be serialized by
+ * the caller. However, multiple threads may read previously stored strings.
+ */
+class StringArena {
+public:
+    /**
+     * Create an empty arena.
+     *
+     * @param chunkSize The default size (in bytes) of each chunk of memory
+     * allocated by this arena. Strings longer than the chunk size are placed
+     * in a chunk of their own.
+     */
+    explicit StringArena(size_t chunkSize = 64 * 1024) :
+        chunkSize(chunkSize) {}
+
+    /**
+     * Copy a given string into this arena.
+     *
+     * @param str The string to be copied.
+     *
+     * @return A view of the copy of the string in this arena.
+     */
+    std::string_view store(std::string_view str) {
+        if (str.size() > remaining) {
+            const size_t size = std::max(chunkSize, str.size());
+            chunks.push_back(std::make_unique<char[]>(size));
+            next = chunks.back().get();
+            remaining = size;
+            allocated += size;
+        }
+        char* const dest = next;
+        std::copy(str.begin(), str.end(), dest);
+        next += str.size();
+        remaining -= str.size();
+        return std::string_view(dest, str.size());
+    }
+
+    /**
+     * Obtain the number of bytes of memory allocated by this arena.
+     *
+     * @return The number of bytes allocated by this arena.
+     */
+    size_t memoryUsage() const {
+        return sizeof(*this) + allocated +
+               chunks.capacity() * sizeof(chunks.front());
+    }
+
+private:
+    /** The default size of each chunk allocated by this arena. */
+    const size_t chunkSize;
+
+    /** The chunks of memory allocated by this arena. */
+    std::vector<std::unique_ptr<char[]>> chunks;
+
+    /** The next free byte in the current chunk. */
+    char* next = nullptr;
+
+    /** The number of bytes remaining in the current chunk. */
+    size_t remaining = 0;
+
+    /** The total number of bytes allocated in all chunks. */
+    size_t allocated = 0;
+};
+
+#endif /* STRING_ARENA_H */
@@ -0,0 +1,447 @@
+#ifndef TEXT_INDEX_H
+#define TEXT_INDEX_H
+
+/**
+ * A full-text (inverted) index for a text column in a CSV. The values in
+ * the column are split into terms (words) and the index maintains a list of
+ * the rows (a posting list) with each term. Searches for rows with all of
+ * a given set of terms intersect the posting lists and rank the rows using
+ * the Okapi BM25 scoring function.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * An MT-safe full-text index for one column. A term is a run of letters
+ * and digits (or non-ASCII bytes, so that UTF-8 words are not split) and
+ * terms are case-insensitive. For example, "Road to Guantanamo, The" has
+ * the terms "road", "to", "guantanamo", and "the".
+ *
+ * The posting list for a term is compressed: each posting is the gap from
+ * the previous row and the number of times the term occurs in the row,
+ * both as variable-length integers. The postings are in chunks of
+ * ChunkSize and the first row of each chunk is noted, so that intersecting
+ * a long list with a short one skips over the chunks without matches.
+ */
+class TextIndex {
+public:
+    /** The number of postings in each chunk of a posting list. */
+    static constexpr size_t ChunkSize = 128;
+
+    /** The rows with all the terms in a search and the score of each row.
+     * The rows are in increasing order. */
+    using Results = std::vector<std::pair<size_t, double>>;
+
+    /**
+     * Split a value into lower case terms.
+     *
+     * @param value The value to be split.
+     *
+     * @return The terms in the value in the order in which they occur.
+     */
+    static std::vector<std::string> tokenize(std::string_view value) {
+        std::vector<std::string> terms;
+        std::string term;
+        for (const char chr : value) {
+            const auto uchr = static_cast<unsigned char>(chr);
+            if (std::isalnum(uchr) || uchr >= 0x80) {
+                term += static_cast<char>(std::tolower(uchr));
+            } else if (!term.empty()) {
+                terms.push_back(std::move(term));
+                term.clear();
+            }
+        }
+        if (!term.empty()) {
+            terms.push_back(std::move(term));
+        }
+        return terms;
+    }
+
+    /**
+     * Add the value in a new row (for example, from a newly loaded or
+     * inserted row) to the index.
+     *
+     * @param rowIdx The zero-based index of the row with the value.
+     *
+     * @param value The value in this column in the row.
+     */
+    void add(size_t rowIdx, const std::string& value) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        insert(rowIdx, value);
+    }
+
+    /**
+     * Update the index when the value in a row is changed.
+     *
+     * @param rowIdx The zero-based index of the row being updated.
+     *
+     * @param oldValue The value in the row before it was updated.
+     *
+     * @param newValue The new value being set in the row.
+     */
+    void update(size_t rowIdx, const std::string& oldValue,
+                const std::string& newValue) {
+        if (oldValue == newValue) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (const auto& [term, freq] : countTerms(oldValue)) {
+            if (auto list = terms.find(term); list != terms.end()) {
+                list->second.remove(rowIdx);
+                if (list->second.count == 0) {
+                    terms.erase(list);
+                }
+                totalLength -= freq;
+            }
+        }
+        insert(rowIdx, newValue);
+    }
+
+    /**
+     * Find the rows whose values have all the terms in a search string and
+     * score the rows using BM25. Rows with rarer terms (and shorter values)
+     * score higher.
+     *
+     * @param search The search string, e.g., "international airport".
+     *
+     * @return The matching rows and their scores. If the search string
+     * does not have any terms, then no rows are returned.
+     */
+    Results search(const std::string& search) const {
+        const auto queryTerms = countTerms(search);
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        std::vector<Cursor> cursors;
+        for (const auto& entry : queryTerms) {
+            const auto list = terms.find(entry.first);
+            if (list == terms.end()) {
+                return {};  // No row has this term
+            }
+            cursors.emplace_back(list->second);
+        }
+        // Drive the intersection from the shortest list.
+        std::sort(cursors.begin(), cursors.end(),
+                  [](const Cursor& c1, const Cursor& c2) {
+                      return c1.size() < c2.size();
+                  });
+        const double numDocs = docLengths.size();
+        const double avgLength = totalLength / std::max(numDocs, 1.0);
+        std::vector<double> idf;
+        for (const auto& cursor : cursors) {
+            idf.push_back(std::log(1 + (numDocs - cursor.size() + 0.5) /
+                                   (cursor.size() + 0.5)));
+        }
+        Results results;
+        while (!cursors.empty() && cursors[0].valid()) {
+            const size_t rowIdx = cursors[0].row;
+            size_t i = 1;
+            while (i < cursors.size() && cursors[i].seek(rowIdx) &&
+                   cursors[i].row == rowIdx) {
+                i++;
+            }
+            if (i < cursors.size()) {
+                if (!cursors[i].valid()) {
+                    break;  // No more rows with the term
+                }
+                // Skip to the next row that may have all the terms.
+                cursors[0].seek(cursors[i].row);
+                continue;
+            }
+            const double norm = K1 * (1 - B + B * docLengths[rowIdx] /
+                                      avgLength);
+            double score = 0;
+            for (size_t t = 0; t < cursors.size(); t++) {
+                score += idf[t] * cursors[t].freq * (K1 + 1) /
+                    (cursors[t].freq + norm);
+            }
+            results.emplace_back(rowIdx, score);
+            cursors[0].next();
+        }
+        return results;
+    }
+
+    /**
+     * Obtain the number of distinct terms in the index.
+     *
+     * @return The number of distinct terms.
+     */
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return terms.size();
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this index.
+     *
+     * @return An estimate of the memory used by this index.
+     */
+    size_t memoryUsage() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        size_t bytes = sizeof(*this) + terms.bucket_count() * sizeof(void*) +
+            docLengths.capacity() * sizeof(uint32_t);
+        for (const auto& entry : terms) {
+            bytes += sizeof(entry) + entry.first.capacity() +
+                entry.second.bytes.capacity() +
+                entry.second.chunks.capacity() * sizeof(Chunk);
+        }
+        return bytes;
+    }
+
+private:
+    /** The BM25 parameters for the saturation of term frequencies (K1)
+     * and the normalization of value lengths (B). */
+    static constexpr double K1 = 1.2, B = 0.75;
+
+    /** The first row and the offset (in bytes) of a chunk of postings. */
+    using Chunk = std::pair<size_t, size_t>;
+
+    /**
+     * A compressed posting list. The gap of the first posting in each
+     * chunk is from row 0 so that decoding can start at any chunk.
+     */
+    struct Postings {
+        /** The (row gap, frequency) pairs as variable-length integers. */
+        std::vector<uint8_t> bytes;
+        /** The first row and byte offset of each chunk. */
+        std::vector<Chunk> chunks;
+        /** The number of postings in the list. */
+        size_t count = 0;
+        /** The row in the last posting in the list. */
+        size_t lastRow = 0;
+
+        /**
+         * Append a posting to the list. The row must be after the last row
+         * in the list.
+         *
+         * @param rowIdx The row with the term.
+         *
+         * @param freq The number of times the term occurs in the row.
+         */
+        void append(size_t rowIdx, size_t freq) {
+            size_t gap = rowIdx - lastRow;
+            if (count % ChunkSize == 0) {
+                chunks.emplace_back(rowIdx, bytes.size());
+                gap = rowIdx;
+            }
+            putVarInt(gap);
+            putVarInt(freq);
+            lastRow = rowIdx;
+            count++;
+        }
+
+        /**
+         * Insert a posting (or replace the posting for the row) anywhere in
+         * the list. The list is re-encoded. So rows are added in increasing
+         * order via append() whenever possible.
+         *
+         * @param rowIdx The row with the term.
+         *
+         * @param freq The number of times the term occurs in the row. The
+         * posting for the row is removed if this is zero.
+         */
+        void set(size_t rowIdx, size_t freq) {
+            std::vector<std::pair<size_t, size_t>> postings;
+            for (Cursor cursor(*this); cursor.valid(); cursor.next()) {
+                if (cursor.row != rowIdx) {
+                    postings.emplace_back(cursor.row, cursor.freq);
+                }
+            }
+            if (freq > 0) {
+                postings.insert(std::lower_bound(postings.begin(),
+                                                 postings.end(),
+                                                 std::make_pair(rowIdx,
+                                                                freq)),
+                                {rowIdx, freq});
+            }
+            *this = Postings();
+            for (const auto& [row, rowFreq] : postings) {
+                append(row, rowFreq);
+            }
+        }
+
+        /**
+         * Remove the posting for a row from the list.
+         *
+         * @param rowIdx The row to be removed.
+         */
+        void remove(size_t rowIdx) { set(rowIdx, 0); }
+
+        /**
+         * Encode a number as a variable-length integer (7 bits per byte)
+         * at the end of the list.
+         *
+         * @param value The value to be encoded.
+         */
+        void putVarInt(size_t value) {
+            for (; value >= 0x80; value >>= 7) {
+                bytes.push_back(static_cast<uint8_t>(value | 0x80));
+            }
+            bytes.push_back(static_cast<uint8_t>(value));
+        }
+    };
+
+    /**
+     * A cursor that decodes the postings in a list in order. Cursors are
+     * used only while the index is locked.
+     */
+    class Cursor {
+    public:
+        /** The row and frequency of the current posting. */
+        size_t row = 0, freq = 0;
+
+        /**
+         * Create a cursor at the first posting in a list.
+         *
+         * @param list The posting list to be decoded.
+         */
+        explicit Cursor(const Postings& list) : list(&list) { next(); }
+
+        /**
+         * Check if the cursor is at a posting (i.e., not past the end).
+         *
+         * @return This method returns true if row and freq are valid.
+         */
+        bool valid() const { return index <= list->count; }
+
+        /**
+         * Obtain the number of postings in the list.
+         *
+         * @return The number of postings in the list.
+         */
+        size_t size() const { return list->count; }
+
+        /**
+         * Advance to the next posting, if any.
+         */
+        void next() {
+            if (index++ >= list->count) {
+                return;  // Past the end
+            }
+            // The gap of the first posting in a chunk is from row 0.
+            row = ((index - 1) % ChunkSize == 0 ? 0 : row) + getVarInt();
+            freq = getVarInt();
+        }
+
+        /**
+         * Advance to the first posting at or after a given row. Chunks that
+         * end before the row are skipped without being decoded.
+         *
+         * @param target The row to be found.
+         *
+         * @return This method returns true if the cursor is at a posting.
+         */
+        bool seek(size_t target) {
+            if (!valid() || row >= target) {
+                return valid();
+            }
+            // The last chunk starting at or before the target.
+            const auto& chunks = list->chunks;
+            const size_t chunk = std::upper_bound(
+                chunks.begin(), chunks.end(), Chunk{target, SIZE_MAX}) -
+                chunks.begin() - 1;
+            if (chunk > (index - 1) / ChunkSize) {
+                offset = chunks[chunk].second;
+                index = chunk * ChunkSize;
+                next();
+            }
+            while (valid() && row < target) {
+                next();
+            }
+            return valid();
+        }
+
+    private:
+        /**
+         * Decode a variable-length integer at the current offset.
+         *
+         * @return The decoded value.
+         */
+        size_t getVarInt() {
+            size_t value = 0;
+            for (int shift = 0; ; shift += 7) {
+                const uint8_t byte = list->bytes[offset++];
+                value |= static_cast<size_t>(byte & 0x7F) << shift;
+                if (byte < 0x80) {
+                    return value;
+                }
+            }
+        }
+
+        /** The list being decoded. */
+        const Postings* list;
+        /** The offset of the next posting in the encoded list. */
+        size_t offset = 0;
+        /** The 1-based index of the current posting. */
+        size_t index = 0;
+    };
+
+    /**
+     * Count the number of times each term occurs in a value.
+     *
+     * @param value The value to be split into terms.
+     *
+     * @return Each distinct term and its frequency, sorted by term.
+     */
+    static std::vector<std::pair<std::string, size_t>>
+    countTerms(std::string_view value) {
+        auto terms = tokenize(value);
+        std::sort(terms.begin(), terms.end());
+        std::vector<std::pair<std::string, size_t>> counts;
+        for (auto& term : terms) {
+            if (counts.empty() || counts.back().first != term) {
+                counts.emplace_back(std::move(term), 0);
+            }
+            counts.back().second++;
+        }
+        return counts;
+    }
+
+    /**
+     * Add the terms in the value of a row to the posting lists.
+     *
+     * @note This method must be called with the mutex locked.
+     *
+     * @param rowIdx The row with the value.
+     *
+     * @param value The value to be indexed.
+     */
+    void insert(size_t rowIdx, const std::string& value) {
+        if (rowIdx >= docLengths.size()) {
+            docLengths.resize(rowIdx + 1);
+        }
+        docLengths[rowIdx] = 0;
+        for (auto& [term, freq] : countTerms(value)) {
+            Postings& list = terms[term];
+            if (list.count == 0 || rowIdx > list.lastRow) {
+                list.append(rowIdx, freq);
+            } else {
+                list.set(rowIdx, freq);
+            }
+            docLengths[rowIdx] += freq;
+            totalLength += freq;
+        }
+    }
+
+    /** The posting list for each term. */
+    std::unordered_map<std::string, Postings> terms;
+
+    /** The number of terms in the value of each row. */
+    std::vector<uint32_t> docLengths;
+
+    /** The total number of terms in all the rows. */
+    size_t totalLength = 0;
+
+    /** Reader-writer lock to enable MT-safe access to the index. */
+    mutable std::shared_mutex mutex;
+};
+
+#endif /* TEXT_INDEX_H */
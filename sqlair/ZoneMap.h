@@ -0,0 +1,200 @@
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+/**
+ * Zone maps record summary information (minimum and maximum values and the
+ * number of empty values) for fixed-size blocks of rows in a column of a
+ * CSV. Scans use the summaries to skip blocks of rows that cannot satisfy
+ * the condition in a "where" clause.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The zone map for one column in a CSV. Empty values are treated as nulls.
+ * For each block of rows, the zone map tracks the lexicographic minimum and
+ * maximum of the non-empty values. If all the non-empty values in a block
+ * are numbers, then the numeric minimum and maximum are also tracked (as
+ * lexicographic order does not work well for numbers).
+ *
+ * @note The ranges in a zone map are only widened when values are updated.
+ * Hence, they are conservative (but never incorrect) until rebuilt.
+ */
+class ZoneMap {
+public:
+    /** The number of rows in each block. */
+    static constexpr size_t BlockSize = 1024;
+
+    /**
+     * Add information about a new value (for example, from a newly loaded or
+     * inserted row) to the zone map.
+     *
+     * @param rowIdx The zero-based index of the row with the value.
+     *
+     * @param value The value in this column in the row.
+     */
+    void add(size_t rowIdx, const std::string& value) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (rowIdx / BlockSize >= zones.size()) {
+            zones.resize(rowIdx / BlockSize + 1);
+        }
+        Zone& zone = zones[rowIdx / BlockSize];
+        zone.numRows++;
+        include(zone, value);
+    }
+
+    /**
+     * Update the zone map when the same value is set in some rows of a
+     * block. The zone is locked and widened just once for all the rows.
+     *
+     * @param block The zero-based index of the block with the rows.
+     *
+     * @param numRows The number of rows in the block being updated.
+     *
+     * @param numOldNulls The number of these rows whose value (before the
+     * update) was empty.
+     *
+     * @param newValue The new value being set in the rows.
+     */
+    void update(size_t block, size_t numRows, size_t numOldNulls,
+                const std::string& newValue) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (block < zones.size() && numRows > 0) {
+            Zone& zone = zones[block];
+            zone.numNulls -= numOldNulls;
+            include(zone, newValue);
+            zone.numNulls += (newValue.empty() ? numRows - 1 : 0);
+        }
+    }
+
+    /**
+     * Determine which blocks may have rows that satisfy a given condition.
+     *
+     * @param cond The condition to be checked. E.g., "=", "<>", or "like".
+     * Blocks are not skipped for other conditions (e.g., "regexp").
+     *
+     * @param value The value specified by the user in the where clause.
+     *
+     * @return A flag for each block indicating if the block may have rows
+     * that satisfy the condition. Rows in blocks added after this call
+     * may satisfy the condition.
+     */
+    std::vector<bool> mayMatch(const std::string& cond,
+                               const std::string& value) const {
+        double number = 0;
+        const bool isNumber = toNumber(value, number);
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        std::vector<bool> blocks(zones.size(), true);
+        for (size_t i = 0; i < zones.size(); i++) {
+            const Zone& zone = zones[i];
+            const bool allNull = (zone.numNulls == zone.numRows);
+            if (cond == "=") {
+                blocks[i] = (value.empty() ? zone.numNulls > 0 :
+                             !allNull && zone.min <= value &&
+                             value <= zone.max &&
+                             (!isNumber || !zone.isNumeric ||
+                              (zone.numMin <= number &&
+                               number <= zone.numMax)));
+            } else if (cond == "<>") {
+                blocks[i] = (value.empty() ? !allNull :
+                             zone.numNulls > 0 || zone.min != value ||
+                             zone.max != value);
+            } else if (cond == "like" || cond == "ilike") {
+                blocks[i] = (value.empty() || !allNull);
+            }
+        }
+        return blocks;
+    }
+
+    /**
+     * Obtain an estimate of the number of bytes used by this zone map.
+     *
+     * @return An estimate of the memory used by this zone map.
+     */
+    size_t memoryUsage() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        size_t bytes = sizeof(*this) + zones.capacity() * sizeof(Zone);
+        for (const auto& zone : zones) {
+            bytes += zone.min.capacity() + zone.max.capacity();
+        }
+        return bytes;
+    }
+
+    /**
+     * Convenience method to convert a string to a finite number.
+     *
+     * @param str The string to be converted.
+     *
+     * @param[out] number The number, if the string is a number.
+     *
+     * @return This method returns true if the whole string is a number.
+     */
+    static bool toNumber(const std::string& str, double& number) {
+        if (str.empty()) {
+            return false;
+        }
+        char* end = nullptr;
+        number = std::strtod(str.c_str(), &end);
+        return *end == '\0' && std::isfinite(number);
+    }
+
+private:
+    /** The summary information for one block of rows. */
+    struct Zone {
+        /** The number of rows in this block. */
+        size_t numRows = 0;
+        /** The number of rows with empty values in this block. */
+        size_t numNulls = 0;
+        /** The lexicographic minimum of the non-empty values. */
+        std::string min;
+        /** The lexicographic maximum of the non-empty values. */
+        std::string max;
+        /** Flag to indicate all the non-empty values are numbers. */
+        bool isNumeric = true;
+        /** The numeric minimum (valid if isNumeric is true). */
+        double numMin = HUGE_VAL;
+        /** The numeric maximum (valid if isNumeric is true). */
+        double numMax = -HUGE_VAL;
+    };
+
+    /**
+     * Helper method to widen the ranges in a zone to include a given value.
+     *
+     * @param zone The zone to be updated.
+     *
+     * @param value The value to be included in the zone.
+     */
+    static void include(Zone& zone, const std::string& value) {
+        if (value.empty()) {
+            zone.numNulls++;
+            return;
+        }
+        if (zone.min.empty() || value < zone.min) {
+            zone.min = value;
+        }
+        if (value > zone.max) {
+            zone.max = value;
+        }
+        double number = 0;
+        if (zone.isNumeric && toNumber(value, number)) {
+            zone.numMin = std::min(zone.numMin, number);
+            zone.numMax = std::max(zone.numMax, number);
+        } else {
+            zone.isNumeric = false;
+        }
+    }
+
+    /** The summary information for each block of rows. */
+    std::vector<Zone> zones;
+
+    /** Reader-writer lock to enable MT-safe access to the zones. */
+    mutable std::shared_mutex mutex;
+};
+
+#endif /* ZONE_MAP_H */
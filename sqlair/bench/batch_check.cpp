@@ -0,0 +1,186 @@
+/**
+ * A check of the framing of the results of batches of statements (see
+ * SQLAir::processBatch) and of transactions spanning the statements of a
+ * batch. The mt_tester test files only send single queries (via GET
+ * requests, each in its own session), so batches (sent via POST requests
+ * to /sql-air/batch) are checked here by calling processBatch in-process.
+ * Each batch is run sequentially and in parallel and its output must be:
+ *
+ *     --- <n> <ok|error> <length>
+ *     <exactly length bytes of output of the n-th statement>
+ *
+ * for each statement in the batch, in the order of the statements.
+ *
+ * Build (from the sqlair directory) with:
+ *
+ *   g++ -std=c++17 -O2 -Wall -I. -o batch_check bench/batch_check.cpp \
+ *       SQLAir.cpp libsqlair_lib.a -lboost_system -lpthread
+ *
+ * Usage:
+ *
+ *   ./batch_check
+ *
+ * The exit code is 1 if any check fails.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "SQLAir.h"
+
+namespace {
+
+/** The result of one statement in the output of a batch. */
+struct Result {
+    /** The status of the statement ("ok" or "error"). */
+    std::string status;
+    /** The output of the statement. */
+    std::string output;
+};
+
+/**
+ * Parses the framed output of a batch.
+ *
+ * @param resp The output of processBatch.
+ *
+ * @return The results of the statements, in the order of the headers.
+ *
+ * @exception std::runtime_error If the output is not framed correctly
+ * (e.g., a statement number is out of order or a length is wrong).
+ */
+std::vector<Result> parseFrames(const std::string& resp) {
+    std::vector<Result> results;
+    for (size_t pos = 0; pos < resp.size();) {
+        const size_t eol = resp.find('\n', pos);
+        std::istringstream hdr(resp.substr(pos, eol - pos));
+        std::string dashes, status;
+        size_t num = 0, len = 0;
+        if (eol == std::string::npos || !(hdr >> dashes >> num >> status >>
+                                          len) || dashes != "---" ||
+            num != results.size() + 1 || eol + 1 + len > resp.size()) {
+            throw std::runtime_error("Invalid header at offset " +
+                                     std::to_string(pos));
+        }
+        results.push_back({status, resp.substr(eol + 1, len)});
+        pos = eol + 1 + len;
+    }
+    return results;
+}
+
+/**
+ * Runs a batch, both sequentially and in parallel, and checks its output.
+ *
+ * @param air The SQLAir instance to run the batch.
+ *
+ * @param batch The statements in the batch.
+ *
+ * @param expected The expected status and output of each statement.
+ *
+ * @return True if the check passed.
+ */
+bool checkBatch(SQLAir& air, const std::string& batch,
+                const std::vector<Result>& expected) {
+    bool passed = true;
+    for (const bool parallel : {false, true}) {
+        std::ostringstream os;
+        air.processBatch(batch, parallel, os);
+        std::string error;
+        try {
+            const std::vector<Result> results = parseFrames(os.str());
+            for (size_t i = 0; i < std::max(results.size(), expected.size());
+                 i++) {
+                if (i >= results.size() || i >= expected.size() ||
+                    results[i].status != expected[i].status ||
+                    results[i].output != expected[i].output) {
+                    error = "Mismatch in statement " + std::to_string(i + 1);
+                    break;
+                }
+            }
+        } catch (const std::exception& exp) {
+            error = exp.what();
+        }
+        if (!error.empty()) {
+            std::cout << "FAIL (" << (parallel ? "parallel" : "sequential")
+                      << "): " << error << "\nBatch:\n" << batch
+                      << "\nOutput:\n" << os.str() << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+}  // namespace
+
+int main() {
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string one = (dir / "sqlair_batch_one.csv").string();
+    const std::string two = (dir / "sqlair_batch_two.csv").string();
+    for (const auto& path : {one, two}) {
+        std::ofstream csv(path);
+        csv << "key,val\nk1,1\nk2,2\n";
+    }
+    SQLAir air;
+    bool passed = true;
+    // Statements are split on semicolons and newlines (but not in quoted
+    // values), blank statements are skipped, and errors are framed too.
+    passed = checkBatch(air,
+        "select val from " + one + " where key = k1;\n\n"
+        "select bogus from " + one + "; select key from " + one +
+        " where key = 'k1;k2'\n",
+        {{"ok", "val\n1\n1 row(s) selected.\n"},
+         {"error", "Error: Column bogus not found in CSV\n"},
+         {"ok", "0 row(s) selected.\n"}}) && passed;
+    // Statements on different CSVs may run concurrently, but the results
+    // are in the order of the statements and each CSV sees its statements
+    // in order.
+    passed = checkBatch(air,
+        "update " + one + " set val = 10 where key = k1;"
+        "update " + two + " set val = 20 where key = k2;"
+        "select val from " + one + " where key = k1;"
+        "select val from " + two + " where key = k2;"
+        "update " + one + " set val = 1 where key = k1;"
+        "update " + two + " set val = 2 where key = k2",
+        {{"ok", "1 row(s) updated.\n"}, {"ok", "1 row(s) updated.\n"},
+         {"ok", "val\n10\n1 row(s) selected.\n"},
+         {"ok", "val\n20\n1 row(s) selected.\n"},
+         {"ok", "1 row(s) updated.\n"}, {"ok", "1 row(s) updated.\n"}}) &&
+        passed;
+    // An empty batch has no results.
+    passed = checkBatch(air, " ;\n;", {}) && passed;
+    // The statements of a batch are run in one session. So a transaction
+    // can span the statements of a batch. Its writes are deferred until
+    // commit and its queries read the committed data.
+    passed = checkBatch(air,
+        "begin; begin transaction;"
+        "update " + one + " set val = 9 where key = k1;"
+        "select val from " + one + " where key = k1;"
+        "wait select val from " + one + " where key = k1;"
+        "commit; select val from " + one + " where key = k1;"
+        "update " + one + " set val = 1 where key = k1",
+        {{"ok", "Transaction started.\n"},
+         {"error", "Error: A transaction is already in progress\n"},
+         {"ok", "Deferred until commit.\n"},
+         {"ok", "val\n1\n1 row(s) selected.\n"},
+         {"error", "Error: Wait cannot be used in a transaction\n"},
+         {"ok", "1 row(s) updated.\nTransaction committed.\n"},
+         {"ok", "val\n9\n1 row(s) selected.\n"},
+         {"ok", "1 row(s) updated.\n"}}) && passed;
+    // Rolling back a transaction discards its deferred writes.
+    passed = checkBatch(air,
+        "begin transaction; delete from " + one + " where key = k1;"
+        "rollback; select count(*) from " + one + "; commit",
+        {{"ok", "Transaction started.\n"},
+         {"ok", "Deferred until commit.\n"},
+         {"ok", "Transaction rolled back.\n"},
+         {"ok", "count(*)\n2\n1 row(s) selected.\n"},
+         {"error", "Error: No transaction in progress\n"}}) && passed;
+    std::filesystem::remove(one);
+    std::filesystem::remove(two);
+    std::cout << (passed ? "All checks passed." : "Some checks failed.")
+              << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,473 @@
+/**
+ * A generator of synthetic CSVs with the same schemas as airports.csv and
+ * movies_db_20.csv (and test.csv), for testing and benchmarking SQLAir at
+ * scale (e.g., 1M to 100M rows). The values follow configurable
+ * distributions:
+ *
+ *   - Key-like columns (e.g., country, city, genres, year) are drawn from
+ *     pools of distinct values with a Zipf distribution, so a few values
+ *     are very common and most are rare. A skew of 0 is uniform.
+ *
+ *   - Low-cardinality columns (e.g., country, dst, genres) have a
+ *     configurable number of distinct values.
+ *
+ *   - A fraction of the names/titles are long strings and a fraction have
+ *     commas (e.g., "Road to Guantanamo, The"), which must be quoted.
+ *
+ * The output is the same for a given seed and options.
+ *
+ * Build (from the sqlair directory) with:
+ *
+ *   g++ -std=c++17 -O2 -Wall -o csv_gen bench/csv_gen.cpp
+ *
+ * Usage:
+ *
+ *   ./csv_gen {airports|movies} <rows> [--seed <n>] [--skew <s>]
+ *             [--cardinality <n>] [--long <fraction>] [--long-length <n>]
+ *             [--commas <fraction>] [--quote-all] [-o <file>]
+ *
+ * For example, "./csv_gen airports 10000000 --skew 1.2 -o /tmp/big.csv".
+ * Without -o the CSV is written to standard output.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+/** The options for generating a CSV, from the command-line. */
+struct Options {
+    /** The schema: "airports" or "movies". */
+    std::string schema;
+    /** The number of rows to be generated. */
+    size_t rows = 0;
+    /** The seed for the random number generator. */
+    uint64_t seed = 1;
+    /** The exponent of the Zipf distribution of key-like columns. */
+    double skew = 1;
+    /** The number of distinct values in low-cardinality columns (e.g.,
+     * countries or combinations of genres). */
+    size_t cardinality = 200;
+    /** The fraction of names or titles that are long strings. */
+    double longFraction = 0.01;
+    /** The length of long strings. */
+    size_t longLength = 512;
+    /** The fraction of names or titles with a comma. */
+    double commaFraction = 0.05;
+    /** Flag to indicate if every value is quoted (as in test.csv). */
+    bool quoteAll = false;
+    /** The output file. Empty for standard output. */
+    std::string outFile;
+};
+
+/**
+ * Sampler for a Zipf distribution over the ranks 0 to n - 1, where rank k
+ * has a probability proportional to 1 / (k + 1)^s.
+ */
+class Zipf {
+public:
+    /**
+     * Create the sampler by computing the cumulative distribution.
+     *
+     * @param n The number of ranks.
+     *
+     * @param s The exponent. Zero is a uniform distribution.
+     */
+    Zipf(size_t n, double s) : cdf(std::max<size_t>(n, 1)) {
+        double sum = 0;
+        for (size_t k = 0; k < cdf.size(); k++) {
+            cdf[k] = (sum += 1 / std::pow(k + 1, s));
+        }
+        for (double& prob : cdf) {
+            prob /= sum;
+        }
+    }
+
+    /**
+     * Draw a rank.
+     *
+     * @param rng The random number generator to be used.
+     *
+     * @return A rank in the range [0, n).
+     */
+    size_t operator()(std::mt19937_64& rng) const {
+        const double u = std::uniform_real_distribution<>(0, 1)(rng);
+        return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) -
+                                cdf.begin(), cdf.size() - 1);
+    }
+
+private:
+    /** The cumulative probability of each rank. */
+    std::vector<double> cdf;
+};
+
+/**
+ * Generates the rows of a CSV into a buffer that is written out in large
+ * chunks, as the CSVs may be many gigabytes.
+ */
+class Generator {
+public:
+    /**
+     * Create the generator, including the pools of words and values.
+     *
+     * @param opts The options for generating the CSV.
+     */
+    explicit Generator(const Options& opts) :
+        opts(opts), rng(opts.seed), words(makePool(4096, 2, 3)),
+        wordZipf(words.size(), opts.skew),
+        keys(makePool(opts.cardinality, 2, 4)),
+        keyZipf(keys.size(), opts.skew),
+        cities(makePool(std::clamp<size_t>(opts.rows / 8, 16, 1 << 20), 2,
+                        3)),
+        cityZipf(cities.size(), opts.skew),
+        yearZipf(120, opts.skew) {
+        out = (opts.outFile.empty() ? stdout :
+               std::fopen(opts.outFile.c_str(), "w"));
+        if (out == nullptr) {
+            throw std::runtime_error("Unable to write " + opts.outFile);
+        }
+        buffer.reserve(BufferSize + 4096);
+    }
+
+    /** Flush the buffer and close the output file. */
+    ~Generator() {
+        flush();
+        if (out != stdout) {
+            std::fclose(out);
+        }
+    }
+
+    /** Generate the header and all the rows of the CSV. */
+    void run() {
+        if (opts.schema == "airports") {
+            header({"id", "name", "city", "country", "iata", "icao",
+                    "latitude", "longitude", "altitude", "utz", "dst",
+                    "timezone"});
+            for (size_t row = 0; row < opts.rows; row++) {
+                airport(row);
+            }
+        } else {
+            header({"movieid", "title", "year", "genres", "imdbid", "rating",
+                    "raters"});
+            for (size_t row = 0; row < opts.rows; row++) {
+                movie(row);
+            }
+        }
+    }
+
+private:
+    /** The size of the output buffer before it is written out. */
+    static constexpr size_t BufferSize = 1 << 20;
+
+    /**
+     * Generate a row of the airports schema.
+     *
+     * @param row The zero-based index of the row.
+     */
+    void airport(size_t row) {
+        number(row + 1);
+        text(name(" Airport"));
+        text(cities[cityZipf(rng)]);
+        text(keys[keyZipf(rng)]);
+        text(code(3));
+        text(code(4));
+        const double lon = uniform(-180, 180);
+        decimal(uniform(-60, 75), 10);
+        decimal(lon, 10);
+        number(static_cast<size_t>(uniform(0, 10000)));
+        number(static_cast<int>(std::lround(lon / 15)));
+        text(std::string(1, "EASOZNU"[keyZipf(rng) % 7]));
+        text("Zone/" + cities[cityZipf(rng) % 512]);
+        endRow();
+    }
+
+    /**
+     * Generate a row of the movies schema.
+     *
+     * @param row The zero-based index of the row.
+     */
+    void movie(size_t row) {
+        static const char* Genres[] = {
+            "Drama", "Comedy", "Thriller", "Action", "Romance", "Adventure",
+            "Crime", "Sci-Fi", "Horror", "Fantasy", "Children", "Animation",
+            "Mystery", "Documentary", "War", "Musical", "Western", "IMAX",
+            "Film-Noir", "(no genres listed)"};
+        number(row * 3 + 1 + rng() % 3);  // Unique, with gaps
+        text(name(""));
+        number(2020 - yearZipf(rng));
+        // The combination of genres is a low-cardinality value: the key
+        // picks the combination.
+        const size_t key = keyZipf(rng);
+        std::string genres = Genres[key % 20];
+        for (size_t combo = key / 20, i = 1; combo > 0 && i < 4;
+             combo /= 20, i++) {
+            genres += std::string("|") + Genres[(key + combo) % 20];
+        }
+        text(genres);
+        number(100000 + rng() % 9000000);
+        decimal(std::round(uniform(0.5, 5) * 8) / 8, 4);
+        // Most movies have few raters, a few have very many.
+        number(static_cast<size_t>(std::min(std::pow(1 - uniform(0, 1), -1.5),
+                                            1e6)));
+        endRow();
+    }
+
+    /**
+     * Write the header of the CSV.
+     *
+     * @param names The names of the columns.
+     */
+    void header(const std::vector<std::string>& names) {
+        for (const auto& colName : names) {
+            text(colName);
+        }
+        endRow();
+    }
+
+    /**
+     * Generate a name or title: a few words, optionally a long string or
+     * with a comma.
+     *
+     * @param suffix The suffix for the name (e.g., " Airport").
+     *
+     * @return The name.
+     */
+    std::string name(const std::string& suffix) {
+        std::string str = words[wordZipf(rng)];
+        for (size_t i = rng() % 3; i > 0; i--) {
+            str += ' ' + words[wordZipf(rng)];
+        }
+        if (uniform(0, 1) < opts.longFraction) {
+            while (str.size() < opts.longLength) {
+                str += ' ' + words[wordZipf(rng)];
+            }
+        }
+        str += suffix;
+        if (uniform(0, 1) < opts.commaFraction) {
+            str += ", " + words[wordZipf(rng)];
+        }
+        return str;
+    }
+
+    /**
+     * Generate a code of upper case letters, e.g., an IATA code.
+     *
+     * @param len The length of the code.
+     *
+     * @return The code.
+     */
+    std::string code(size_t len) {
+        std::string str(len, 'A');
+        for (char& chr : str) {
+            chr += rng() % 26;
+        }
+        return str;
+    }
+
+    /**
+     * Make a pool of distinct capitalized pseudo-words from syllables.
+     *
+     * @param size The number of words in the pool.
+     *
+     * @param minSyl The minimum number of syllables in a word.
+     *
+     * @param maxSyl The maximum number of syllables in a word.
+     *
+     * @return The words in the pool.
+     */
+    std::vector<std::string> makePool(size_t size, size_t minSyl,
+                                      size_t maxSyl) {
+        static const char* Syllables[] = {
+            "ka", "lo", "mi", "ra", "ten", "sa", "vor", "el", "an", "tu",
+            "ber", "go", "na", "ri", "ston", "dal", "mo", "ve", "qu", "ix",
+            "port", "ham", "by", "field", "ley", "wick", "ton", "burg"};
+        const size_t numSyl = std::size(Syllables);
+        std::vector<std::string> pool;
+        std::unordered_set<std::string> seen;
+        for (size_t i = 0; pool.size() < size; i++) {
+            // The digits of the index (in base numSyl) pick the syllables,
+            // with the rest of the index as a suffix.
+            std::string word;
+            size_t idx = i;
+            for (size_t syl = 0; syl < minSyl || (idx > 0 && syl < maxSyl);
+                 syl++, idx /= numSyl) {
+                word += Syllables[idx % numSyl];
+            }
+            word[0] = std::toupper(word[0]);
+            word += (idx > 0 ? std::to_string(idx) : "");
+            if (seen.insert(word).second) {
+                pool.push_back(word);
+            }
+        }
+        std::shuffle(pool.begin(), pool.end(), rng);
+        return pool;
+    }
+
+    /**
+     * Draw a uniformly distributed real number.
+     *
+     * @return A number in the range [min, max).
+     */
+    double uniform(double min, double max) {
+        return std::uniform_real_distribution<>(min, max)(rng);
+    }
+
+    /** Start the next value in the row. */
+    void separator() {
+        if (!rowStart) {
+            buffer += ',';
+        }
+        rowStart = false;
+    }
+
+    /** Append a text value, quoted if needed (or always, if quoteAll). */
+    void text(const std::string& value) {
+        separator();
+        const bool quote = opts.quoteAll ||
+            value.find(',') != std::string::npos;
+        if (quote) {
+            buffer += '"';
+        }
+        buffer += value;
+        if (quote) {
+            buffer += '"';
+        }
+    }
+
+    /** Append an integer value. */
+    template <typename Int>
+    void number(Int value) {
+        char str[32];
+        text(std::string(str, std::to_chars(str, str + sizeof(str),
+                                            value).ptr));
+    }
+
+    /** Append a real value with a given number of significant digits. */
+    void decimal(double value, int digits) {
+        char str[64];
+        text(std::string(str, std::snprintf(str, sizeof(str), "%.*g", digits,
+                                            value)));
+    }
+
+    /** End the row, writing the buffer out when it is full. */
+    void endRow() {
+        buffer += '\n';
+        rowStart = true;
+        if (buffer.size() >= BufferSize) {
+            flush();
+        }
+    }
+
+    /** Write the buffer out. */
+    void flush() {
+        std::fwrite(buffer.data(), 1, buffer.size(), out);
+        buffer.clear();
+    }
+
+    /** The options for generating the CSV. */
+    const Options opts;
+
+    /** The random number generator. Seeded from opts.seed. */
+    std::mt19937_64 rng;
+
+    /** The pool of words for names and titles and its distribution. */
+    std::vector<std::string> words;
+    Zipf wordZipf;
+
+    /** The pool of low-cardinality values (e.g., countries). */
+    std::vector<std::string> keys;
+    Zipf keyZipf;
+
+    /** The pool of cities. */
+    std::vector<std::string> cities;
+    Zipf cityZipf;
+
+    /** The distribution of years before 2020. */
+    Zipf yearZipf;
+
+    /** The buffer with the rows not yet written out. */
+    std::string buffer;
+
+    /** Flag to indicate if the next value starts a row. */
+    bool rowStart = true;
+
+    /** The output file. */
+    FILE* out;
+};
+
+/**
+ * Parse the command-line arguments.
+ *
+ * @param argc The number of arguments.
+ *
+ * @param argv The arguments.
+ *
+ * @return The options.
+ *
+ * @exception std::invalid_argument This method throws an exception if the
+ * arguments are invalid.
+ */
+Options parseArgs(int argc, char* argv[]) {
+    if (argc < 3 || (std::string(argv[1]) != "airports" &&
+                     std::string(argv[1]) != "movies")) {
+        throw std::invalid_argument("Usage: csv_gen {airports|movies} <rows> "
+            "[--seed <n>] [--skew <s>] [--cardinality <n>] "
+            "[--long <fraction>] [--long-length <n>] [--commas <fraction>] "
+            "[--quote-all] [-o <file>]");
+    }
+    Options opts;
+    opts.schema = argv[1];
+    opts.rows = std::stoull(argv[2]);
+    for (int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--quote-all") {
+            opts.quoteAll = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("Missing value for " + arg);
+        }
+        const std::string value = argv[++i];
+        if (arg == "--seed") {
+            opts.seed = std::stoull(value);
+        } else if (arg == "--skew") {
+            opts.skew = std::stod(value);
+        } else if (arg == "--cardinality") {
+            opts.cardinality = std::max<size_t>(std::stoull(value), 1);
+        } else if (arg == "--long") {
+            opts.longFraction = std::stod(value);
+        } else if (arg == "--long-length") {
+            opts.longLength = std::stoull(value);
+        } else if (arg == "--commas") {
+            opts.commaFraction = std::stod(value);
+        } else if (arg == "-o") {
+            opts.outFile = value;
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    return opts;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Generator(parseArgs(argc, argv)).run();
+    } catch (const std::exception& exp) {
+        std::cerr << exp.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
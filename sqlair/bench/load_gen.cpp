@@ -0,0 +1,473 @@
+/**
+ * A closed-loop HTTP load generator for the SQLAir server (see runServer).
+ * A number of client threads each send a query, wait for the response, and
+ * then send the next query. The tool reports the throughput (queries per
+ * second) and the latency percentiles (p50, p90, p99, p99.9, and max).
+ *
+ * With a target rate (--rate), each thread sends its queries on a fixed
+ * schedule. When the server falls behind, a query is sent as soon as the
+ * previous one completes, but its latency is measured from the time it
+ * was scheduled to be sent. This corrects for coordinated omission: slow
+ * responses delay the queries after them, and those delays are included
+ * in the latencies rather than hidden. The latencies measured from when
+ * the queries were actually sent (i.e., the service times) are reported
+ * too.
+ *
+ * The queries are read from workload files, which are either mt_tester
+ * test files (e.g., tests/st_select_tests.txt, where the queries and their
+ * expected outputs are quoted strings) or workload specs with a query per
+ * line, optionally preceded by a weight and a tab. Lines starting with "#"
+ * are comments. Queries are picked at random in proportion to their
+ * weights.
+ *
+ * The server closes each connection after a response ("Connection:
+ * Close"), in which case a new connection is used for each query. With
+ * --reuse, the tool asks for keep-alive connections and reuses them as
+ * long as the server does not close them.
+ *
+ * Build (from the sqlair directory) with:
+ *
+ *   g++ -std=c++17 -O2 -Wall -o load_gen bench/load_gen.cpp -lpthread
+ *
+ * Usage:
+ *
+ *   ./load_gen <port> <workload file>... [--host <host>] [--threads <n>]
+ *              [--duration <secs>] [--warmup <secs>] [--rate <qps>]
+ *              [--seed <n>] [--reuse]
+ *
+ * For example, start the server with "./sqlair 8080" and then run
+ * "./load_gen 8080 tests/st_select_tests.txt --threads 8 --rate 2000".
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using boost::asio::ip::tcp;
+
+/** The options for the load generator, from the command-line. */
+struct Options {
+    /** The host and port of the server. */
+    std::string host = "127.0.0.1", port;
+    /** The workload files with the queries. */
+    std::vector<std::string> workloads;
+    /** The number of client threads. */
+    int threads = 4;
+    /** The time (in seconds) for which latencies are recorded. */
+    double duration = 10;
+    /** The time (in seconds) before latencies are recorded. */
+    double warmup = 1;
+    /** The target rate (queries per second) over all the threads. Zero
+     * sends queries as fast as the server responds. */
+    double rate = 0;
+    /** The seed for picking queries. */
+    uint64_t seed = 1;
+    /** Flag to indicate if connections are to be kept alive and reused. */
+    bool reuse = false;
+};
+
+/** A query in the workload and its weight. */
+struct Query {
+    /** The HTTP request for the query. */
+    std::string request;
+    /** The relative frequency of the query. */
+    double weight = 1;
+};
+
+/** The results recorded by a client thread. */
+struct Results {
+    /** The latencies (in microseconds) from the scheduled send times. */
+    std::vector<double> latencies;
+    /** The latencies (in microseconds) from the actual send times. */
+    std::vector<double> serviceTimes;
+    /** The number of failed queries (e.g., errors or lost connections). */
+    size_t errors = 0;
+    /** The number of connections opened. */
+    size_t connections = 0;
+};
+
+/**
+ * Encode a query for use in a URL.
+ *
+ * @param str The query to be encoded.
+ *
+ * @return The query with characters other than letters and digits encoded
+ * as "%nn".
+ */
+std::string urlEncode(const std::string& str) {
+    std::string encoded;
+    for (const unsigned char chr : str) {
+        if (std::isalnum(chr)) {
+            encoded += chr;
+        } else {
+            char hex[4];
+            std::snprintf(hex, sizeof(hex), "%%%02X", chr);
+            encoded += hex;
+        }
+    }
+    return encoded;
+}
+
+/**
+ * Read the quoted strings in a mt_tester test file. The strings alternate
+ * between queries and their expected outputs, with "run" lines between
+ * groups of queries.
+ *
+ * @param is The test file.
+ *
+ * @return The queries in the file.
+ */
+std::vector<std::string> readTestFile(std::istream& is) {
+    std::vector<std::string> strings;
+    std::string line, str;
+    bool inQuote = false;
+    while (std::getline(is, line)) {
+        if (!inQuote && (line.empty() || line[0] == '#')) {
+            continue;
+        }
+        for (const char chr : line) {
+            if (chr == '"') {
+                if (inQuote) {
+                    strings.push_back(str);
+                    str.clear();
+                }
+                inQuote = !inQuote;
+            } else if (inQuote) {
+                str += chr;
+            }
+        }
+        if (inQuote) {
+            str += '\n';
+        }
+    }
+    // Skip the "run" strings and the expected outputs.
+    std::vector<std::string> queries;
+    bool isQuery = true;
+    for (const auto& entry : strings) {
+        if (entry == "run") {
+            isQuery = true;
+        } else {
+            if (isQuery && entry != "exit" && entry != "exit;") {
+                queries.push_back(entry);
+            }
+            isQuery = !isQuery;
+        }
+    }
+    return queries;
+}
+
+/**
+ * Read the queries in the workload files.
+ *
+ * @param opts The options with the workload files.
+ *
+ * @return The queries with their HTTP requests.
+ */
+std::vector<Query> readWorkload(const Options& opts) {
+    std::vector<Query> queries;
+    const auto add = [&](const std::string& sql, const double weight) {
+        Query query;
+        query.request = "GET /sql-air?query=" + urlEncode(sql) +
+            " HTTP/1.1\r\nHost: " + opts.host + "\r\nConnection: " +
+            (opts.reuse ? "keep-alive" : "close") + "\r\n\r\n";
+        query.weight = weight;
+        queries.push_back(query);
+    };
+    for (const auto& path : opts.workloads) {
+        std::ifstream is(path);
+        if (!is.good()) {
+            throw std::runtime_error("Unable to read " + path);
+        }
+        const bool isTestFile = (is.peek() == '"' ||
+                                 (path.size() > 4 &&
+                                  path.substr(path.size() - 4) == ".txt"));
+        if (isTestFile) {
+            for (const auto& sql : readTestFile(is)) {
+                add(sql, 1);
+            }
+            continue;
+        }
+        for (std::string line; std::getline(is, line);) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            const size_t tab = line.find('\t');
+            if (tab == std::string::npos) {
+                add(line, 1);
+            } else {
+                add(line.substr(tab + 1), std::stod(line.substr(0, tab)));
+            }
+        }
+    }
+    if (queries.empty()) {
+        throw std::runtime_error("The workload does not have any queries");
+    }
+    return queries;
+}
+
+/**
+ * A connection to the server, which is reopened as needed.
+ */
+class Connection {
+public:
+    /**
+     * Create a connection (that is opened when it is first used).
+     *
+     * @param opts The options with the host and port of the server.
+     *
+     * @param results The results where the connections are counted.
+     */
+    Connection(const Options& opts, Results& results) :
+        socket(io), opts(opts), results(results) {
+        endpoints = tcp::resolver(io).resolve(opts.host, opts.port);
+    }
+
+    /**
+     * Send a request and read the response.
+     *
+     * @param request The HTTP request to be sent.
+     *
+     * @return This method returns true if the response is "200 OK" and does
+     * not report an error.
+     */
+    bool send(const std::string& request) {
+        if (!socket.is_open()) {
+            boost::asio::connect(socket, endpoints);
+            socket.set_option(tcp::no_delay(true));
+            results.connections++;
+        }
+        boost::asio::write(socket, boost::asio::buffer(request));
+        // Read the headers and then the body (of Content-Length bytes).
+        const size_t hdrEnd = boost::asio::read_until(socket, buffer,
+                                                      "\r\n\r\n");
+        std::string headers(boost::asio::buffers_begin(buffer.data()),
+                            boost::asio::buffers_begin(buffer.data()) +
+                            hdrEnd);
+        buffer.consume(hdrEnd);
+        std::transform(headers.begin(), headers.end(), headers.begin(),
+                       [](unsigned char chr) { return std::tolower(chr); });
+        const size_t lenPos = headers.find("content-length:");
+        const size_t length = (lenPos == std::string::npos ? 0 :
+                               std::stoul(headers.substr(lenPos + 15)));
+        if (buffer.size() < length) {
+            boost::asio::read(socket, buffer, boost::asio::transfer_exactly(
+                                  length - buffer.size()));
+        }
+        const std::string body(boost::asio::buffers_begin(buffer.data()),
+                               boost::asio::buffers_begin(buffer.data()) +
+                               length);
+        buffer.consume(length);
+        if (!opts.reuse ||
+            headers.find("connection: close") != std::string::npos) {
+            close();
+        }
+        return headers.find(" 200 ") != std::string::npos &&
+            body.find("Error:") == std::string::npos;
+    }
+
+    /** Close the connection, so that it is reopened when next used. */
+    void close() {
+        boost::system::error_code err;
+        socket.close(err);
+        buffer.consume(buffer.size());
+    }
+
+private:
+    boost::asio::io_context io;
+    tcp::socket socket;
+    tcp::resolver::results_type endpoints;
+    boost::asio::streambuf buffer;
+    const Options& opts;
+    Results& results;
+};
+
+/**
+ * The main method of a client thread.
+ *
+ * @param opts The options for the load generator.
+ *
+ * @param queries The queries in the workload.
+ *
+ * @param thrIdx The index of this thread.
+ *
+ * @param start The time at which the warm-up starts.
+ *
+ * @param results The results recorded by this thread.
+ */
+void runClient(const Options& opts, const std::vector<Query>& queries,
+               const int thrIdx, const Clock::time_point start,
+               Results& results) {
+    std::mt19937_64 rng(opts.seed + thrIdx);
+    std::vector<double> weights;
+    for (const auto& query : queries) {
+        weights.push_back(query.weight);
+    }
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    const auto toTime = [](double secs) {
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(secs));
+    };
+    const auto measureFrom = start + toTime(opts.warmup);
+    const auto end = measureFrom + toTime(opts.duration);
+    // The threads send queries at evenly spaced, staggered times.
+    const auto interval = (opts.rate > 0 ? toTime(opts.threads / opts.rate) :
+                           Clock::duration::zero());
+    auto scheduled = start + interval * thrIdx / opts.threads;
+    Connection conn(opts, results);
+    // Queries still behind schedule at the end are not sent.
+    while (scheduled < end && Clock::now() < end) {
+        if (opts.rate > 0) {
+            std::this_thread::sleep_until(scheduled);
+        } else {
+            scheduled = Clock::now();
+        }
+        const auto sent = Clock::now();
+        bool ok = false;
+        try {
+            ok = conn.send(queries[pick(rng)].request);
+        } catch (const std::exception&) {
+            conn.close();
+        }
+        const auto done = Clock::now();
+        if (sent >= measureFrom) {
+            using Micros = std::chrono::duration<double, std::micro>;
+            results.latencies.push_back(Micros(done - scheduled).count());
+            results.serviceTimes.push_back(Micros(done - sent).count());
+            results.errors += !ok;
+        }
+        scheduled += interval;
+    }
+}
+
+/**
+ * Print the percentiles of a set of latencies.
+ *
+ * @param name The name of the latencies.
+ *
+ * @param latencies The latencies (in microseconds). They are sorted by
+ * this method.
+ */
+void printPercentiles(const std::string& name, std::vector<double>& latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    const auto pct = [&](double fraction) {
+        const size_t idx = static_cast<size_t>(fraction * latencies.size());
+        return latencies[std::min(idx, latencies.size() - 1)] / 1000;
+    };
+    std::printf("%-14s p50 %9.3f  p90 %9.3f  p99 %9.3f  p99.9 %9.3f  "
+                "max %9.3f ms\n", name.c_str(), pct(0.5), pct(0.9),
+                pct(0.99), pct(0.999), latencies.back() / 1000);
+}
+
+/**
+ * Parse the command-line arguments.
+ *
+ * @param argc The number of arguments.
+ *
+ * @param argv The arguments.
+ *
+ * @return The options.
+ *
+ * @exception std::invalid_argument This method throws an exception if the
+ * arguments are invalid.
+ */
+Options parseArgs(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--reuse") {
+            opts.reuse = true;
+        } else if (arg.rfind("--", 0) == 0 && i + 1 < argc) {
+            const std::string value = argv[++i];
+            if (arg == "--host") {
+                opts.host = value;
+            } else if (arg == "--threads") {
+                opts.threads = std::max(std::stoi(value), 1);
+            } else if (arg == "--duration") {
+                opts.duration = std::stod(value);
+            } else if (arg == "--warmup") {
+                opts.warmup = std::stod(value);
+            } else if (arg == "--rate") {
+                opts.rate = std::stod(value);
+            } else if (arg == "--seed") {
+                opts.seed = std::stoull(value);
+            } else {
+                throw std::invalid_argument("Unknown option " + arg);
+            }
+        } else if (opts.port.empty()) {
+            opts.port = arg;
+        } else {
+            opts.workloads.push_back(arg);
+        }
+    }
+    if (opts.port.empty() || opts.workloads.empty()) {
+        throw std::invalid_argument("Usage: load_gen <port> <workload file>... "
+            "[--host <host>] [--threads <n>] [--duration <secs>] "
+            "[--warmup <secs>] [--rate <qps>] [--seed <n>] [--reuse]");
+    }
+    return opts;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        const Options opts = parseArgs(argc, argv);
+        const std::vector<Query> queries = readWorkload(opts);
+        std::vector<Results> results(opts.threads);
+        std::vector<std::thread> threads;
+        const auto start = Clock::now();
+        for (int thr = 0; thr < opts.threads; thr++) {
+            threads.emplace_back(runClient, std::cref(opts),
+                                 std::cref(queries), thr, start,
+                                 std::ref(results[thr]));
+        }
+        for (auto& thr : threads) {
+            thr.join();
+        }
+        // The last queries may complete after the duration.
+        const double elapsed = std::chrono::duration<double>(
+            Clock::now() - start).count() - opts.warmup;
+        // Combine the results of all the threads.
+        Results total;
+        for (auto& res : results) {
+            total.latencies.insert(total.latencies.end(),
+                                   res.latencies.begin(), res.latencies.end());
+            total.serviceTimes.insert(total.serviceTimes.end(),
+                                      res.serviceTimes.begin(),
+                                      res.serviceTimes.end());
+            total.errors += res.errors;
+            total.connections += res.connections;
+        }
+        if (total.latencies.empty()) {
+            throw std::runtime_error("No queries completed");
+        }
+        std::printf("%zu queries (%zu distinct), %d threads, %.1f s: "
+                    "%.1f queries/s, %zu errors, %zu connections\n",
+                    total.latencies.size(), queries.size(), opts.threads,
+                    elapsed, total.latencies.size() / elapsed,
+                    total.errors, total.connections);
+        if (opts.rate > 0) {
+            std::printf("target rate %.1f queries/s\n", opts.rate);
+            printPercentiles("latency", total.latencies);
+        }
+        printPercentiles("service time", total.serviceTimes);
+    } catch (const std::exception& exp) {
+        std::cerr << exp.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,358 @@
+/**
+ * Benchmarks for the core operations of SQLAir -- tokenizing, loading (and
+ * freeing) CSVs, selecting (with each condition), printing, updating,
+ * inserting, and deleting rows -- using Google Benchmark. Each benchmark
+ * reports the rows processed per second (as items_per_second) and, where
+ * there is data read or written, bytes per second.
+ *
+ * The benchmarks use airports.csv and a synthetic CSV with the same
+ * schema (the rows of airports.csv repeated with unique ids). The
+ * synthetic CSV is written to the temporary directory on first use.
+ *
+ * Build (from the sqlair directory) with:
+ *
+ *   g++ -std=c++17 -O2 -Wall -I. -o sqlair_bench bench/sqlair_bench.cpp \
+ *       SQLAir.cpp libsqlair_lib.a -lbenchmark -lboost_system -lpthread
+ *
+ * and run it from the sqlair directory (so that airports.csv is found),
+ * e.g., "./sqlair_bench --benchmark_filter=Select".
+ */
+
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "SQLAir.h"
+
+namespace {
+
+/** The number of rows in the synthetic CSV. */
+constexpr size_t SyntheticRows = 1 << 17;
+
+/**
+ * SQLAir with the helper methods used by the benchmarks made accessible.
+ */
+class BenchAir : public SQLAir {
+public:
+    using SQLAir::encodeColumns;
+    using SQLAir::loadCSV;
+    using SQLAir::planColumns;
+    using SQLAir::selectHelper;
+    using SQLAir::updateHelper;
+};
+
+/**
+ * A stream buffer that discards the output written to it but counts the
+ * bytes, so that printing is measured without growing a string.
+ */
+class CountingBuf : public std::streambuf {
+public:
+    /** The number of bytes written so far. */
+    size_t bytes = 0;
+
+protected:
+    int_type overflow(int_type chr) override {
+        bytes += (chr != traits_type::eof());
+        return traits_type::not_eof(chr);
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        bytes += count;
+        return count;
+    }
+};
+
+/**
+ * The SQLAir instance shared by the benchmarks (so that each CSV is
+ * loaded once).
+ *
+ * @return The shared instance.
+ */
+BenchAir& air() {
+    static BenchAir instance;
+    return instance;
+}
+
+/**
+ * The SQLAir instance shared by the benchmarks that use dictionary encoded
+ * columns (see SQLAir::setDictionaryEncoding()).
+ *
+ * @return The shared instance.
+ */
+BenchAir& encodedAir() {
+    static BenchAir instance;
+    static std::once_flag encoding;
+    std::call_once(encoding, [] { instance.setDictionaryEncoding(true); });
+    return instance;
+}
+
+/**
+ * Read the contents of a file into a string.
+ *
+ * @param path The path to the file.
+ *
+ * @return The contents of the file.
+ */
+std::string readFile(const std::string& path) {
+    std::ifstream in(path);
+    if (!in.good()) {
+        throw Exp("Unable to read " + path + ". Run the benchmarks from the "
+                  "sqlair directory.");
+    }
+    std::ostringstream data;
+    data << in.rdbuf();
+    return data.str();
+}
+
+/**
+ * Obtain the path of the synthetic CSV, creating it if needed. It has the
+ * rows of airports.csv repeated (with unique ids) to SyntheticRows rows.
+ *
+ * @return The path to the synthetic CSV.
+ */
+const std::string& syntheticCSV() {
+    static const std::string path = [] {
+        const auto file = std::filesystem::temp_directory_path() /
+            ("sqlair_bench_" + std::to_string(SyntheticRows) + ".csv");
+        if (!std::filesystem::exists(file)) {
+            std::istringstream airports(readFile("airports.csv"));
+            std::string header, line;
+            std::getline(airports, header);
+            std::vector<std::string> rows;  // The rows without their ids
+            while (std::getline(airports, line)) {
+                if (!line.empty()) {
+                    rows.push_back(line.substr(line.find(',')));
+                }
+            }
+            std::ofstream out(file);
+            out << header << '\n';
+            for (size_t i = 0; i < SyntheticRows; i++) {
+                out << (i + 1) << rows[i % rows.size()] << '\n';
+            }
+        }
+        return file.string();
+    }();
+    return path;
+}
+
+/**
+ * Obtain the path of the CSV used by a benchmark.
+ *
+ * @param state The state of the benchmark. Its first argument is 0 for
+ * airports.csv and 1 for the synthetic CSV.
+ *
+ * @return The path to the CSV.
+ */
+std::string csvPath(const benchmark::State& state) {
+    return (state.range(0) == 0 ? "airports.csv" : syntheticCSV());
+}
+
+/** Benchmark tokenizing a query (argument 0) and a row of a CSV (1). */
+void BM_Tokenize(benchmark::State& state) {
+    const std::string query = "select name, city, country from airports.csv "
+        "where country = 'United States'";
+    std::istringstream airports(readFile("airports.csv"));
+    std::string row;
+    std::getline(airports, row);  // Skip the header
+    std::getline(airports, row);
+    const std::string& str = (state.range(0) == 0 ? query : row);
+    for (auto _ : state) {
+        StrVec tokens = (state.range(0) == 0 ? CSV::tokenize(str) :
+                         CSV::tokenize(str, ",", false, "", "", false,
+                                       false));
+        benchmark::DoNotOptimize(tokens.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * str.size());
+}
+BENCHMARK(BM_Tokenize)->Arg(0)->Arg(1);
+
+/** Benchmark loading a CSV using CSV::load(), as the base class does. */
+void BM_LoadCSV(benchmark::State& state) {
+    const std::string data = readFile(csvPath(state));
+    size_t rows = 0;
+    for (auto _ : state) {
+        std::istringstream is(data);
+        CSV csv;
+        csv.load(is);
+        rows = csv.size();
+    }
+    state.SetItemsProcessed(state.iterations() * rows);
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_LoadCSV)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+/** Benchmark loading a CSV using SQLAir::loadCSV() (the fast path). */
+void BM_LoadFast(benchmark::State& state) {
+    const std::string data = readFile(csvPath(state));
+    size_t rows = 0;
+    for (auto _ : state) {
+        std::istringstream is(data);
+        CSV csv;
+        BenchAir::loadCSV(csv, is);
+        rows = csv.size();
+    }
+    state.SetItemsProcessed(state.iterations() * rows);
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_LoadFast)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+/**
+ * Benchmark freeing (i.e., destroying) a loaded CSV, which frees each cell
+ * that did not fit in its string. The CSV is loaded untimed.
+ */
+void BM_FreeCSV(benchmark::State& state) {
+    const std::string data = readFile(csvPath(state));
+    size_t rows = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::istringstream is(data);
+        auto csv = std::make_unique<CSV>();
+        BenchAir::loadCSV(*csv, is);
+        rows = csv->size();
+        state.ResumeTiming();
+        csv.reset();
+    }
+    state.SetItemsProcessed(state.iterations() * rows);
+}
+BENCHMARK(BM_FreeCSV)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+/**
+ * Benchmark dictionary encoding the columns of a CSV. The memory used by the
+ * CSV (see CSV::memoryUsage()) before and after encoding is reported as
+ * bytes_before and bytes_after. The cells are not changed, so encoding adds
+ * to the memory used.
+ */
+void BM_EncodeColumns(benchmark::State& state) {
+    std::istringstream is(readFile(csvPath(state)));
+    CSV csv;
+    BenchAir::loadCSV(csv, is);
+    const size_t bytesBefore = csv.memoryUsage();
+    for (auto _ : state) {
+        air().encodeColumns(csv);
+    }
+    state.SetItemsProcessed(state.iterations() * csv.size());
+    state.counters["bytes_before"] = bytesBefore;
+    state.counters["bytes_after"] = csv.memoryUsage();
+}
+BENCHMARK(BM_EncodeColumns)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+/**
+ * Benchmark selecting rows with each condition: "=" (argument 0), "<>"
+ * (1), and "like" (2). The second argument is the CSV (see csvPath()).
+ * The third argument is 1 if the columns are dictionary encoded. Every row
+ * is checked, so items are the rows in the CSV.
+ */
+void BM_Select(benchmark::State& state) {
+    static const std::vector<std::pair<std::string, std::string>> Conds = {
+        {"=", "Canada"}, {"<>", "United States"}, {"like", "land"}};
+    const auto& [cond, value] = Conds.at(state.range(0));
+    BenchAir& sqlAir = (state.range(2) == 0 ? air() : encodedAir());
+    CSV& csv = sqlAir.loadAndGet(state.range(1) == 0 ? "airports.csv" :
+                                 syntheticCSV());
+    const ColumnPlan plan = sqlAir.planColumns(csv, {"name", "city",
+                                                     "country"});
+    const int colIdx = csv.getColumnIndex("country");
+    CountingBuf buf;
+    std::ostream os(&buf);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sqlAir.selectHelper(csv, plan, colIdx, cond,
+                                                     value, os));
+    }
+    state.SetItemsProcessed(state.iterations() * csv.size());
+    state.SetBytesProcessed(buf.bytes);
+}
+BENCHMARK(BM_Select)->ArgsProduct({{0, 1, 2}, {0, 1}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+/**
+ * Benchmark printing every row (i.e., "select * from <csv>"), which is
+ * dominated by formatting the rows for output.
+ */
+void BM_PrintRows(benchmark::State& state) {
+    CSV& csv = air().loadAndGet(csvPath(state));
+    const ColumnPlan plan = air().planColumns(csv, {"*"});
+    CountingBuf buf;
+    std::ostream os(&buf);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(air().selectHelper(csv, plan, -1, "", "",
+                                                    os));
+    }
+    state.SetItemsProcessed(state.iterations() * csv.size());
+    state.SetBytesProcessed(buf.bytes);
+}
+BENCHMARK(BM_PrintRows)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+/**
+ * Benchmark updating a column in the rows meeting an equality condition.
+ * The value alternates so that every update changes the rows.
+ */
+void BM_Update(benchmark::State& state) {
+    CSV& csv = air().loadAndGet(csvPath(state));
+    const ColumnPlan plans[] = {air().planColumns(csv, {"altitude"}, {"1"}),
+                                air().planColumns(csv, {"altitude"}, {"2"})};
+    const int colIdx = csv.getColumnIndex("country");
+    CountingBuf buf;
+    std::ostream os(&buf);
+    size_t updated = 0;
+    for (auto _ : state) {
+        updated += air().updateHelper(csv, plans[updated % 2], colIdx, "=",
+                                      "Canada", os);
+    }
+    state.SetItemsProcessed(state.iterations() * csv.size());
+    state.counters["rows_updated"] = benchmark::Counter(
+        updated, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Update)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+/**
+ * Benchmark inserting single rows. The inserted rows are deleted at the
+ * end (untimed), so that the CSV is unchanged for the other benchmarks.
+ */
+void BM_Insert(benchmark::State& state) {
+    CSV& csv = air().loadAndGet(csvPath(state));
+    const StrVec colNames = {"name", "city", "latitude", "longitude"};
+    const StrVec values = {"Bench Insert", "Oxford", "39.5", "-84.7"};
+    CountingBuf buf;
+    std::ostream os(&buf);
+    for (auto _ : state) {
+        air().insertQuery(csv, false, colNames, values, os);
+    }
+    // The timer is stopped after the loop.
+    air().deleteQuery(csv, false, csv.getColumnIndex("name"), "=",
+                      "Bench Insert", os);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Insert)->Arg(0)->Arg(1);
+
+/**
+ * Benchmark deleting rows. Each iteration (untimed) inserts a few rows
+ * and then deletes them, which checks every row in the CSV.
+ */
+void BM_Delete(benchmark::State& state) {
+    CSV& csv = air().loadAndGet(csvPath(state));
+    const StrVec colNames = {"name", "city"};
+    const StrVec values = {"Bench Delete", "Oxford"};
+    const int colIdx = csv.getColumnIndex("name");
+    CountingBuf buf;
+    std::ostream os(&buf);
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (int i = 0; i < 16; i++) {
+            air().insertQuery(csv, false, colNames, values, os);
+        }
+        state.ResumeTiming();
+        air().deleteQuery(csv, false, colIdx, "=", "Bench Delete", os);
+    }
+    state.SetItemsProcessed(state.iterations() * csv.size());
+}
+BENCHMARK(BM_Delete)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
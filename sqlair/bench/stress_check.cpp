@@ -0,0 +1,574 @@
+/**
+ * A mixed read/write concurrency benchmark and consistency checker for
+ * SQLAir. Worker threads run a random mix of select, update, insert,
+ * delete, and "wait select" statements (via SQLAir::process) against a
+ * CSV in-process, recording the history of the operations. The history
+ * is then checked for:
+ *
+ *   - Torn rows: each write sets two columns (a and b) of a row to the
+ *     same value, so a read with different values saw a partial write.
+ *
+ *   - Non-linearizable reads: each row is a register whose writes have
+ *     unique values. The reads and writes of each register must be
+ *     linearizable, which is checked using the zones of the values (see
+ *     checkRegister()).
+ *
+ *   - Lost updates: increments ("set counter = counter + 1") of each row
+ *     must all be reflected in the final value of the counter.
+ *
+ *   - Lost or duplicated rows: the final rows must be exactly the initial
+ *     rows and the inserted rows that were not deleted.
+ *
+ *   - Lost wake-ups: a thread waiting (via "wait select") for rows
+ *     inserted by the workers must see each of them.
+ *
+ * The workload is run with 1, 2, 4, ... up to the given number of threads
+ * (each on a fresh CSV) to report how the throughput scales.
+ *
+ * Build (from the sqlair directory) with:
+ *
+ *   g++ -std=c++17 -O2 -Wall -I. -o stress_check bench/stress_check.cpp \
+ *       SQLAir.cpp libsqlair_lib.a -lboost_system -lpthread
+ *
+ * Usage:
+ *
+ *   ./stress_check [--threads <n>] [--duration <secs>] [--rows <n>]
+ *                  [--mix select=50,update=20,incr=15,insert=5,delete=5,
+ *                         signal=5] [--seed <n>]
+ *
+ * The exit code is 1 if any check fails.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "SQLAir.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** The kinds of operations in the workload. */
+enum class OpType { Select, Update, Incr, Insert, Delete, Signal };
+
+/** The names of the operations, as used in the --mix option. */
+const std::vector<std::string> OpNames = {"select", "update", "incr",
+                                          "insert", "delete", "signal"};
+
+/** The options for the benchmark, from the command-line. */
+struct Options {
+    /** The largest number of worker threads. */
+    int threads = std::max(2u, std::thread::hardware_concurrency());
+    /** The time (in seconds) for which each run lasts. */
+    double duration = 2;
+    /** The number of rows (registers) in the CSV. */
+    int rows = 16;
+    /** The relative frequency of each kind of operation. */
+    std::vector<double> mix = {50, 20, 15, 5, 5, 5};
+    /** The seed for the random choices of the workers. */
+    uint64_t seed = 1;
+};
+
+/** A read or a write of a register (i.e., a row) in the history. */
+struct RegisterOp {
+    /** Flag to indicate if the operation is a write. */
+    bool isWrite;
+    /** The value read or written. */
+    std::string value;
+    /** The times (in ns since the start of the run) at which the operation
+     * was invoked and at which it completed. */
+    int64_t start, end;
+};
+
+/** The history recorded by a worker thread. */
+struct History {
+    /** The reads and writes of each register. */
+    std::vector<std::vector<RegisterOp>> registers;
+    /** The number of increments of each register. */
+    std::vector<size_t> increments;
+    /** The keys of the rows inserted and not deleted. */
+    std::vector<std::string> inserted;
+    /** The number of rows with different values of a and b. */
+    size_t tornRows = 0;
+    /** The number of operations that failed (e.g., exceptions). */
+    size_t errors = 0;
+    /** The number of operations completed. */
+    size_t ops = 0;
+};
+
+/**
+ * The state shared by the threads of a run.
+ */
+struct Run {
+    /** The options for the benchmark. */
+    const Options& opts;
+    /** The SQLAir instance being tested. */
+    SQLAir& air;
+    /** The path to the CSV. */
+    std::string csv;
+    /** The time at which the run started. */
+    Clock::time_point start;
+    /** The number of signal rows inserted (or being inserted). */
+    std::atomic<size_t> signals = {0};
+    /** The number of the final signal row, once the workers are done. */
+    std::atomic<size_t> finalSignal = {SIZE_MAX};
+    /** The number of signal rows seen by the waiting thread. */
+    std::atomic<size_t> seen = {0};
+    /** The time (in ns) at which the insert of each signal row completed
+     * and at which the waiting thread saw it. */
+    std::vector<std::atomic<int64_t>> signalDone, signalSeen;
+
+    Run(const Options& opts, SQLAir& air) : opts(opts), air(air),
+        signalDone(1 << 20), signalSeen(1 << 20) {}
+
+    /** Obtain the time (in ns) since the start of the run. */
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count();
+    }
+
+    /**
+     * Run a statement.
+     *
+     * @param sql The statement to be run.
+     *
+     * @param[out] out The output of the statement.
+     *
+     * @return This method returns false if the statement failed.
+     */
+    bool exec(const std::string& sql, std::string& out) {
+        std::ostringstream os;
+        try {
+            air.process(sql, os);
+        } catch (const std::exception& exp) {
+            out = exp.what();
+            return false;
+        }
+        out = os.str();
+        return true;
+    }
+};
+
+/**
+ * Split the output of a statement into lines.
+ *
+ * @param out The output.
+ *
+ * @return The lines in the output.
+ */
+StrVec lines(const std::string& out) {
+    StrVec result;
+    std::istringstream is(out);
+    for (std::string line; std::getline(is, line);) {
+        result.push_back(line);
+    }
+    return result;
+}
+
+/**
+ * The main method of a worker thread. It runs random operations until the
+ * end of the run.
+ *
+ * @param run The state of the run.
+ *
+ * @param thrIdx The index of this thread.
+ *
+ * @param hist The history recorded by this thread.
+ */
+void runWorker(Run& run, const int thrIdx, History& hist) {
+    std::mt19937_64 rng(run.opts.seed * 7919 + thrIdx);
+    std::discrete_distribution<int> pickOp(run.opts.mix.begin(),
+                                           run.opts.mix.end());
+    std::uniform_int_distribution<int> pickRow(0, run.opts.rows - 1);
+    hist.registers.resize(run.opts.rows);
+    hist.increments.resize(run.opts.rows);
+    const int64_t end = run.opts.duration * 1e9;
+    std::string out;
+    for (size_t seq = 0; run.now() < end; seq++) {
+        const int row = pickRow(rng);
+        const std::string key = "'r" + std::to_string(row) + "'";
+        const int64_t start = run.now();
+        bool ok = true;
+        switch (static_cast<OpType>(pickOp(rng))) {
+        case OpType::Select: {
+            ok = run.exec("select a, b from " + run.csv + " where key = " +
+                          key, out);
+            const StrVec res = lines(out);
+            const size_t tab = (res.size() == 3 ? res[1].find('\t') :
+                                std::string::npos);
+            if (ok && tab != std::string::npos) {
+                const std::string valA = res[1].substr(0, tab);
+                hist.tornRows += (valA != res[1].substr(tab + 1));
+                hist.registers[row].push_back({false, valA, start,
+                                               run.now()});
+            } else {
+                ok = false;
+            }
+            break;
+        }
+        case OpType::Update: {
+            // The values written are unique: "<thread>.<sequence>"
+            const std::string value = "'" + std::to_string(thrIdx + 1) + "." +
+                std::to_string(seq) + "'";
+            ok = run.exec("update " + run.csv + " set a = " + value +
+                          ", b = " + value + " where key = " + key, out) &&
+                out.find("1 row(s) updated.") == 0;
+            hist.registers[row].push_back({true, value.substr(1,
+                                           value.size() - 2), start,
+                                           run.now()});
+            break;
+        }
+        case OpType::Incr:
+            ok = run.exec("update " + run.csv + " set counter = counter + 1 "
+                          "where key = " + key, out) &&
+                out.find("1 row(s) updated.") == 0;
+            hist.increments[row] += ok;
+            break;
+        case OpType::Insert: {
+            const std::string ins = "i" + std::to_string(thrIdx) + "-" +
+                std::to_string(seq);
+            ok = run.exec("insert into " + run.csv + " (key, a, b, counter) "
+                          "values ('" + ins + "', 0, 0, 0)", out);
+            if (ok) {
+                hist.inserted.push_back(ins);
+            }
+            break;
+        }
+        case OpType::Delete:
+            if (!hist.inserted.empty()) {
+                // Delete a random row inserted by this thread.
+                const size_t idx = rng() % hist.inserted.size();
+                std::swap(hist.inserted[idx], hist.inserted.back());
+                ok = run.exec("delete from " + run.csv + " where key = '" +
+                              hist.inserted.back() + "'", out);
+                if (ok) {
+                    hist.inserted.pop_back();
+                }
+            }
+            break;
+        case OpType::Signal: {
+            const size_t num = run.signals++;
+            if (num + 1 >= run.signalDone.size()) {
+                break;  // Too many signals for this run
+            }
+            ok = run.exec("insert into " + run.csv + " (key, a, b, counter) "
+                          "values ('s" + std::to_string(num) + "', 0, 0, 0)",
+                          out);
+            run.signalDone[num] = run.now();
+            break;
+        }
+        }
+        hist.errors += !ok;
+        hist.ops++;
+    }
+}
+
+/**
+ * The main method of the thread that waits (via "wait select") for each
+ * signal row in turn, until it sees the final signal row.
+ *
+ * @param run The state of the run.
+ */
+void runWaiter(Run& run) {
+    std::string out;
+    for (size_t num = 0; num < run.signalSeen.size(); num++) {
+        run.exec("wait select key from " + run.csv + " where key = 's" +
+                 std::to_string(num) + "'", out);
+        run.signalSeen[num] = run.now();
+        run.seen = num + 1;
+        if (num == run.finalSignal) {
+            break;
+        }
+    }
+}
+
+/**
+ * Check that the history of a register is linearizable. Each written value
+ * is unique, so each read is matched to its write. The operations on each
+ * value form a cluster, and the zone of a cluster spans from the earliest
+ * end to the latest start of its operations. A zone is a forward zone if
+ * the earliest end precedes the latest start (and a backward zone
+ * otherwise). The history is linearizable if no read precedes its write,
+ * no two forward zones overlap, and no backward zone is within a forward
+ * zone (Gibbons and Korach, 1997).
+ *
+ * @param ops The reads and writes of the register by all the threads. The
+ * initial value of "0" is written before the run starts.
+ *
+ * @param[out] error A description of the first violation, if any.
+ *
+ * @return This method returns true if the history is linearizable.
+ */
+bool checkRegister(const std::vector<RegisterOp>& ops, std::string& error) {
+    struct Zone {
+        int64_t minEnd = INT64_MAX, maxStart = INT64_MIN;
+        int64_t writeStart = INT64_MAX;
+        bool written = false;
+    };
+    std::unordered_map<std::string, Zone> zones;
+    zones["0"] = {-1, -1, -1, true};
+    for (const auto& op : ops) {
+        Zone& zone = zones[op.value];
+        zone.minEnd = std::min(zone.minEnd, op.end);
+        zone.maxStart = std::max(zone.maxStart, op.start);
+        if (op.isWrite) {
+            zone.written = true;
+            zone.writeStart = op.start;
+        }
+    }
+    for (const auto& op : ops) {
+        const Zone& zone = zones[op.value];
+        if (!zone.written || (!op.isWrite && op.end < zone.writeStart)) {
+            error = "read of value " + op.value + " before it was written";
+            return false;
+        }
+    }
+    std::vector<std::pair<int64_t, int64_t>> forward, backward;
+    for (const auto& [value, zone] : zones) {
+        (zone.minEnd < zone.maxStart ? forward : backward)
+            .emplace_back(std::min(zone.minEnd, zone.maxStart),
+                          std::max(zone.minEnd, zone.maxStart));
+    }
+    std::sort(forward.begin(), forward.end());
+    for (size_t i = 1; i < forward.size(); i++) {
+        if (forward[i].first < forward[i - 1].second) {
+            error = "overlapping forward zones (a stale read)";
+            return false;
+        }
+    }
+    for (const auto& [low, high] : backward) {
+        // The forward zone starting last before the backward zone.
+        auto zone = std::lower_bound(forward.begin(), forward.end(),
+                                     std::make_pair(low, INT64_MIN));
+        if (zone != forward.begin() && (--zone)->second > high) {
+            error = "backward zone within a forward zone (a stale read)";
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Run the workload with a given number of threads and check the history.
+ *
+ * @param opts The options for the benchmark.
+ *
+ * @param numThreads The number of worker threads.
+ *
+ * @param runIdx The index of this run, used to name the CSV.
+ *
+ * @return This method returns true if all the checks pass.
+ */
+bool runWorkload(const Options& opts, const int numThreads,
+                 const int runIdx) {
+    SQLAir air;
+    Run run(opts, air);
+    run.csv = (std::filesystem::temp_directory_path() /
+               ("sqlair_stress_" + std::to_string(runIdx) + ".csv")).string();
+    {
+        std::ofstream csv(run.csv);
+        csv << "key,a,b,counter\n";
+        for (int row = 0; row < opts.rows; row++) {
+            csv << 'r' << row << ",0,0,0\n";
+        }
+    }
+    std::string out;
+    run.exec("use " + run.csv, out);
+    run.start = Clock::now();
+    std::vector<History> hists(numThreads);
+    std::vector<std::thread> threads;
+    for (int thr = 0; thr < numThreads; thr++) {
+        threads.emplace_back(runWorker, std::ref(run), thr,
+                             std::ref(hists[thr]));
+    }
+    std::thread waiter(runWaiter, std::ref(run));
+    for (auto& thr : threads) {
+        thr.join();
+    }
+    const double elapsed = run.now() / 1e9;
+    // A final signal row lets the waiting thread finish.
+    const size_t final = run.signals++;
+    run.finalSignal = final;
+    run.exec("insert into " + run.csv + " (key, a, b, counter) values ('s" +
+             std::to_string(final) + "', 0, 0, 0)", out);
+    run.signalDone[final] = run.now();
+    const auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (run.seen <= final && Clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::vector<std::string> failures;
+    if (run.seen <= final) {
+        failures.push_back("wait select did not return for signal row s" +
+                           std::to_string(run.seen.load()) +
+                           " (lost wake-up)");
+        waiter.detach();  // It is blocked
+    } else {
+        waiter.join();
+    }
+    // Combine the histories and check them.
+    History total;
+    total.registers.resize(opts.rows);
+    total.increments.resize(opts.rows);
+    for (const auto& hist : hists) {
+        for (int row = 0; row < opts.rows; row++) {
+            total.registers[row].insert(total.registers[row].end(),
+                                        hist.registers[row].begin(),
+                                        hist.registers[row].end());
+            total.increments[row] += hist.increments[row];
+        }
+        total.inserted.insert(total.inserted.end(), hist.inserted.begin(),
+                              hist.inserted.end());
+        total.tornRows += hist.tornRows;
+        total.errors += hist.errors;
+        total.ops += hist.ops;
+    }
+    if (total.tornRows > 0) {
+        failures.push_back(std::to_string(total.tornRows) + " torn rows");
+    }
+    if (total.errors > 0) {
+        failures.push_back(std::to_string(total.errors) + " failed "
+                           "operations");
+    }
+    for (int row = 0; row < opts.rows; row++) {
+        std::string error;
+        if (!checkRegister(total.registers[row], error)) {
+            failures.push_back("row r" + std::to_string(row) +
+                               " is not linearizable: " + error);
+        }
+    }
+    // The final rows must be the initial rows (with all the increments),
+    // the inserted rows that were not deleted, and the signal rows.
+    std::map<std::string, std::string> expected;
+    for (int row = 0; row < opts.rows; row++) {
+        expected["r" + std::to_string(row)] =
+            std::to_string(total.increments[row]);
+    }
+    for (const auto& key : total.inserted) {
+        expected[key] = "0";
+    }
+    for (size_t num = 0; num <= final; num++) {
+        expected["s" + std::to_string(num)] = "0";
+    }
+    run.exec("select key, counter from " + run.csv, out);
+    std::map<std::string, std::string> actual;
+    size_t duplicates = 0;
+    const StrVec res = lines(out);
+    for (size_t i = 1; i + 1 < res.size(); i++) {
+        const size_t tab = res[i].find('\t');
+        duplicates += !actual.emplace(res[i].substr(0, tab),
+                                      res[i].substr(tab + 1)).second;
+    }
+    for (const auto& [key, counter] : expected) {
+        const auto row = actual.find(key);
+        if (row == actual.end()) {
+            failures.push_back("row " + key + " is missing");
+        } else if (row->second != counter) {
+            failures.push_back("row " + key + " has counter " + row->second +
+                               " instead of " + counter + " (lost update)");
+        }
+    }
+    if (duplicates > 0 || actual.size() != expected.size()) {
+        failures.push_back(std::to_string(duplicates) + " duplicated and " +
+                           std::to_string(actual.size() + duplicates -
+                                          expected.size()) +
+                           " unexpected rows");
+    }
+    int64_t maxWake = 0;
+    for (size_t num = 0; num <= final && num < run.seen; num++) {
+        maxWake = std::max(maxWake, run.signalSeen[num] - run.signalDone[num]);
+    }
+    std::printf("%3d threads: %9.0f ops/s  (%zu ops, %zu signals, "
+                "max wake-up %.3f ms)  %s\n", numThreads, total.ops / elapsed,
+                total.ops, final, maxWake / 1e6,
+                failures.empty() ? "OK" : "FAILED");
+    for (size_t i = 0; i < std::min<size_t>(failures.size(), 10); i++) {
+        std::printf("    %s\n", failures[i].c_str());
+    }
+    std::filesystem::remove(run.csv);
+    return failures.empty();
+}
+
+/**
+ * Parse the command-line arguments.
+ *
+ * @param argc The number of arguments.
+ *
+ * @param argv The arguments.
+ *
+ * @return The options.
+ *
+ * @exception std::invalid_argument This method throws an exception if the
+ * arguments are invalid.
+ */
+Options parseArgs(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; i += 2) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("Usage: stress_check [--threads <n>] "
+                "[--duration <secs>] [--rows <n>] "
+                "[--mix select=50,update=20,...] [--seed <n>]");
+        }
+        const std::string value = argv[i + 1];
+        if (arg == "--threads") {
+            opts.threads = std::max(std::stoi(value), 1);
+        } else if (arg == "--duration") {
+            opts.duration = std::stod(value);
+        } else if (arg == "--rows") {
+            opts.rows = std::max(std::stoi(value), 1);
+        } else if (arg == "--seed") {
+            opts.seed = std::stoull(value);
+        } else if (arg == "--mix") {
+            std::fill(opts.mix.begin(), opts.mix.end(), 0);
+            std::istringstream is(value);
+            for (std::string entry; std::getline(is, entry, ',');) {
+                const size_t eq = entry.find('=');
+                const auto name = std::find(OpNames.begin(), OpNames.end(),
+                                            entry.substr(0, eq));
+                if (eq == std::string::npos || name == OpNames.end()) {
+                    throw std::invalid_argument("Invalid mix entry " + entry);
+                }
+                opts.mix[name - OpNames.begin()] =
+                    std::stod(entry.substr(eq + 1));
+            }
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    return opts;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        const Options opts = parseArgs(argc, argv);
+        bool passed = true;
+        int runIdx = 0;
+        for (int numThreads = 1; ; numThreads = std::min(numThreads * 2,
+                                                         opts.threads)) {
+            passed = runWorkload(opts, numThreads, runIdx++) && passed;
+            if (numThreads == opts.threads) {
+                break;
+            }
+        }
+        std::cout << (passed ? "All checks passed." : "Some checks failed.")
+                  << std::endl;
+        // A waiting thread may still be blocked after a failure.
+        std::quick_exit(passed ? 0 : 1);
+    } catch (const std::exception& exp) {
+        std::cerr << exp.what() << std::endl;
+        return 1;
+    }
+}
@@ -11,6 +11,10 @@ var cmdID = 1;
 // to estimate the time taken to get response from the server.
 var startTime = 0;
 
+// A random token to identify this page's session with the server. It
+// enables commands (such as "use") to affect subsequent commands.
+var sessionID = Math.random().toString(36).substring(2);
+
 /**
  * This method intercepts and handles the enter key by sending a request
  * to the SQLAir web-serer.
@@ -129,7 +133,8 @@ function run(cmd) {
         // Run the command.
         console.log("Running command: " + cmd);
         cmd = encodeURIComponent(cmd);
-        xhttp.open("GET", "/sql-air?query=" + cmd, false);
+        xhttp.open("GET", "/sql-air?session=" + sessionID + "&query=" + cmd,
+                   false);
         // Save the tarting time.
         startTime = new Date().getMilliseconds();
         xhttp.send();